@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# balance.sh
+#
+# Checks that calls balanced over several servers keep being answered while
+# one of them fails: starts three suiteservers over loopback tcp, and runs
+# suiteclient -b over all of them while the second is killed, and started
+# again, a few times
+#  - usage: bench/balance.sh [seconds [threads]]  (from the top level
+#    directory, with COMP117 set, as for make)
+#  - calls in flight to the killed server may fail; suiteclient exits 1
+#    unless the others kept answering throughout
+#  - also fails if the client holds more sockets near the end than its
+#    connections to the three servers, ie. connections to the killed server
+#    were not closed once it was ejected
+#
+# by: Justin Jo and Charles Wan
+
+SECONDS_PER_RUN=${1:-4}
+THREADS=${2:-4}
+PORT=${BENCHPORT:-24800}
+SERVERS=localhost:$PORT,localhost:$((PORT + 1)),localhost:$((PORT + 2))
+
+make -s bench/suiteserver bench/suiteclient || exit 1
+
+bench/suiteserver -p $PORT &
+FIRST=$!
+bench/suiteserver -p $((PORT + 1)) &
+KILLED=$!
+bench/suiteserver -p $((PORT + 2)) &
+LAST=$!
+sleep 0.5
+
+bench/suiteclient -b $SERVERS $SECONDS_PER_RUN $THREADS &
+CLIENT=$!
+
+# kill the second server and start it again, three times over the run
+STEP=$(awk "BEGIN { print $SECONDS_PER_RUN / 8 }")
+for i in 1 2 3; do
+    sleep $STEP
+    kill $KILLED
+    wait $KILLED 2>/dev/null
+    sleep $STEP
+    bench/suiteserver -p $((PORT + 1)) &
+    KILLED=$!
+done
+
+# stdin, stdout, stderr and a few more, besides a socket per connection
+sleep $STEP
+FDS=$(ls /proc/$CLIENT/fd 2>/dev/null | wc -l)
+MOST=$((3 * THREADS + 8))
+
+wait $CLIENT
+STATUS=$?
+
+kill $FIRST $KILLED $LAST
+wait 2>/dev/null
+
+if [ $FDS -gt $MOST ]; then
+    echo "balance.sh: Client held $FDS files, at most $MOST expected" >&2
+    STATUS=1
+fi
+exit $STATUS
@@ -0,0 +1,29 @@
+#!/bin/bash
+#
+# batch.sh
+#
+# Compares calls made one at a time with the same calls made through
+# <func>_batch, over loopback tcp, for a range of batch sizes
+#  - usage: bench/batch.sh [calls]  (from the top level directory, with
+#    COMP117 set, as for make)
+#  - builds bench/benchserver and bench/benchclient; the echo and sum lines
+#    of each run are calls one at a time, echo[n] and sum[n] the same calls
+#    n to a batch
+#
+# by: Justin Jo and Charles Wan
+
+CALLS=${1:-20000}
+PORT=${BENCHPORT:-24700}
+
+make -s bench/benchserver bench/benchclient || exit 1
+
+bench/benchserver -p $PORT -t 1 &
+SERVER=$!
+sleep 0.5
+
+for BATCH in 10 100 1000; do
+    bench/benchclient localhost:$PORT $CALLS $BATCH
+done
+
+kill $SERVER
+wait $SERVER 2>/dev/null
@@ -0,0 +1,19 @@
+// bench.cpp
+//
+// Defines the functions declared in bench.idl
+//
+// by: Justin Jo and Charles Wan
+
+#include "bench.idl"
+
+int echo(int x) {
+    return x;
+}
+
+int sum(int a[256]) {
+    int total = 0;
+    for (int i = 0; i < 256; i++) {
+        total += a[i];
+    }
+    return total;
+}
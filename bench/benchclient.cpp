@@ -0,0 +1,178 @@
+// benchclient.cpp
+//
+// Times calls to the functions in bench.idl against a running benchserver
+//  - usage: ./benchclient <server name> [calls [batch size]]
+//  - prints one line per function: calls made, mean round trip and calls per
+//    second; see uring.sh and transports.sh for the comparisons it is run for
+//  - then makes the same calls again with <func>_batch, batch size calls at
+//    a time, printed as eg. echo[1000]; see batch.sh
+//  - built with BENCH_IN_PROCESS, as benchmem, the stubs are linked in too
+//    and served on mem:bench, so calls cost no system calls at all
+//
+// by: Justin Jo and Charles Wan
+
+
+// define debug file, can be set by compiler
+#ifndef _DEBUG_FILE_
+#define _DEBUG_FILE_ NULL
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "rpcproxyhelper.h"
+#include "c150debug.h"
+#include "c150grading.h"
+#include "rpcutils.h"
+#ifdef BENCH_IN_PROCESS
+#include "rpcpoolserver.h"
+#endif
+
+using namespace std;
+using namespace C150NETWORK;
+
+#include "bench.proxy.h"
+
+
+// fwd declarations
+void usage(char *progname, int exitCode);
+void report(const char *servername, const char *funcname, int calls,
+            long long startUs);
+long long nowUs();
+
+
+// cmd line args
+const int serverArg = 1;
+const int callsArg = 2;
+const int batchArg = 3;
+
+// constants
+const int DEFAULT_CALLS = 20000;
+const int WARMUP_CALLS = 100;
+const int DEFAULT_BATCH = 1000;
+
+
+// ==========
+// 
+// MAIN
+//
+// ==========
+
+int main(int argc, char *argv[]) {
+    GRADEME(argc, argv); // obligatory grading line
+
+    // cmd line handling
+    if (argc < 2 || argc > 4) {
+        usage(argv[0], 1);
+    }
+    int calls = (argc >= 3) ? atoi(argv[callsArg]) : DEFAULT_CALLS;
+    int batch = (argc == 4) ? atoi(argv[batchArg]) : DEFAULT_BATCH;
+    if (calls <= 0 || batch <= 0) usage(argv[0], 1);
+    string batchName = "[" + to_string(batch) + "]";
+
+    // debugging, off so that logging is not what gets timed
+    initDebugLog(_DEBUG_FILE_, argv[0], 0);
+
+    try {
+#ifdef BENCH_IN_PROCESS
+        rpcmemoryserve("bench");
+#endif
+
+        // create socket
+        rpcproxyinitialize(argv[serverArg]);
+
+        int a[256];
+        for (int i = 0; i < 256; i++) a[i] = i;
+
+        for (int i = 0; i < WARMUP_CALLS; i++) echo(i);
+
+        long long start = nowUs();
+        for (int i = 0; i < calls; i++) {
+            if (echo(i) != i) throw RPCException("benchclient: Bad echo");
+        }
+        report(argv[serverArg], "echo", calls, start);
+
+        start = nowUs();
+        for (int i = 0; i < calls; i++) {
+            if (sum(a) != 255 * 128) throw RPCException("benchclient: Bad sum");
+        }
+        report(argv[serverArg], "sum", calls, start);
+
+        // the same calls in batches, built before the clock starts
+        vector<vector<echo_args>> echoes;
+        vector<vector<sum_args>> sums;
+        for (int i = 0; i < calls; i++) {
+            if (i % batch == 0) {
+                echoes.emplace_back();
+                sums.emplace_back();
+            }
+            echoes.back().push_back({i});
+            sums.back().emplace_back();
+            copy(a, a + 256, sums.back().back().a);
+        }
+
+        start = nowUs();
+        for (size_t b = 0; b < echoes.size(); b++) {
+            vector<RPCBatchResult<int>> res = echo_batch(echoes[b]);
+            for (size_t i = 0; i < res.size(); i++) {
+                if (res[i].code != success || res[i].res != echoes[b][i].x)
+                    throw RPCException("benchclient: Bad echo batch");
+            }
+        }
+        report(argv[serverArg], ("echo" + batchName).c_str(), calls, start);
+
+        start = nowUs();
+        for (size_t b = 0; b < sums.size(); b++) {
+            vector<RPCBatchResult<int>> res = sum_batch(sums[b]);
+            for (size_t i = 0; i < res.size(); i++) {
+                if (res[i].code != success || res[i].res != 255 * 128)
+                    throw RPCException("benchclient: Bad sum batch");
+            }
+        }
+        report(argv[serverArg], ("sum" + batchName).c_str(), calls, start);
+
+    } catch (C150Exception &e) {
+        // write to debug log
+        c150debug->printf(
+            C150ALWAYSLOG,
+            "Caught %s",
+            e.formattedExplanation().c_str()
+        );
+        cerr << argv[0] << ": " << e.formattedExplanation() << endl; 
+        return 1;
+    }
+    return 0;
+}
+
+
+// ==========
+// 
+// DEFS
+//
+// ==========
+
+// Prints command line usage to stderr and exits
+void usage(char *progname, int exitCode) {
+    fprintf(stderr, "usage: %s <servername> [calls [batch size]]\n", progname);
+    exit(exitCode);
+}
+
+// Prints the timing of calls calls to funcname, made since startUs
+void report(const char *servername, const char *funcname, int calls,
+            long long startUs) {
+    double elapsedUs = nowUs() - startUs;
+    printf("%-28s %-11s %8d calls %9.2f us/call %10.0f calls/s\n",
+           servername, funcname, calls, elapsedUs / calls,
+           calls / (elapsedUs / 1e6));
+    fflush(stdout);
+}
+
+// Monotonic clock in us
+long long nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
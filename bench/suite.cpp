@@ -0,0 +1,51 @@
+// suite.cpp
+//
+// Defines the functions declared in suite.idl, each as little work as it
+// takes to prove every arg arrived, so the suite times the calls; but fail,
+// which always throws, for checking that a call whose function throws is
+// still answered
+//
+// by: Justin Jo and Charles Wan
+
+#include <string>
+#include "rpcutils.h"
+
+using namespace std;
+
+#include "suite.idl"
+
+int add(int x, int y) {
+    return x + y;
+}
+
+float total(float v[65536]) {
+    float sum = 0;
+    for (int i = 0; i < 65536; i++) {
+        sum += v[i];
+    }
+    return sum;
+}
+
+int checksum(Shape shapes[128]) {
+    int sum = 0;
+    for (int s = 0; s < 128; s++) {
+        sum += shapes[s].id;
+        for (int c = 0; c < 8; c++) {
+            sum += (int)(shapes[s].corners[c].x + shapes[s].corners[c].y +
+                         shapes[s].corners[c].z);
+        }
+    }
+    return sum;
+}
+
+int letters(string words[1024]) {
+    int count = 0;
+    for (int i = 0; i < 1024; i++) {
+        count += words[i].length();
+    }
+    return count;
+}
+
+int fail(int x) {
+    throw RPCException("fail: Thrown on purpose, x=" + to_string(x));
+}
@@ -0,0 +1,45 @@
+#!/bin/bash
+#
+# suite.sh
+#
+# Runs the benchmark suite: suiteclient against a suiteserver over loopback
+# tcp, each workload in suite.idl at several numbers of client threads, and
+# writes the results as json, for comparing versions
+#  - usage: bench/suite.sh [out.json [seconds [threads,threads,...]]]  (from
+#    the top level directory, with COMP117 set, as for make); make bench runs
+#    it, writing bench/results.json
+#  - builds bench/suiteserver and bench/suiteclient, and everything they
+#    are made of, as a release build: RPCGENFLAGS=-r and LOGFLAGS=
+#    "-DRPC_NO_LOGGING -DRPC_NO_GRADING", unless either is set, eg. empty to
+#    time the default build with its logging. The server runs on its thread
+#    pool, one worker per core
+#  - results are labelled with $BENCHLABEL, or else the git commit, if there
+#    is one, and record the flags they were built with as config
+#
+# by: Justin Jo and Charles Wan
+
+OUT=${1:-/dev/stdout}
+SECONDS_PER_RUN=${2:-1}
+THREADS=${3:-1,4,16}
+PORT=${BENCHPORT:-24800}
+export BENCHLABEL=${BENCHLABEL:-$(git describe --always --dirty 2>/dev/null)}
+export RPCGENFLAGS=${RPCGENFLAGS--r}
+export LOGFLAGS=${LOGFLAGS--DRPC_NO_LOGGING -DRPC_NO_GRADING}
+export BENCHCONFIG="RPCGENFLAGS=$RPCGENFLAGS LOGFLAGS=$LOGFLAGS"
+
+# make does not track flags, so everything the suite is made of is rebuilt,
+# but for idl_to_json, which they do not change
+make -s idl_to_json || exit 1
+make -s -B -o idl_to_json bench/suiteserver bench/suiteclient \
+    RPCGENFLAGS="$RPCGENFLAGS" LOGFLAGS="$LOGFLAGS" || exit 1
+
+bench/suiteserver -p $PORT &
+SERVER=$!
+sleep 0.5
+
+bench/suiteclient localhost:$PORT $SECONDS_PER_RUN $THREADS > $OUT
+STATUS=$?
+
+kill $SERVER
+wait $SERVER 2>/dev/null
+exit $STATUS
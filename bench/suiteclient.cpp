@@ -0,0 +1,388 @@
+// suiteclient.cpp
+//
+// Times the workloads in suite.idl against a running suiteserver, from
+// several client threads at once, and prints the results as json
+//  - usage: ./suiteclient [-b] <server name> [seconds [threads,threads,...]]
+//  - first checks that calls to fail, whose function throws, are answered
+//    with func_failed, alone and in a batch, and that the connection still
+//    works after them; exits 1 if not
+//  - workloads: ints, two scalar ints; floats, a 256KB float array; structs,
+//    an array of structs of struct arrays; strings, 1024 short strings
+//  - each workload is run for seconds (default 1) at each number of threads
+//    (default 1,4,16); every thread makes calls on its own connection until
+//    time is up, and times each one
+//  - prints one json object, whose runs hold each run's calls/s, MB/s of
+//    request and response frames, and latency percentiles in us; with
+//    $BENCHLABEL set, eg. to a version, it is included as label, so results
+//    of different versions can be told apart, and $BENCHCONFIG, the flags
+//    it was built with, as config; see suite.sh
+//  - with -b, only checks that calls balanced over several servers keep
+//    being answered while one of them is killed, see balance.sh
+//
+// by: Justin Jo and Charles Wan
+
+
+// define debug file, can be set by compiler
+#ifndef _DEBUG_FILE_
+#define _DEBUG_FILE_ NULL
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "rpcproxyhelper.h"
+#include "c150debug.h"
+#include "c150grading.h"
+#include "rpcutils.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+#include "suite.proxy.h"
+
+
+// Workload
+//  - one kind of call to time: call makes one and checks its result, bytes
+//    is what its request and response frames take on the wire
+
+struct Workload {
+    const char *name;
+    const char *funcname;
+    size_t bytes;
+    function<void()> call;
+};
+
+// Run
+//  - the result of one workload at one number of threads
+struct Run {
+    const Workload *workload;
+    int threads;
+    long long calls;
+    double seconds;
+    vector<long long> latencies; // ns, sorted
+};
+
+
+// fwd declarations
+void usage(char *progname, int exitCode);
+vector<int> parseThreads(const char *list);
+void checkFailures();
+int checkBalance(double seconds, int threads);
+Run runWorkload(const Workload &workload, int threads, double seconds);
+void printJson(const char *servername, double seconds,
+               const vector<Run> &runs);
+long long percentile(const vector<long long> &sorted, double p);
+
+
+// cmd line args
+const int serverArg = 1;
+const int secondsArg = 2;
+const int threadsArg = 3;
+
+// constants
+const double DEFAULT_SECONDS = 1.0;
+const char DEFAULT_THREADS[] = "1,4,16";
+const int WARMUP_CALLS = 20;
+const int BALANCE_SLICES = 10;
+const size_t FRAME_HEADERS = 24; // request's and response's, see rpcutils.h
+
+const int FLOATS = 65536;
+const int SHAPES = 128;
+const int CORNERS = 8;
+const int WORDS = 1024;
+
+
+// ==========
+//
+// MAIN
+//
+// ==========
+
+int main(int argc, char *argv[]) {
+    GRADEME(argc, argv); // obligatory grading line
+
+    // cmd line handling, -b shifts the rest along
+    bool balance = (argc >= 2 && strcmp(argv[1], "-b") == 0);
+    int shift = balance ? 1 : 0;
+    if (argc - shift < 2 || argc - shift > 4) {
+        usage(argv[0], 1);
+    }
+    char *servername = argv[serverArg + shift];
+    double seconds = (argc - shift >= 3) ? atof(argv[secondsArg + shift])
+                                         : DEFAULT_SECONDS;
+    vector<int> levels = parseThreads((argc - shift == 4)
+                                      ? argv[threadsArg + shift]
+                                      : DEFAULT_THREADS);
+    if (seconds <= 0 || levels.empty()) usage(argv[0], 1);
+
+    // debugging, off so that logging is not what gets timed
+    initDebugLog(_DEBUG_FILE_, argv[0], 0);
+
+    try {
+        // one connection per thread at the most threads, so threads only
+        // share the server, not a connection
+        int most = *max_element(levels.begin(), levels.end());
+        rpcproxyinitialize(servername, most);
+        if (balance) {
+            return checkBalance(seconds, most);
+        }
+
+        checkFailures();
+
+        // args, built before any clock starts; only read by the calls, so
+        // every thread shares them
+        float *v = new float[FLOATS];
+        float vTotal = 0;
+        for (int i = 0; i < FLOATS; i++) {
+            v[i] = i % 8;
+            vTotal += v[i];
+        }
+
+        Shape *shapes = new Shape[SHAPES];
+        int shapesSum = 0;
+        for (int s = 0; s < SHAPES; s++) {
+            shapes[s].id = s;
+            shapesSum += s;
+            for (int c = 0; c < CORNERS; c++) {
+                shapes[s].corners[c] = {(float)c, (float)s, 1};
+                shapesSum += c + s + 1;
+            }
+        }
+
+        string *words = new string[WORDS];
+        int wordsLetters = 0;
+        size_t wordsBytes = 0;
+        for (int i = 0; i < WORDS; i++) {
+            words[i] = "w" + to_string(i);
+            wordsLetters += words[i].length();
+            wordsBytes += 4 + words[i].length() + 1; // see writeString
+        }
+
+        vector<Workload> workloads = {
+            {"ints", "add", FRAME_HEADERS + 2 * 4 + 4, [] {
+                if (add(20, 22) != 42)
+                    throw RPCException("suiteclient: Bad add");
+            }},
+            {"floats", "total", FRAME_HEADERS + FLOATS * 4 + 4, [=] {
+                if (total(v) != vTotal)
+                    throw RPCException("suiteclient: Bad total");
+            }},
+            {"structs", "checksum",
+             FRAME_HEADERS + SHAPES * (4 + CORNERS * 3 * 4) + 4, [=] {
+                if (checksum(shapes) != shapesSum)
+                    throw RPCException("suiteclient: Bad checksum");
+            }},
+            {"strings", "letters", FRAME_HEADERS + wordsBytes + 4, [=] {
+                if (letters(words) != wordsLetters)
+                    throw RPCException("suiteclient: Bad letters");
+            }},
+        };
+
+        vector<Run> runs;
+        for (const Workload &workload : workloads) {
+            for (int i = 0; i < WARMUP_CALLS; i++) workload.call();
+            for (int threads : levels) {
+                runs.push_back(runWorkload(workload, threads, seconds));
+            }
+        }
+        printJson(servername, seconds, runs);
+
+    } catch (C150Exception &e) {
+        // write to debug log
+        c150debug->printf(
+            C150ALWAYSLOG,
+            "Caught %s",
+            e.formattedExplanation().c_str()
+        );
+        cerr << argv[0] << ": " << e.formattedExplanation() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+
+// ==========
+//
+// DEFS
+//
+// ==========
+
+// Prints command line usage to stderr and exits
+void usage(char *progname, int exitCode) {
+    fprintf(stderr,
+            "usage: %s [-b] <servername> [seconds [threads,threads,...]]\n",
+            progname);
+    exit(exitCode);
+}
+
+// Reads a comma separated list of thread counts, empty if any is not one
+vector<int> parseThreads(const char *list) {
+    vector<int> levels;
+    stringstream in(list);
+    string item;
+    while (getline(in, item, ',')) {
+        int threads = atoi(item.c_str());
+        if (threads <= 0) return {};
+        levels.push_back(threads);
+    }
+    return levels;
+}
+
+// Throws unless fail's calls, which always throw on the server, fail one by
+// one, and the calls after each still get their own answers
+void checkFailures() {
+    bool threw = false;
+    try {
+        fail(1);
+    } catch (const RPCException &e) {
+        threw = true;
+    }
+    if (!threw || add(1, 2) != 3) {
+        throw RPCException("suiteclient: Failed call not answered");
+    }
+
+    vector<RPCBatchResult<int>> res = fail_batch({{1}, {2}, {3}});
+    if (res.size() != 3) {
+        throw RPCException("suiteclient: Failed batch not answered");
+    }
+    for (RPCBatchResult<int> &each : res) {
+        if (each.code != func_failed) {
+            throw RPCException("suiteclient: Failed batch call not answered");
+        }
+    }
+    if (add(3, 4) != 7) {
+        throw RPCException("suiteclient: Failed batch not answered");
+    }
+}
+
+// Makes add calls from threads threads for seconds, over every server the
+// client was given, while balance.sh kills and restarts one of them; calls
+// in flight to it may fail, but some call must be answered in every tenth
+// of the run. Prints the counts as json, returns the exit code
+int checkBalance(double seconds, int threads) {
+    atomic<long long> answered[BALANCE_SLICES];
+    atomic<long long> failed(0);
+    for (atomic<long long> &each : answered) each = 0;
+
+    long long start = rpcNowNs();
+    long long sliceNs = (long long)(seconds * 1e9) / BALANCE_SLICES;
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            long long now;
+            while ((now = rpcNowNs()) < start + sliceNs * BALANCE_SLICES) {
+                try {
+                    if (add(20, 22) != 42)
+                        throw RPCException("suiteclient: Bad add");
+                    answered[(now - start) / sliceNs]++;
+                } catch (C150Exception &e) {
+                    failed++; // its server was killed
+                }
+            }
+        });
+    }
+    for (thread &worker : workers) worker.join();
+
+    bool kept = true;
+    printf("{\n  \"failed\": %lld,\n  \"answered\": [", failed.load());
+    for (int s = 0; s < BALANCE_SLICES; s++) {
+        printf("%s%lld", (s > 0) ? ", " : "", answered[s].load());
+        if (answered[s] == 0) kept = false;
+    }
+    printf("]\n}\n");
+    fflush(stdout);
+    if (!kept) {
+        cerr << "suiteclient: Calls stopped being answered" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Makes workload's calls from threads threads at once for seconds, timing
+// each; rethrows the first exception any thread caught
+Run runWorkload(const Workload &workload, int threads, double seconds) {
+    vector<vector<long long>> latencies(threads);
+    vector<exception_ptr> errors(threads);
+    vector<thread> workers;
+
+    long long start = rpcNowNs();
+    long long deadline = start + (long long)(seconds * 1e9);
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            try {
+                long long now = rpcNowNs();
+                while (now < deadline) {
+                    workload.call();
+                    long long done = rpcNowNs();
+                    latencies[t].push_back(done - now);
+                    now = done;
+                }
+            } catch (...) {
+                errors[t] = current_exception();
+            }
+        });
+    }
+    for (thread &worker : workers) worker.join();
+    long long end = rpcNowNs();
+
+    for (exception_ptr &error : errors) {
+        if (error) rethrow_exception(error);
+    }
+
+    Run run = {&workload, threads, 0, (end - start) / 1e9, {}};
+    for (vector<long long> &each : latencies) {
+        run.latencies.insert(run.latencies.end(), each.begin(), each.end());
+    }
+    sort(run.latencies.begin(), run.latencies.end());
+    run.calls = run.latencies.size();
+    return run;
+}
+
+// Prints every run as one json object on stdout
+void printJson(const char *servername, double seconds,
+               const vector<Run> &runs) {
+    const char *label = getenv("BENCHLABEL");
+    const char *config = getenv("BENCHCONFIG");
+    printf("{\n  \"label\": \"%s\",\n  \"config\": \"%s\",\n"
+           "  \"server\": \"%s\",\n  \"seconds\": %g,\n  \"runs\": [\n",
+           (label != NULL) ? label : "", (config != NULL) ? config : "",
+           servername, seconds);
+
+    for (size_t r = 0; r < runs.size(); r++) {
+        const Run &run = runs[r];
+        double callsPerSec = run.calls / run.seconds;
+        printf("    {\"workload\": \"%s\", \"function\": \"%s\", "
+               "\"threads\": %d, \"calls\": %lld, \"bytes_per_call\": %zu,\n"
+               "     \"calls_per_sec\": %.1f, \"mb_per_sec\": %.3f,\n"
+               "     \"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, "
+               "\"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}}%s\n",
+               run.workload->name, run.workload->funcname, run.threads,
+               run.calls, run.workload->bytes, callsPerSec,
+               callsPerSec * run.workload->bytes / 1e6,
+               percentile(run.latencies, 0.5) / 1e3,
+               percentile(run.latencies, 0.9) / 1e3,
+               percentile(run.latencies, 0.99) / 1e3,
+               percentile(run.latencies, 0.999) / 1e3,
+               percentile(run.latencies, 1.0) / 1e3,
+               (r + 1 < runs.size()) ? "," : "");
+    }
+    printf("  ]\n}\n");
+    fflush(stdout);
+}
+
+// The latency in sorted that fraction p of the calls took at most, 0 if
+// there were none
+long long percentile(const vector<long long> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)(p * sorted.size() + 0.5);
+    return sorted[min(sorted.size() - 1, (rank > 0) ? rank - 1 : 0)];
+}
@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# transports.sh
+#
+# Compares the transports a client can reach a server over: loopback tcp, a
+# unix domain socket, shared memory, and a memory transport inside one process
+#  - usage: bench/transports.sh [calls]  (from the top level directory, with
+#    COMP117 set, as for make)
+#  - builds bench/benchserver, bench/benchclient and bench/benchmem; the
+#    socket runs use one worker, so they differ only in transport
+#
+# by: Justin Jo and Charles Wan
+
+CALLS=${1:-20000}
+PORT=${BENCHPORT:-24600}
+SOCKPATH=${BENCHSOCK:-/tmp/benchserver.$$.sock}
+SHMPATH=$SOCKPATH.shm
+
+make -s bench/benchserver bench/benchclient bench/benchmem || exit 1
+
+bench/benchserver -p $PORT -t 1 &
+TCPSERVER=$!
+bench/benchserver -s $SOCKPATH -t 1 &
+UNIXSERVER=$!
+bench/benchserver -s $SHMPATH -m &
+SHMSERVER=$!
+sleep 0.5
+
+bench/benchclient localhost:$PORT $CALLS
+bench/benchclient unix:$SOCKPATH $CALLS
+bench/benchclient shm:$SHMPATH $CALLS
+bench/benchclient shmpoll:$SHMPATH $CALLS
+bench/benchmem mem:bench $CALLS
+
+kill $TCPSERVER $UNIXSERVER $SHMSERVER
+wait $TCPSERVER $UNIXSERVER $SHMSERVER 2>/dev/null
+rm -f $SOCKPATH $SHMPATH
@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# uring.sh
+#
+# Compares the io_uring server and transport with the epoll, thread pool and
+# plain socket paths, over loopback
+#  - usage: bench/uring.sh [calls]  (from the top level directory, with
+#    COMP117 set, as for make)
+#  - builds bench/benchserver and bench/benchclient, then times each client
+#    transport against each server loop on its own port
+#
+# by: Justin Jo and Charles Wan
+
+CALLS=${1:-20000}
+PORT=${BENCHPORT:-24600}
+
+make -s bench/benchserver bench/benchclient || exit 1
+
+for LOOP in "-t 1" "-e" "-u"; do
+    bench/benchserver -p $PORT $LOOP &
+    SERVER=$!
+    sleep 0.5
+
+    echo "== benchserver -p $PORT $LOOP"
+    for NAME in localhost:$PORT uring:localhost:$PORT; do
+        bench/benchclient $NAME $CALLS
+    done
+
+    kill $SERVER
+    wait $SERVER 2>/dev/null
+    PORT=$((PORT + 1))
+done
@@ -0,0 +1,65 @@
+// rpcbalance.cpp
+//
+// Defines the policies that spread a client's calls over its servers
+//
+// by: Justin Jo and Charles Wan
+
+#include <random>
+#include "rpcbalance.h"
+
+
+// RPCEndpoint::recordLatency
+//  - folds one round trip into latencyUs, weighting it 1/8
+//  - samples from different threads may race and one be lost, which an
+//    average does not mind
+
+void RPCEndpoint::recordLatency(long long us) {
+    long long old = latencyUs.load(memory_order_relaxed);
+    latencyUs.store(old == 0 ? us : old + (us - old) / 8,
+                    memory_order_relaxed);
+}
+
+
+// RPCRoundRobin::choose
+//  - see rpcbalance.h
+
+int RPCRoundRobin::choose(RPCEndpoint **endpoints, int count) {
+    return next.fetch_add(1, memory_order_relaxed) % count;
+}
+
+
+// RPCLeastOutstanding::choose
+//  - see rpcbalance.h
+
+int RPCLeastOutstanding::choose(RPCEndpoint **endpoints, int count) {
+    int best = 0;
+    for (int i = 1; i < count; i++) {
+        if (endpoints[i]->outstanding < endpoints[best]->outstanding) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+// _cost
+//  - what RPCPowerOfTwo compares: expected wait for a call sent now
+
+static long long _cost(RPCEndpoint *endpoint) {
+    return endpoint->latencyUs * (endpoint->outstanding + 1);
+}
+
+
+// RPCPowerOfTwo::choose
+//  - see rpcbalance.h
+
+int RPCPowerOfTwo::choose(RPCEndpoint **endpoints, int count) {
+    if (count == 1) return 0;
+
+    static thread_local minstd_rand rng(random_device{}());
+    int a = rng() % count;
+    int b = rng() % (count - 1);
+    if (b >= a) b++; // two different ones
+
+    return (_cost(endpoints[b]) < _cost(endpoints[a])) ? b : a;
+}
@@ -0,0 +1,88 @@
+// rpcbalance.h
+//
+// Declares how a client given several servers spreads its calls over them,
+// see rpcproxyinitialize: what the proxies know about each endpoint, and the
+// policies that pick one of them for each call
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCBALANCE_H_
+#define _RPCBALANCE_H_
+
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+
+// RPCEndpoint
+//  - one of the servers a client was given, as the policies see it
+//  - outstanding is how many calls have been sent to it and not answered
+//  - latencyUs is a moving average of its round trips, from request sent to
+//    response read, 0 until one has been measured
+//  - index is its place in the list it was given in
+
+struct RPCEndpoint {
+    string name;
+    int index;
+    atomic<int> outstanding;
+    atomic<long long> latencyUs;
+
+    RPCEndpoint(const string &name, int index) :
+        name(name), index(index), outstanding(0), latencyUs(0)
+    {};
+
+    void recordLatency(long long us);
+};
+
+
+// RPCBalancer
+//  - a policy for spreading calls, subclassed for each one; pass one to
+//    rpcproxybalance to use it
+//  - choose is given the endpoints that are currently healthy, at least one,
+//    and returns the position of the one the next call goes to; it is called
+//    from many threads at once
+
+class RPCBalancer {
+public:
+    virtual ~RPCBalancer() {};
+    virtual int choose(RPCEndpoint **endpoints, int count) = 0;
+};
+
+
+// RPCRoundRobin
+//  - each endpoint in turn; the default
+
+class RPCRoundRobin : public RPCBalancer {
+private:
+    atomic<unsigned> next;
+
+public:
+    RPCRoundRobin() : next(0) {};
+    int choose(RPCEndpoint **endpoints, int count);
+};
+
+
+// RPCLeastOutstanding
+//  - the endpoint with the fewest calls in flight, the first of them on a
+//    tie, so a slow server is given fewer calls
+
+class RPCLeastOutstanding : public RPCBalancer {
+public:
+    int choose(RPCEndpoint **endpoints, int count);
+};
+
+
+// RPCPowerOfTwo
+//  - two endpoints at random, and of those the one whose latency, scaled by
+//    its calls in flight, is lower; an endpoint not measured yet wins, so
+//    every one is tried
+//  - looks at two endpoints, not all, so it costs the same however many
+//    there are, and never sends everything to the single best one at once
+
+class RPCPowerOfTwo : public RPCBalancer {
+public:
+    int choose(RPCEndpoint **endpoints, int count);
+};
+
+#endif
@@ -0,0 +1,98 @@
+// rpccoro.cpp
+//
+// Defines the executor that coroutine handlers and the coroutines waiting on
+// nested calls run on
+//
+// by: Justin Jo and Charles Wan
+
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "c150debug.h"
+#include "rpccoro.h"
+
+using namespace C150NETWORK;
+
+
+// coroutines ready to run, for the executor's threads
+static deque<coroutine_handle<>> runQueue;
+static mutex runMutex;
+static condition_variable runCond;
+static atomic<bool> started(false);
+
+
+// runLoop
+//  - resumes ready coroutines forever, each until it next suspends or ends
+
+static void runLoop() {
+    while (1) {
+        coroutine_handle<> h;
+        {
+            unique_lock<mutex> lock(runMutex);
+            runCond.wait(lock, [] { return !runQueue.empty(); });
+            h = runQueue.front();
+            runQueue.pop_front();
+        }
+        h.resume();
+    }
+}
+
+
+// RPCExecutor::start
+//  - starts nthreads threads, if the executor has not started yet
+
+void RPCExecutor::start(int nthreads) {
+    lock_guard<mutex> lock(runMutex);
+    if (started) return;
+    started = true;
+
+    c150debug->printf(C150RPCDEBUG, "RPCExecutor: Starting %d threads",
+                      nthreads);
+    for (int i = 0; i < nthreads; i++) {
+        thread(runLoop).detach();
+    }
+}
+
+
+// RPCExecutor::schedule
+//  - queues h to be resumed, starting the executor if need be
+
+void RPCExecutor::schedule(coroutine_handle<> h) {
+    if (!started) {
+        int nthreads = thread::hardware_concurrency();
+        start(nthreads < 2 ? 2 : nthreads);
+    }
+    {
+        lock_guard<mutex> lock(runMutex);
+        runQueue.push_back(h);
+    }
+    runCond.notify_one();
+}
+
+
+// RPCExecutor::detach
+//  - runs task to the end, and logs anything it throws, since there is no
+//    one to rethrow it to
+
+RPCDetached RPCExecutor::detach(RPCTask<void> task) {
+    try {
+        co_await task;
+    } catch (C150Exception &e) {
+        c150debug->printf(C150RPCDEBUG, "RPCExecutor: Caught %s",
+                          e.formattedExplanation().c_str());
+    } catch (exception &e) {
+        c150debug->printf(C150RPCDEBUG, "RPCExecutor: Caught %s", e.what());
+    } catch (...) {
+        c150debug->printf(C150RPCDEBUG, "RPCExecutor: Caught an exception");
+    }
+}
+
+
+// RPCExecutor::spawn
+//  - see rpccoro.h
+
+void RPCExecutor::spawn(RPCTask<void> task) {
+    schedule(detach(move(task)).h);
+}
@@ -0,0 +1,199 @@
+// rpccoro.h
+//
+// Declares coroutine support, for server functions that make calls of their
+// own to other rpc servers: a task type for coroutine handlers, the executor
+// they run on, and the awaitable that <func>_await proxies return
+//  - needs c++20
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCCORO_H_
+#define _RPCCORO_H_
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <type_traits>
+#include <utility>
+#include "rpcproxyhelper.h"
+
+using namespace std;
+
+
+template <class T> class RPCTask;
+
+
+// RPCTaskPromiseBase
+//  - what every RPCTask's promise has: the coroutine waiting on it, resumed
+//    straight from its final suspend, and any exception it ended with
+//  - tasks start suspended and only run once awaited
+
+struct RPCTaskPromiseBase {
+    coroutine_handle<> continuation;
+    exception_ptr error;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; };
+        template <class P>
+        coroutine_handle<> await_suspend(coroutine_handle<P> h) noexcept {
+            coroutine_handle<> next = h.promise().continuation;
+            return next ? next : noop_coroutine();
+        };
+        void await_resume() noexcept {};
+    };
+
+    suspend_always initial_suspend() noexcept { return {}; };
+    FinalAwaiter final_suspend() noexcept { return {}; };
+    void unhandled_exception() { error = current_exception(); };
+};
+
+template <class T>
+struct RPCTaskPromise : RPCTaskPromiseBase {
+    T value;
+
+    RPCTask<T> get_return_object();
+    void return_value(T v) { value = move(v); };
+    T result() {
+        if (error) rethrow_exception(error);
+        return move(value);
+    };
+};
+
+template <>
+struct RPCTaskPromise<void> : RPCTaskPromiseBase {
+    RPCTask<void> get_return_object();
+    void return_void() {};
+    void result() {
+        if (error) rethrow_exception(error);
+    };
+};
+
+
+// RPCTask
+//  - result of a coroutine that returns T: a coroutine handler, or anything
+//    a handler awaits
+//  - co_await runs it and gives its result, or rethrows what it threw;
+//    the task owns its coroutine, which it destroys when it goes away
+
+template <class T>
+class RPCTask {
+public:
+    typedef RPCTaskPromise<T> promise_type;
+
+    explicit RPCTask(coroutine_handle<promise_type> h) : h(h) {};
+    RPCTask(RPCTask &&other) : h(other.h) { other.h = nullptr; };
+    RPCTask(const RPCTask &) = delete;
+    ~RPCTask() { if (h) h.destroy(); };
+
+    bool await_ready() { return false; };
+    coroutine_handle<> await_suspend(coroutine_handle<> waiter) {
+        h.promise().continuation = waiter;
+        return h;
+    };
+    T await_resume() { return h.promise().result(); };
+
+private:
+    coroutine_handle<promise_type> h;
+};
+
+template <class T>
+RPCTask<T> RPCTaskPromise<T>::get_return_object() {
+    return RPCTask<T>(coroutine_handle<RPCTaskPromise<T>>::from_promise(*this));
+}
+
+inline RPCTask<void> RPCTaskPromise<void>::get_return_object() {
+    return RPCTask<void>(
+        coroutine_handle<RPCTaskPromise<void>>::from_promise(*this));
+}
+
+
+// RPCDetached
+//  - a coroutine no one awaits: it starts suspended, is handed to the
+//    executor by the one that made it, and frees itself when it ends
+
+struct RPCDetached {
+    struct promise_type {
+        RPCDetached get_return_object() {
+            return RPCDetached{coroutine_handle<promise_type>::from_promise(*this)};
+        };
+        suspend_always initial_suspend() noexcept { return {}; };
+        suspend_never final_suspend() noexcept { return {}; };
+        void return_void() {};
+        void unhandled_exception() { terminate(); }; // callers catch all
+    };
+
+    coroutine_handle<promise_type> h;
+};
+
+
+// RPCExecutor
+//  - the few threads that coroutines run on; a coroutine waiting on a nested
+//    call is not on any of them, and is scheduled again when the response
+//    arrives, so a handful of threads carry any number of calls in flight
+//  - started on first use with one thread per core, or at least 2, unless
+//    start is called first
+
+class RPCExecutor {
+private:
+    template <class T>
+    static RPCDetached signal(RPCTask<T> task, promise<T> &done);
+    static RPCDetached detach(RPCTask<void> task);
+
+public:
+    static void start(int nthreads);
+    static void schedule(coroutine_handle<> h); // resumes h on a thread
+
+    static void spawn(RPCTask<void> task); // runs task, for no one to await
+    template <class T>
+    static T wait(RPCTask<T> task); // runs task, blocking until it is done
+};
+
+template <class T>
+RPCDetached RPCExecutor::signal(RPCTask<T> task, promise<T> &done) {
+    try {
+        if constexpr (is_void<T>::value) {
+            co_await task;
+            done.set_value();
+        } else {
+            done.set_value(co_await task);
+        }
+    } catch (...) {
+        done.set_exception(current_exception());
+    }
+}
+
+template <class T>
+T RPCExecutor::wait(RPCTask<T> task) {
+    promise<T> done;
+    future<T> result = done.get_future();
+    schedule(signal(move(task), done).h);
+    return result.get();
+}
+
+
+// RPCCall
+//  - what a <func>_await proxy returns: a call already sent, which co_await
+//    waits for without holding a thread, and then receives with the
+//    function's <func>_recv
+//  - like a call id, every one must be awaited exactly once
+
+template <class T>
+class RPCCall {
+private:
+    RPCCallId callid;
+    T (*recv)(RPCCallId);
+
+public:
+    RPCCall(RPCCallId callid, T (*recv)(RPCCallId)) :
+        callid(callid), recv(recv)
+    {};
+
+    bool await_ready() { return false; };
+    bool await_suspend(coroutine_handle<> h) {
+        // the response may come, and h run on, before this even returns
+        return rpcproxyoncomplete(callid, [h] { RPCExecutor::schedule(h); });
+    };
+    T await_resume() { return recv(callid); };
+};
+
+#endif
@@ -0,0 +1,267 @@
+// rpcepollserver.cpp
+//
+// Defines the event loop server: one epoll set over the listener and every
+// connection, whose frames and responses are kept by RPCEventConnection
+//
+// by: Justin Jo and Charles Wan
+
+
+#include <vector>
+#include <unordered_map>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "c150debug.h"
+#include "rpcepollserver.h"
+#include "rpceventconn.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+
+// constants
+const size_t MAX_QUEUED_OUTPUT = 1 << 20; // stop reading a client past this
+const int MAX_EVENTS = 256; // per epoll_wait
+const int ACCEPT_BACKOFF_MS = 100; // accepting pauses this long when out of fds
+
+
+// EpollConnection
+//  - a client socket, its frames and queued responses, and what epoll is
+//    watching it for
+
+struct EpollConnection {
+    int fd;
+    RPCEventConnection conn;
+    uint32_t events;
+
+    EpollConnection(int fd, int timeout) :
+        fd(fd), conn(timeout), events(EPOLLIN)
+    {};
+};
+
+
+// readInput
+//  - does a single non-blocking read into the connection's input buffer and
+//    answers whatever frames it completes
+//  - marks the connection closing on eof or error
+
+static void readInput(EpollConnection *c) {
+    size_t space;
+    char *dst = c->conn.readSpace(space);
+
+    ssize_t readlen = recv(c->fd, dst, space, 0);
+    if (readlen > 0) {
+        c->conn.received(readlen);
+    } else if (readlen == 0 || (errno != EAGAIN && errno != EINTR)) {
+        c150debug->printf(C150RPCDEBUG, "rpcepollserver: EOF signaled on input");
+        c->conn.closing = true;
+    }
+}
+
+
+// writeOutput
+//  - writes as much queued output as the socket takes without blocking
+//
+// returns: false if the connection is broken
+
+static bool writeOutput(EpollConnection *c) {
+    RPCEventConnection &conn = c->conn;
+    while (conn.queued() > 0) {
+        ssize_t writelen = send(c->fd, conn.out.data() + conn.outSent,
+                                conn.queued(), MSG_NOSIGNAL);
+        if (writelen < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            return false;
+        }
+        conn.sent(writelen);
+    }
+    return true;
+}
+
+
+// closeConnection
+//  - stops watching the connection, closes it and forgets it
+
+static void closeConnection(int epfd, EpollConnection *c,
+                            unordered_map<int, EpollConnection *> &conns) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    conns.erase(c->fd);
+    delete c;
+}
+
+
+// serviceConnection
+//  - handles readiness on a connection: reads and parses if readable, writes
+//    whatever is queued, then closes it or updates what epoll watches for
+//  - a client whose responses are piling up is not read from until they
+//    drain, so it cannot make the server buffer without limit
+
+static void serviceConnection(int epfd, EpollConnection *c, uint32_t ready,
+                              unordered_map<int, EpollConnection *> &conns) {
+    if (ready & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        readInput(c);
+    }
+
+    if (!writeOutput(c)) {
+        c150debug->printf(C150RPCDEBUG,
+            "rpcepollserver: Write failed, closing connection");
+        closeConnection(epfd, c, conns);
+        return;
+    }
+
+    size_t queued = c->conn.queued();
+    if (c->conn.closing && queued == 0) {
+        closeConnection(epfd, c, conns);
+        return;
+    }
+
+    uint32_t events = 0;
+    if (!c->conn.closing && queued < MAX_QUEUED_OUTPUT) events |= EPOLLIN;
+    if (queued > 0) events |= EPOLLOUT;
+    if (events != c->events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+}
+
+
+// acceptConnections
+//  - accepts every client waiting on the listener, non-blocking, and starts
+//    watching each for input
+//
+//  returns: false if it ran out of fds, so the clients left waiting keep
+//           the listener readable until some close
+
+static bool acceptConnections(int epfd, int listenfd, int timeout,
+                              unordered_map<int, EpollConnection *> &conns) {
+    while (1) {
+        int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE ||
+                errno == ENOBUFS || errno == ENOMEM) {
+                c150debug->printf(C150RPCDEBUG,
+                    "rpcepollserver: Out of fds, pausing accepts");
+                return false;
+            }
+            return true; // EAGAIN, all accepted
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        EpollConnection *c = new EpollConnection(fd, timeout);
+        struct epoll_event ev;
+        ev.events = c->events;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        conns[fd] = c;
+        c150debug->printf(C150RPCDEBUG, "rpcepollserver: Accepted client");
+    }
+}
+
+
+// watchListener
+//  - starts or stops watching the listener for clients; stopped while out
+//    of fds, since it stays readable and epoll_wait would return at once
+
+static void watchListener(int epfd, int listenfd, bool watch) {
+    struct epoll_event ev;
+    ev.events = watch ? EPOLLIN : 0;
+    ev.data.ptr = NULL; // the listener
+    epoll_ctl(epfd, EPOLL_CTL_MOD, listenfd, &ev);
+}
+
+
+// expireConnections
+//  - closes every connection whose partial frame is past its deadline
+
+static void expireConnections(int epfd,
+                              unordered_map<int, EpollConnection *> &conns) {
+    long long now = rpcNowMs();
+    vector<EpollConnection *> expired;
+    for (auto &entry : conns) {
+        EpollConnection *c = entry.second;
+        if (c->conn.expired(now)) expired.push_back(c);
+    }
+
+    for (EpollConnection *c : expired) {
+        c150debug->printf(C150RPCDEBUG, "rpcepollserver: Socket timed out");
+        closeConnection(epfd, c, conns);
+    }
+}
+
+
+// rpcepollserve
+//  - see rpcepollserver.h
+
+void rpcepollserve(RPCListener &listener, int timeout) {
+    int listenfd = listener.fileno();
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) throw RPCException("rpcepollserver: Could not create epoll");
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listener
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+    c150debug->printf(C150RPCDEBUG,
+        "rpcepollserver: Listening on %s", listener.address());
+
+    // deadlines are checked a few times per timeout, so a stalled frame is
+    // closed at most half a timeout late
+    int scanInterval = (timeout != 0) ? (timeout + 1) / 2 : -1;
+    long long nextScan = rpcNowMs() + scanInterval;
+
+    // while out of fds, the listener is watched again once a connection
+    // closes, or after a backoff in case the fds are held elsewhere
+    bool accepting = true;
+    size_t connsWhenFull = 0;
+    long long acceptRetry = 0;
+
+    unordered_map<int, EpollConnection *> conns;
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int wait = scanInterval;
+        if (!accepting && (wait < 0 || wait > ACCEPT_BACKOFF_MS)) {
+            wait = ACCEPT_BACKOFF_MS;
+        }
+        int nready = epoll_wait(epfd, events, MAX_EVENTS, wait);
+
+        for (int i = 0; i < nready; i++) {
+            EpollConnection *c = (EpollConnection *)events[i].data.ptr;
+            if (c == NULL) {
+                if (!acceptConnections(epfd, listenfd, timeout, conns)) {
+                    watchListener(epfd, listenfd, false);
+                    accepting = false;
+                    connsWhenFull = conns.size();
+                    acceptRetry = rpcNowMs() + ACCEPT_BACKOFF_MS;
+                }
+            } else {
+                serviceConnection(epfd, c, events[i].events, conns);
+            }
+        }
+
+        if (timeout != 0 && rpcNowMs() >= nextScan) {
+            expireConnections(epfd, conns);
+            nextScan = rpcNowMs() + scanInterval;
+        }
+
+        if (!accepting &&
+            (conns.size() < connsWhenFull || rpcNowMs() >= acceptRetry)) {
+            watchListener(epfd, listenfd, true);
+            accepting = true;
+        }
+    }
+}
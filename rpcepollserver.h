@@ -0,0 +1,30 @@
+// rpcepollserver.h
+//
+// Declares the event loop server, which serves any number of clients on a
+// single thread with non-blocking sockets
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCEPOLLSERVER_H_
+#define _RPCEPOLLSERVER_H_
+
+#include "rpcstubhelper.h"
+
+
+// rpcepollserve
+//  - accepts on listener and serves every client that connects, until the process
+//    is killed
+//  - every socket is non-blocking and watched by one epoll set; each
+//    connection parses frames incrementally out of its own input buffer, so
+//    partial frames cost nothing while the rest is in flight
+//  - each complete request is answered with dispatchRequest, in order, and
+//    its response queued on the connection; queued responses are written
+//    whenever the socket can take them
+//  - suited to many mostly idle clients; calls run on the loop thread, so a
+//    slow function delays every client, unlike rpcpoolserve
+//  - timeout: ms allowed for each request once it starts arriving; idle
+//    connections are kept open until the client closes them
+
+void rpcepollserve(RPCListener &listener, int timeout);
+
+#endif
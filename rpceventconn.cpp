@@ -0,0 +1,184 @@
+// rpceventconn.cpp
+//
+// Defines the per-connection frame parser and response queue shared by the
+// event loop servers
+//
+// by: Justin Jo and Charles Wan
+
+
+#include <cstring>
+#include "c150debug.h"
+#include "rpceventconn.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+
+// constants
+const size_t INITIAL_INPUT = 16384; // bytes, grows for larger frames
+
+
+// RPCEventConnection
+//  - timeout: ms allowed for each frame once it starts arriving, 0 for none
+
+RPCEventConnection::RPCEventConnection(int timeout) :
+    in(INITIAL_INPUT), start(0), end(0), matched(false), timeout(timeout),
+    need(0), outSent(0), closing(false), deadline(0)
+{}
+
+
+// RPCEventConnection::parse
+//  - answers the handshake, then every complete request frame in data, in
+//    order, appending each response to out; stops at the first partial frame
+//    and notes in need how many bytes it takes
+//
+//  returns: number of bytes of data used
+
+size_t RPCEventConnection::parse(const char *data, size_t len) {
+    size_t used = 0;
+    need = 0;
+    while (!closing) {
+        const char *p = data + used;
+        size_t avail = len - used;
+
+        if (!matched) {
+            if (avail < 4) break;
+            RPCCursor idIn(p, 4);
+            StatusCode code = rpcstubcheckinterface(extractInt(idIn));
+            RPCWriter codeOut(NULL);
+            writeInt(codeOut, code);
+            codeOut.moveTo(out);
+            used += 4;
+            matched = true;
+            if (code != matching_interface) {
+                c150debug->printf(C150RPCDEBUG,
+                    "rpceventconn: Proxy idl does not match stubs");
+                closing = true;
+            }
+            continue;
+        }
+
+        // header: func id, call id, args size
+        if (avail < 12) break;
+        RPCCursor header(p, 12);
+        uint32_t funcid = extractInt(header);
+        uint32_t callid = extractInt(header);
+        int argsSize = extractInt(header);
+        if (argsSize < 0 || argsSize > MAX_FRAME_ARGS) {
+            c150debug->printf(C150RPCDEBUG,
+                "rpceventconn: Args size %d out of range, closing connection",
+                argsSize);
+            closing = true;
+            break;
+        }
+
+        size_t frameSize = 12 + (size_t)argsSize;
+        if (avail < frameSize) {
+            need = frameSize;
+            break;
+        }
+
+        // whole frame is here, answer it in place
+        RPCCursor argsIn(p + 12, argsSize);
+        RPCWriter resOut(NULL);
+        dispatchRequest(funcid, callid, argsIn, resOut);
+        resOut.moveTo(out);
+        used += frameSize;
+        deadline = 0; // next frame gets its own
+    }
+    return used;
+}
+
+
+// RPCEventConnection::settle
+//  - after parsing: rewinds an empty buffer, moves a partial frame to the
+//    front, and arms its deadline if it is new; the buffer only grows as the
+//    rest of the frame arrives, see readSpace and receive
+
+void RPCEventConnection::settle() {
+    if (start == end) {
+        start = end = 0; // empty, rewind for free
+        deadline = 0;
+        return;
+    }
+
+    if (start + need > in.size()) {
+        memmove(&in[0], &in[start], end - start);
+        end -= start;
+        start = 0;
+    }
+
+    if (deadline == 0 && timeout != 0) deadline = rpcNowMs() + timeout;
+}
+
+
+// RPCEventConnection::readSpace
+//  - free space at the end of the input buffer, making room if there is none
+//
+//  returns: where to read to; len is set to how many bytes fit
+
+char *RPCEventConnection::readSpace(size_t &len) {
+    if (end == in.size()) {
+        if (start > 0) {
+            memmove(&in[0], &in[start], end - start);
+            end -= start;
+            start = 0;
+        } else {
+            in.resize(in.size() * 2);
+        }
+    }
+
+    len = in.size() - end;
+    return &in[end];
+}
+
+
+// RPCEventConnection::received
+//  - len bytes were read into readSpace; answers whatever is now complete
+
+void RPCEventConnection::received(size_t len) {
+    end += len;
+    start += parse(&in[start], end - start);
+    settle();
+}
+
+
+// RPCEventConnection::receive
+//  - bytes that were read into some other buffer, eg. one the kernel picked
+//  - when nothing is buffered, complete frames are answered straight out of
+//    data and only a trailing partial frame is copied
+
+void RPCEventConnection::receive(const char *data, size_t len) {
+    if (start == end) {
+        size_t used = parse(data, len);
+        data += used;
+        len -= used;
+        start = end = 0;
+        if (len > in.size()) in.resize(len);
+        memcpy(&in[0], data, len);
+        end = len;
+        settle();
+        return;
+    }
+
+    if (in.size() - end < len) {
+        memmove(&in[0], &in[start], end - start);
+        end -= start;
+        start = 0;
+        if (in.size() - end < len) in.resize(end + len);
+    }
+    memcpy(&in[end], data, len);
+    received(len);
+}
+
+
+// RPCEventConnection::sent
+//  - len bytes of out were written; out is emptied once all of it has been
+
+void RPCEventConnection::sent(size_t len) {
+    outSent += len;
+    if (outSent == out.size()) {
+        out.clear();
+        outSent = 0;
+    }
+}
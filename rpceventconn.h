@@ -0,0 +1,59 @@
+// rpceventconn.h
+//
+// Declares the per-connection state shared by the event loop servers: an
+// input buffer parsed incrementally into request frames, and a queue of
+// response frames waiting to be written
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCEVENTCONN_H_
+#define _RPCEVENTCONN_H_
+
+#include <string>
+#include <vector>
+#include "rpcstubhelper.h"
+
+using namespace std;
+
+
+// RPCEventConnection
+//  - one client of a server that does its own reads and writes, eg. with
+//    epoll or io_uring, and only hands complete frames to the stubs
+//  - bytes are fed in as they arrive, either read straight into readSpace or
+//    passed to receive; every complete frame is answered with
+//    dispatchRequest and its response appended to out
+//  - the first 4 bytes are the proxy's idl id, answered like
+//    rpcstubhandshake; a mismatched proxy is marked closing
+//  - timeouts apply per frame, as in RPCReader: once part of a frame is
+//    buffered, deadline is when the rest must have arrived
+
+class RPCEventConnection {
+private:
+    vector<char> in;
+    size_t start, end; // unread input is in[start, end)
+    bool matched; // handshake done
+    int timeout; // ms per frame, 0 for none
+
+    size_t need; // bytes the next frame needs buffered, 0 if unknown
+
+    size_t parse(const char *data, size_t len);
+    void settle();
+
+public:
+    string out; // response frames not yet written, from outSent on
+    size_t outSent;
+    bool closing; // peer closed or misbehaved, close once out is written
+    long long deadline; // ms, 0 unless part of a frame is buffered
+
+    RPCEventConnection(int timeout);
+
+    char *readSpace(size_t &len); // where the next read can go, and how much
+    void received(size_t len); // len bytes were read into readSpace
+    void receive(const char *data, size_t len); // bytes read elsewhere
+
+    size_t queued() const { return out.size() - outSent; };
+    void sent(size_t len); // len bytes of out were written
+    bool expired(long long now) const { return deadline != 0 && now > deadline; };
+};
+
+#endif
@@ -9,6 +9,98 @@ import utils
 
 
 FUNCPROXY_TEMPLATE = 'funcproxy.template.cpp'
+PROXYHEADER_TEMPLATE = 'proxy.template.h'
+
+
+# generate_sendheader, generate_recvheader
+#   - generate the headers of the pipelined halves of a proxy: <func>_send
+#     takes the function's args and returns a call id, <func>_recv takes the
+#     call id and returns the function's result
+#
+#   args:
+#   - funcname [str]: name of function
+#   - funcdict [dict]: idl func declaration in json
+
+def generate_sendheader(funcname, funcdict):
+    return utils.generate_funcheader(funcname + '_send', funcdict, 'RPCCallId')
+
+def generate_recvheader(funcname, funcdict):
+    return '{} {}_recv (RPCCallId callid)'.format(
+        utils.clean_type(funcdict['return_type']), funcname,
+    )
+
+
+# generate_asyncheader
+#   - generates the header of <func>_async, which takes the function's args
+#     and returns a future of its result
+#
+#   args:
+#   - funcname [str]: name of function
+#   - funcdict [dict]: idl func declaration in json
+
+def generate_asyncheader(funcname, funcdict):
+    return utils.generate_funcheader(funcname + '_async', funcdict, 'future<{}>'.format(
+        utils.clean_type(funcdict['return_type']),
+    ))
+
+
+# generate_batchargs, generate_batchheader
+#   - generate the struct holding one call's args, <func>_args, and the
+#     header of <func>_batch, which takes a vector of them and returns a
+#     vector of RPCBatchResult
+#
+#   args:
+#   - funcname [str]: name of function
+#   - funcdict [dict]: idl func declaration in json
+
+def generate_batchargs(funcname, funcdict):
+    return 'struct {}_args {{\n{}}};'.format(funcname, ''.join([
+        utils.generate_vardecl(p['type'], p['name']) + ';\n'
+        for p in funcdict['arguments']
+    ]))
+
+def generate_batchheader(funcname, funcdict):
+    return 'vector<RPCBatchResult<{}>> {}_batch (const vector<{}_args> &calls)'.format(
+        utils.clean_type(funcdict['return_type']), funcname, funcname,
+    )
+
+
+# generate_fanoutheader
+#   - generates the header of <func>_fanout, which takes the function's args
+#   and how many servers' answers to wait for, and returns a vector of
+#   RPCBatchResult, one per server
+#
+#   args:
+#   - funcname [str]: name of function
+#   - funcdict [dict]: idl func declaration in json
+#   - default [bool]: whether to give first its default, for the declaration
+
+def generate_fanoutheader(funcname, funcdict, default=False):
+    return utils.generate_funcheader(
+        funcname + '_fanout', funcdict,
+        'vector<RPCBatchResult<{}>>'.format(utils.clean_type(funcdict['return_type'])),
+        ['size_t first' + (' = 0' if default else '')],
+    )
+
+
+# generate_awaitproxy
+#   - generates <func>_await, defined inline in the proxy header: it sends
+#     the call and returns an RPCCall, which a coroutine can co_await
+#
+#   args:
+#   - funcname [str]: name of function
+#   - funcdict [dict]: idl func declaration in json
+
+def generate_awaitproxy(funcname, funcdict):
+    returntype = utils.clean_type(funcdict['return_type'])
+    return 'inline {} {{\nreturn RPCCall<{}>({}, {}_recv);\n}}'.format(
+        utils.generate_funcheader(funcname + '_await', funcdict, 'RPCCall<{}>'.format(returntype)),
+        returntype,
+        utils.generate_funccall(funcname + '_send', [
+            p['name'] for p in funcdict['arguments']
+        ]),
+        funcname,
+    )
 
 
 # generate_funcproxy
@@ -18,8 +110,9 @@ FUNCPROXY_TEMPLATE = 'funcproxy.template.cpp'
 #   - funcname [str]: name of function
 #   - funcsdict [dict]: idl func declarations in json
 #   - typesdict [dict]: idl type declarations in json
+#   - release [bool]: whether to leave out the debug lines of each value
 
-def generate_funcproxy(funcname, funcsdict, typesdict):
+def generate_funcproxy(funcname, funcsdict, typesdict, release=False):
     template = utils.load_template(FUNCPROXY_TEMPLATE)
     funcdict = funcsdict[funcname]
     args = funcdict['arguments']
@@ -31,30 +124,82 @@ def generate_funcproxy(funcname, funcsdict, typesdict):
         repl=('' if len(args) == 0 else None),
     )
 
-    # if void, replace result block in template with just a return
-    void_return_str = '\n'.join([
-        'debugStream << "Call to {funcname}() complete";',
-        'logDebug(debugStream, C150APPLICATION, true);',
-        'return;',
-    ])
-    template = utils.replace_template_block(
-        template, 'result',
-        repl=(void_return_str if returntype == 'void' else None),
-    )
+    # if void, remove result blocks in template, only the status is checked
+    for block in ['result', 'batchresult', 'fanoutresult']:
+        template = utils.replace_template_block(
+            template, block,
+            repl=('' if returntype == 'void' else None),
+        )
 
     template_formats = {
         'funcname': funcname,
         'returntype': returntype,
         'funcheader': utils.generate_funcheader(funcname, funcdict),
+        'sendheader': generate_sendheader(funcname, funcdict),
+        'recvheader': generate_recvheader(funcname, funcdict),
+        'asyncheader': generate_asyncheader(funcname, funcdict),
+        'batchheader': generate_batchheader(funcname, funcdict),
+        'fanoutheader': generate_fanoutheader(funcname, funcdict),
+        'sendcall': utils.generate_funccall(funcname + '_send', [
+            p['name'] for p in args
+        ]),
+        'asynccall': utils.generate_funccall(funcname + '_async', [
+            p['name'] for p in args
+        ]),
+        'returnKeyword': '' if returntype == 'void' else 'return ',
         'argsSizeAccumulate': ''.join([
             shared.generate_varsize(p['name'], p['type'], typesdict, 'argsSize')
             for p in args
         ]),
         'sendArgs': '\n'.join([
-            shared.generate_varwrites(p['name'], p['type'], typesdict, False)
+            shared.generate_varwrites(p['name'], p['type'], typesdict, False, 'argsOut', release)
+            for p in args
+        ]),
+        'batchSizeAccumulate': ''.join([
+            shared.generate_varsize('calls[c].' + p['name'], p['type'], typesdict, 'callSize')
+            for p in args
+        ]),
+        'batchSendArgs': '\n'.join([
+            shared.generate_varwrites('calls[c].' + p['name'], p['type'], typesdict, False, 'argsOut', release)
             for p in args
         ]),
         'declareResult': utils.generate_vardecl(returntype, 'res') + ';',
-        'readResult': shared.generate_varreads('res', returntype, typesdict, False, 'ss'),
+        'readResult': shared.generate_varreads('res', returntype, typesdict, False, 'resIn', release),
+        'batchReadResult': shared.generate_varreads('res', returntype, typesdict, False, 'callIn', release),
+        'returnResult': '' if returntype == 'void' else '\nreturn res;',
+    }
+    return template.format(**template_formats)
+
+
+# generate_proxyheader
+#   - generates the header declaring the pipelined proxies of an idl file
+#
+#   args:
+#   - funcsdict [dict]: idl func declarations in json
+#   - prefix [str]: prefix of idl file
+#
+#   returns [str]: header contents
+
+def generate_proxyheader(funcsdict, prefix):
+    template = utils.load_template(PROXYHEADER_TEMPLATE)
+
+    template_formats = {
+        'prefix': prefix,
+        'guard': '_{}_PROXY_H_'.format(prefix.upper()),
+        'declarations': '\n'.join([
+            '{};\n{};\n{};\n\n{}\n{};\n{};\n'.format(
+                generate_sendheader(f, funcsdict[f]),
+                generate_recvheader(f, funcsdict[f]),
+                generate_asyncheader(f, funcsdict[f]),
+                generate_batchargs(f, funcsdict[f]),
+                generate_batchheader(f, funcsdict[f]),
+                generate_fanoutheader(f, funcsdict[f], default=True),
+            )
+            for f in funcsdict.keys()
+        ]),
+        'awaitproxies': '\n\n'.join([
+            generate_awaitproxy(f, funcsdict[f])
+            for f in funcsdict.keys()
+        ]),
     }
     return template.format(**template_formats)
@@ -3,14 +3,16 @@
 # rpcgen.py
 #
 # Defines functions to generate proxies and stubs for an idl file
-#   - usage: rpcgenerate [-h] idlfiles [idlfiles ...]
-#   - output: <name>.proxy.cpp, <name>.stub.cpp
+#   - usage: rpcgenerate [-h] [-d outdir] [-c] [-r] idlfiles [idlfiles ...]
+#   - output: <name>.proxy.cpp, <name>.proxy.h, <name>.stub.cpp, <name>.ids.h,
+#     and with -c <name>.coro.h
 #
 # by: Justin Jo and Charles
 
 import argparse
 import json
 import subprocess
+import sys
 
 import utils
 import shared
@@ -18,6 +20,11 @@ import proxy
 import stub
 
 
+# constants
+RPCSTATSID = 0xfffffffe # the built-in stats call, see rpcstats.h
+RPCTRACEID = 0xfffffffd # a traced call's wrapper, see rpctrace.h
+
+
 ##### MISCELLANEOUS FUNCTIONS
 
 # parse_args
@@ -41,6 +48,20 @@ def parse_args():
         type=str,
         help='output directory for proxies and stubs, defaults to current dir',
     )
+    parser.add_argument(
+        '-c',
+        '--coroutines',
+        action='store_true',
+        help='generate stubs that await coroutine handlers <func>_co, '
+             'declared in <prefix>.coro.h, instead of calling <func>',
+    )
+    parser.add_argument(
+        '-r',
+        '--release',
+        action='store_true',
+        help='leave out the debug logging of every value read and written; '
+             'the remaining logging is compiled out with -DRPC_NO_LOGGING',
+    )
 
     args = parser.parse_args()
     return args
@@ -48,7 +69,7 @@ def parse_args():
 
 # prints out program usage
 def usage():
-    print('usage: {} [-h] idlfiles [idlfiles...]'.format(sys.arv[0]))
+    print('usage: {} [-h] [-d outdir] [-c] [-r] idlfiles [idlfiles...]'.format(sys.argv[0]))
 
 
 ##### IDL PROCESSING
@@ -59,20 +80,73 @@ def usage():
 #   args:
 #   - prefix [str]: the prefix of an idl file
 #   - is_stub [bool]: true if code is for the stub, false if proxy
+#   - coroutines [bool]: true if the stub awaits coroutine handlers
 #
 #   returns [str]: generated c++ code
 
-def generate_shared(prefix, is_stub):
+def generate_shared(prefix, is_stub, coroutines=False):
+    # the proxy header includes the idl itself, to declare the pipelined
+    # proxies alongside the idl functions, and the coroutine header does
+    # the same for the handlers
+    if not is_stub:
+        idl = '.proxy.h'
+    elif coroutines:
+        idl = '.coro.h'
+    else:
+        idl = '.idl'
     headers = shared.SHARED_HEADERS + [
         '"rpc' + ('stub' if is_stub else 'proxy') + 'helper.h"',
-        '"' + prefix + '.idl"',
+        '"' + prefix + idl + '"',
+        '"' + prefix + '.ids.h"',
     ]
 
     return '\n'.join([
         shared.generate_incls(headers, shared.SHARED_NAMESPACES),
+        shared.generate_interfaceid(),
     ])
 
 
+# generate_ids
+#   - generates the header holding the id of every function in an idl file,
+#     shared by its proxy and stub
+#   - every function has a second id, for its batches
+#   - exits if two ids are the same, since the stub could not tell them apart,
+#     or if one is reserved: the id of the built-in stats call, or of a traced
+#     call's wrapper
+#
+#   args:
+#   - funcsdict [dict]: idl func declarations in json
+#   - typesdict [dict]: idl type declarations in json
+#   - prefix [str]: the prefix of the idl file
+#
+#   returns [str]: ids header contents
+
+def generate_ids(funcsdict, typesdict, prefix):
+    funcids = {
+        f: utils.generate_funcid(f, funcsdict[f], typesdict)
+        for f in funcsdict.keys()
+    }
+    batchids = {
+        f: utils.generate_funcid(f, funcsdict[f], typesdict, batch=True)
+        for f in funcsdict.keys()
+    }
+
+    seen = {
+        RPCSTATSID: 'the built-in stats call',
+        RPCTRACEID: 'the traced call wrapper',
+    }
+    for f, funcid in list(funcids.items()) + [
+        (f + '_batch', batchid) for f, batchid in batchids.items()
+    ]:
+        if funcid in seen:
+            print("error: '{}' and '{}' have the same function id {:#010x}"
+                .format(seen[funcid], f, funcid))
+            sys.exit(1)
+        seen[funcid] = f
+
+    return shared.generate_ids(funcids, batchids, funcsdict, prefix)
+
+
 # generate_proxy
 #   - generates proxy code for an idl file
 #
@@ -80,12 +154,13 @@ def generate_shared(prefix, is_stub):
 #   - funcsdict [dict]: idl func declarations in json
 #   - typesdict [dict]: idl type declarations in json
 #   - prefix [str]: the prefix of the idl file
+#   - release [bool]: whether to leave out the debug lines of each value
 #
 #   returns [str]: proxy file contents
 
-def generate_proxy(funcsdict, typesdict, prefix):
+def generate_proxy(funcsdict, typesdict, prefix, release=False):
     func_proxies = '\n'.join([
-        proxy.generate_funcproxy(f, funcsdict, typesdict)
+        proxy.generate_funcproxy(f, funcsdict, typesdict, release)
         for f in funcsdict.keys()
     ])
 
@@ -102,19 +177,21 @@ def generate_proxy(funcsdict, typesdict, prefix):
 #   - funcsdict [dict]: idl func declarations in json
 #   - typesdict [dict]: idl type declarations in json
 #   - prefix [str]: the prefix of the idl file
+#   - coroutines [bool]: whether to await coroutine handlers
+#   - release [bool]: whether to leave out the debug lines of each value
 #
 #   returns [str]: stub file contents
 
-def generate_stub(funcsdict, typesdict, prefix):
+def generate_stub(funcsdict, typesdict, prefix, coroutines=False, release=False):
     func_stubs = '\n'.join([
-        stub.generate_funcstub(f, funcsdict, typesdict)
+        stub.generate_funcstub(f, funcsdict, typesdict, coroutines, release)
         for f in funcsdict.keys()
     ])
 
     return '\n'.join([
-        generate_shared(prefix, True),
+        generate_shared(prefix, True, coroutines),
         func_stubs,
-        stub.generate_dispatch(funcsdict, prefix),
+        stub.generate_dispatch(funcsdict, prefix, coroutines),
     ])
 
 
@@ -125,14 +202,19 @@ def generate_stub(funcsdict, typesdict, prefix):
 #   - file names:
 #       - proxy file name: <prefix>.proxy.cpp
 #       - stub file name: <prefix>.stub.cpp
+#       - function ids file name: <prefix>.ids.h
+#       - pipelined proxies header name: <prefix>.proxy.h
+#       - coroutine handlers header name: <prefix>.coro.h, if coroutines
 #
 # args:
 #   - fname [str]: fname, must be of the pattern *.idl
 #   - outdir [str]: output directory for proxies and stubs
+#   - coroutines [bool]: whether the stubs await coroutine handlers
+#   - release [bool]: whether to leave out the debug lines of each value
 #
 # returns: n/a
 
-def generate(fname, outdir='.'):
+def generate(fname, outdir='.', coroutines=False, release=False):
     if not utils.isfile(fname):
         print("error: '{}' does not exist or could not be opened".format(fname))
         return
@@ -149,10 +231,17 @@ def generate(fname, outdir='.'):
     typesdict = decls['types']
 
     # generate files
+    with open('{}/{}.ids.h'.format(outdir.rstrip('/'), prefix), 'w+') as f:
+        f.write(generate_ids(funcsdict, typesdict, prefix))
+    with open('{}/{}.proxy.h'.format(outdir.rstrip('/'), prefix), 'w+') as f:
+        f.write(proxy.generate_proxyheader(funcsdict, prefix))
     with open('{}/{}.proxy.cpp'.format(outdir.rstrip('/'), prefix), 'w+') as f:
-        f.write(generate_proxy(funcsdict, typesdict, prefix))
+        f.write(generate_proxy(funcsdict, typesdict, prefix, release))
     with open('{}/{}.stub.cpp'.format(outdir.rstrip('/'), prefix), 'w+') as f:
-        f.write(generate_stub(funcsdict, typesdict, prefix))
+        f.write(generate_stub(funcsdict, typesdict, prefix, coroutines, release))
+    if coroutines:
+        with open('{}/{}.coro.h'.format(outdir.rstrip('/'), prefix), 'w+') as f:
+            f.write(stub.generate_coroheader(funcsdict, prefix))
 
 
 ##### MAIN
@@ -160,7 +249,7 @@ def generate(fname, outdir='.'):
 def main():
     args = parse_args()
     for f in args.idlfiles:
-        generate(f, args.outdir)
+        generate(f, args.outdir, args.coroutines, args.release)
 
 
 if __name__ == '__main__':
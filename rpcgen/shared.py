@@ -9,6 +9,7 @@ import utils
 
 
 # constants
+IDS_TEMPLATE = 'ids.template.h'
 SHARED_HEADERS = [
     '<cstdio>',
     '<iostream>',
@@ -41,10 +42,76 @@ def generate_incls(headers, namespaces):
     )
 
 
+# generate_interfaceid
+#   - generates the c++ function that rpc helpers use to find the interface id
+#     of the idl that proxies/stubs were generated from
+#
+#   returns [str]: c++ function definition
+
+def generate_interfaceid():
+    return '\n'.join([
+        '// rpcInterfaceId',
+        '//  - returns the id of the idl this file was generated from, exchanged',
+        '//    when a proxy connects to a stub',
+        '',
+        'uint32_t rpcInterfaceId() {',
+        'return RPCINTERFACEID;',
+        '}',
+        '',
+    ])
+
+
+# generate_ids
+#   - generates the function ids header of an idl file
+#   - the interface id is a hash of all function ids, so it changes whenever a
+#     function is added, removed or changes signature
+#
+#   args:
+#   - funcids [dict]: function name -> function id
+#   - batchids [dict]: function name -> id of the function's batches
+#   - funcsdict [dict]: idl func declarations in json
+#   - prefix [str]: prefix of idl file
+#
+#   returns [str]: header contents
+
+def generate_ids(funcids, batchids, funcsdict, prefix):
+    template = utils.load_template(IDS_TEMPLATE)
+    interfaceid = utils.fnv1a(','.join(sorted(
+        '{:08x}'.format(funcid) for funcid in funcids.values()
+    )))
+
+    template_formats = {
+        'prefix': prefix,
+        'guard': '_{}_IDS_H_'.format(prefix.upper()),
+        'interfaceid': '{:#010x}u'.format(interfaceid),
+        'funcIds': '\n'.join([
+            'const uint32_t RPCID_{} = {:#010x}u; // {}'.format(
+                f, funcids[f], utils.generate_funcheader(f, funcsdict[f]),
+            )
+            for f in funcsdict.keys()
+        ] + [
+            'const uint32_t RPCBATCHID_{} = {:#010x}u; // {}_batch'.format(
+                f, batchids[f], f,
+            )
+            for f in funcsdict.keys()
+        ]),
+        'nameCases': '\n'.join([
+            'case RPCID_{0}:\n  return "{0}";'.format(f)
+            for f in funcsdict.keys()
+        ] + [
+            'case RPCBATCHID_{0}:\n  return "{0}_batch";'.format(f)
+            for f in funcsdict.keys()
+        ]),
+    }
+    return template.format(**template_formats)
+
+
 # generate_varhandle
 #   - for each variable, add a read or write
 #   - for simple types like int/string/float, only 1 r/w is necessary
-#   - for array types, for loop to r/w 1 per element
+#   - for array types whose elements are, possibly through more arrays, a type
+#     with a bulk format (key '<type>[]'), 1 r/w for the whole array
+#   - for other array types, for loop to r/w 1 per element
 #   - for structs, we do 1 r/w per member
 #   - if arg types are nested, we nest the number of reads, according to the
 #     above
@@ -55,6 +122,8 @@ def generate_incls(headers, namespaces):
 #   - typesdict [dict]: dictionary of types
 #   - builtin_formats [dict]: format strings for r/w for builtin types
 #       - must have entries for 'int', 'float' and 'string'
+#       - may have bulk entries 'int[]' and 'float[]' for contiguous arrays,
+#         formatted with the variable name and total element count
 #   - n [int]: number of recursive calls so far, initialized to 0, should not be
 #       used by nonrecursive calls
 #       - needed to guarantee that iterators in for loops are unique
@@ -74,6 +143,12 @@ def generate_varhandle(varname, vartype, typesdict, builtin_formats, n=0):
             return None
 
     elif type_of_type == 'array':
+        # arrays of int/float, however many dimensions, are contiguous in
+        # memory and can be handled in one go
+        leaf, count = utils.array_leaf(vartype, typesdict)
+        if leaf + '[]' in builtin_formats:
+            return builtin_formats[leaf + '[]'].format(varname, count)
+
         # for each level of array, generate a for loop
         iterator = 'i' + str(n)
         arrstr = utils.generate_forloop(
@@ -105,72 +180,111 @@ def generate_varhandle(varname, vartype, typesdict, builtin_formats, n=0):
 
 
 # generate debug lines for varreads and varwrites below
-def _generate_rw_debug(ty, is_stub, is_read):
+#   - only formatted if VARDEBUG is enabled, see rpcLogging
+#   - none at all for rpcgenerate --release
+def _generate_rw_debug(ty, is_stub, is_read, release=False):
+    if release:
+        return ''
     distobj = 'stub' if is_stub else 'proxy'
     rw = 'Received' if is_read else 'Sending'
 
     return '\n'.join([
-        'debugStream << "{}: {} {} {}size=" << {} << " for variable \'{{0}}\'";'
+        'if (rpcLogging(VARDEBUG, false)) {{',
+        '  stringstream debugStream;',
+        '  debugStream << "{}: {} {} {}size=" << {} << " for variable \'{{0}}\'";'
             .format(
                 distobj, rw, ty,
                 '' if ty == 'string' else '\'" << {0} << "\' ',
                 '{0}.length() + 1' if ty == 'string' else 4, # int/float size=4
             ),
-        'logDebug(debugStream, VARDEBUG, false);\n',
+        '  logDebug(debugStream, VARDEBUG, false);',
+        '}}\n',
+    ])
+
+
+# generate debug lines for bulk array reads and writes, same as above
+def _generate_bulk_rw_debug(ty, is_stub, is_read, release=False):
+    if release:
+        return ''
+    distobj = 'stub' if is_stub else 'proxy'
+    rw = 'Received' if is_read else 'Sending'
+
+    return '\n'.join([
+        'if (rpcLogging(VARDEBUG, false)) {{',
+        '  stringstream debugStream;',
+        '  debugStream << "{}: {} {}[{{1}}] size=" << 4 * {{1}} << " for variable \'{{0}}\'";'
+            .format(distobj, rw, ty),
+        '  logDebug(debugStream, VARDEBUG, false);',
+        '}}\n',
     ])
 
 
 # generate_varreads
 #   - for each variable, add the necessary number of reads to fill the variable
-#     from a string stream
+#     from a cursor over the received bytes
 
 # args:
 #   - varname [str]: name of variable
 #   - vartype [str]: type of variable, should have an entry in typedict
 #   - typesdict [dict]: dictionary of types
 #   - is_stub [bool]: whether or not code is for the stub
-#   - streamvar [str]: name of the stream 
+#   - cursorvar [str]: name of the RPCCursor
+#   - release [bool]: whether to leave out the debug lines of each read
 #
 # returns [str]: c++ string of var reads, or None if invalid type found
-#
-# notes:
-#   - assumes existence of string stream 'debugStream' for debugging
 
-def generate_varreads(varname, vartype, typesdict, is_stub, streamvar='ss'):
+def generate_varreads(varname, vartype, typesdict, is_stub, cursorvar='in',
+                      release=False):
     builtin_formats = {
-        'int': '{0} = extractInt(' + streamvar + ');\n',
-        'float': '{0} = extractFloat(' + streamvar + ');\n',
-        'string': '{0} = extractString(' + streamvar + ');\n',
+        'int': '{0} = extractInt(' + cursorvar + ');\n',
+        'float': '{0} = extractFloat(' + cursorvar + ');\n',
+        'string': '{0} = extractString(' + cursorvar + ');\n',
     }
     for ty in builtin_formats.keys(): # append debug strings
-        builtin_formats[ty] += _generate_rw_debug(ty, is_stub, True)
+        builtin_formats[ty] += _generate_rw_debug(ty, is_stub, True, release)
+
+    # whole int/float arrays, see generate_varhandle
+    for ty, fn in [('int', 'extractInts'), ('float', 'extractFloats')]:
+        builtin_formats[ty + '[]'] = (
+            fn + '(' + cursorvar + ', (' + ty + ' *){0}, {1});\n' +
+            _generate_bulk_rw_debug(ty, is_stub, True, release)
+        )
 
     return generate_varhandle(varname, vartype, typesdict, builtin_formats)
 
 
 # generate_varwrites
-#   - for each var, add writes to write entire variable to sock
+#   - for each var, add writes to write entire variable to a writer
+#   - writes are only buffered, the writer is flushed once the whole frame is in
 #
 # args:
 #   - varname [str]: name of variable
 #   - vartype [str]: type of variable, should have an entry in typedict
 #   - typesdict [dict]: dictionary of types
 #   - is_stub [bool]: whether or not code is for the stub
+#   - writervar [str]: name of the RPCWriter
+#   - release [bool]: whether to leave out the debug lines of each write
 #
 # returns [str]: c++ string of var reads, or None if invalid type found
 
-def generate_varwrites(varname, vartype, typesdict, is_stub):
-    sock = 'RPC' + ('STUB' if is_stub else 'PROXY') + 'SOCKET'
-
+def generate_varwrites(varname, vartype, typesdict, is_stub, writervar='out',
+                       release=False):
     builtin_formats = {
-        'int': 'writeInt(' + sock + ', {0});\n',
-        'float': 'writeFloat(' + sock + ', {0});\n',
-        'string': 'writeString(' + sock + ', {0});\n',
+        'int': 'writeInt(' + writervar + ', {0});\n',
+        'float': 'writeFloat(' + writervar + ', {0});\n',
+        'string': 'writeString(' + writervar + ', {0});\n',
     }
     for ty in builtin_formats.keys(): # prepend debug strings
-        debugstr = _generate_rw_debug(ty, is_stub, False)
+        debugstr = _generate_rw_debug(ty, is_stub, False, release)
         builtin_formats[ty] = debugstr + builtin_formats[ty]
 
+    # whole int/float arrays, see generate_varhandle
+    for ty, fn in [('int', 'writeInts'), ('float', 'writeFloats')]:
+        builtin_formats[ty + '[]'] = (
+            _generate_bulk_rw_debug(ty, is_stub, False, release) +
+            fn + '(' + writervar + ', (const ' + ty + ' *){0}, {1});\n'
+        )
+
     return generate_varhandle(varname, vartype, typesdict, builtin_formats)
 
 
@@ -188,5 +302,7 @@ def generate_varsize(varname, vartype, typesdict, sizevar='sizeVar'):
         'int': sizevar + ' += 4;\n',
         'float': sizevar + ' += 4;\n',
         'string': sizevar + ' += {0}.length() + 5;\n', # +1 for null, +4 for string size
+        'int[]': sizevar + ' += 4 * {1};\n',
+        'float[]': sizevar + ' += 4 * {1};\n',
     }
     return generate_varhandle(varname, vartype, typesdict, builtin_formats)
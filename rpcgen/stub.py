@@ -11,6 +11,7 @@ import utils
 # constants
 FUNCSTUB_TEMPLATE = 'funcstub.template.cpp'
 DISPATCH_TEMPLATE = 'dispatch.template.cpp'
+COROHEADER_TEMPLATE = 'coro.template.h'
 
 
 # generate_funcstub
@@ -20,8 +21,12 @@ DISPATCH_TEMPLATE = 'dispatch.template.cpp'
 #   - funcname [str]: name of function
 #   - funcsdict [dict]: idl func declarations in json
 #   - typesdict [dict]: idl type declarations in json
+#   - coroutines [bool]: whether the stub is a coroutine awaiting the
+#     handler <func>_co, rather than calling <func>
+#   - release [bool]: whether to leave out the debug lines of each value
 
-def generate_funcstub(funcname, funcsdict, typesdict):
+def generate_funcstub(funcname, funcsdict, typesdict, coroutines=False,
+                      release=False):
     template = utils.load_template(FUNCSTUB_TEMPLATE)
     funcdict = funcsdict[funcname]
     args = funcdict['arguments']
@@ -33,30 +38,37 @@ def generate_funcstub(funcname, funcsdict, typesdict):
         repl=('' if len(args) == 0 else None),
     )
 
-    # if void, replace return block in template with just a return
+    # if void, replace result block in template with a status only response
+    void_return_str = '\n'.join([
+        '',
+        '// send response frame with no result',
+        'writeStatusFrame(resOut, success);',
+    ])
     template = utils.replace_template_block(
         template, 'result',
-        repl=('\nreturn;' if returntype == 'void' else None),
+        repl=(void_return_str if returntype == 'void' else None),
     )
 
     template_formats = {
         'funcname': funcname,
         'returntype': returntype,
+        'stubtype': 'RPCTask<void>' if coroutines else 'void',
         'declareArgs': '\n'.join([
             utils.generate_vardecl(p['type'], p['name']) + ';'
             for p in args
         ]),
         'readArgs': '\n'.join([
-            shared.generate_varreads(p['name'], p['type'], typesdict, True, 'ss')
+            shared.generate_varreads(p['name'], p['type'], typesdict, True, 'argsIn', release)
             for p in args
         ]),
-        'callFunction': '{}{}({});'.format(
+        'callFunction': '{}{}{}({});'.format(
             '' if returntype == 'void' else (utils.generate_vardecl(returntype, 'res') + ' = '),
-            funcname,
+            'co_await ' if coroutines else '',
+            funcname + ('_co' if coroutines else ''),
             ', '.join(p['name'] for p in args),
         ),
         'resSizeAccumulate': shared.generate_varsize('res', returntype, typesdict, 'resSize'),
-        'sendRes': shared.generate_varwrites('res', returntype, typesdict, True),
+        'sendRes': shared.generate_varwrites('res', returntype, typesdict, True, 'resOut', release),
     }
 
     return template.format(**template_formats)
@@ -65,27 +77,73 @@ def generate_funcstub(funcname, funcsdict, typesdict):
 # generate_dispatch
 #   - generates c++ function that dispatches function requests received from the
 #     socket
+#   - dispatch is a switch on the function ids from <prefix>.ids.h, so it is a
+#     single jump no matter how many functions the idl has
+#   - a function's batch id goes to rpcstubbatch, which runs the function's
+#     stub once per call in the batch
 #
 #   args:
 #   - funcsdict [dict]: idl func declarations in json
 #   - prefix [str]: prefix of idl file
+#   - coroutines [bool]: whether the stubs are coroutines
 
-def generate_dispatch(funcsdict, prefix):
+def generate_dispatch(funcsdict, prefix, coroutines=False):
     template = utils.load_template(DISPATCH_TEMPLATE)
 
+    # keep only the dispatchAsync for this kind of stub
     template = utils.replace_template_block(
-        template, 'branches',
-        repl=('' if len(funcsdict.keys()) == 0 else None),
+        template, 'sync', repl=('' if coroutines else None),
+    )
+    template = utils.replace_template_block(
+        template, 'coroutine', repl=(None if coroutines else ''),
     )
 
     template_formats = {
-        'funcBranches': ' else '.join([
+        'prefix': prefix,
+        'dispatchheader': (
+            'static RPCTask<void> dispatchCoroutine(uint32_t funcid, uint32_t callid,\n'
+            '                                       RPCCursor &argsIn, RPCWriter &resOut)'
+            if coroutines else
+            'void dispatchRequest(uint32_t funcid, uint32_t callid, RPCCursor &argsIn,\n'
+            '                     RPCWriter &resOut)'
+        ),
+        'dispatchreturn': '\nco_return; // a coroutine, even with no functions' if coroutines else '',
+        'statsreturn': 'co_return;' if coroutines else 'return;',
+        'funcCases': '\n'.join([
             '\n'.join([
-                'if (strcmp(funcname, "{0}") == 0) {{',
-                '  writeInt(RPCSTUBSOCKET, existing_func);',
-                '  _{0}();',
-                '}}',
-            ]).format(f)
+                'case RPCID_{0}:',
+                '  {1}_{0}(argsIn, resOut);',
+                '  break;',
+                'case RPCBATCHID_{0}:',
+                '  {1}rpcstubbatch(_{0}, argsIn, resOut);',
+                '  break;',
+            ]).format(f, 'co_await ' if coroutines else '')
+            for f in funcsdict.keys()
+        ]),
+    }
+    return template.format(**template_formats)
+
+
+# generate_coroheader
+#   - generates the header declaring the coroutine handlers that stubs
+#     generated with --coroutines call, one <func>_co per idl function
+#
+#   args:
+#   - funcsdict [dict]: idl func declarations in json
+#   - prefix [str]: prefix of idl file
+#
+#   returns [str]: header contents
+
+def generate_coroheader(funcsdict, prefix):
+    template = utils.load_template(COROHEADER_TEMPLATE)
+
+    template_formats = {
+        'prefix': prefix,
+        'guard': '_{}_CORO_H_'.format(prefix.upper()),
+        'declarations': '\n'.join([
+            utils.generate_funcheader(f + '_co', funcsdict[f], 'RPCTask<{}>'.format(
+                utils.clean_type(funcsdict[f]['return_type']),
+            )) + ';'
             for f in funcsdict.keys()
         ]),
     }
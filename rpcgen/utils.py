@@ -110,16 +110,18 @@ def generate_vardecl(vartype, varname):
 #   args:
 #   - funcname [str]: name of function
 #   - funcdict [dict]: json dict containing return type and args for funcname
+#   - returntype [str]: return type to use instead of funcdict's, if given
+#   - extraargs [list[str]]: params to add after funcdict's, if given
 #
 #   notes:
 #   - curly braces are not included
 
-def generate_funcheader(funcname, funcdict):
-    returntype = clean_type(funcdict['return_type'])    
+def generate_funcheader(funcname, funcdict, returntype=None, extraargs=[]):
+    returntype = clean_type(returntype or funcdict['return_type'])
     args = [ # iterate over pairs of arguments, organize into list of arg strs
         generate_vardecl(p['type'], p['name'])
         for p in funcdict['arguments']
-    ]
+    ] + extraargs
     return returntype + ' ' + funcname + ' (' + ', '.join(args) + ')'
 
 
@@ -141,6 +143,88 @@ def generate_funccall(funcname, funcargs):
     )
 
 
+# canonical_type
+#   - returns a canonical string for a type, with arrays and structs expanded
+#     down to their builtin types so that any change to the layout of a type
+#     changes the string
+#
+#   args:
+#   - ty [str]: type, types without an entry are treated as builtins
+#   - typesdict [dict]: idl type declarations in json
+
+def canonical_type(ty, typesdict):
+    tydict = typesdict.get(ty, {'type_of_type': 'builtin'})
+
+    if tydict['type_of_type'] == 'array':
+        return '[{}]{}'.format(
+            tydict['element_count'],
+            canonical_type(tydict['member_type'], typesdict),
+        )
+    elif tydict['type_of_type'] == 'struct':
+        return '{}{{{}}}'.format(ty, ','.join([
+            canonical_type(p['type'], typesdict)
+            for p in tydict['members']
+        ]))
+    else: # builtin
+        return ty
+
+
+# array_leaf
+#   - for an array type, follows nested arrays down to the first non-array
+#     type, eg. int[3][4] -> int
+#
+#   args:
+#   - ty [str]: array type, should have an entry in typesdict
+#   - typesdict [dict]: idl type declarations in json
+#
+#   returns [(str, int)]: leaf type and total number of leaf elements
+
+def array_leaf(ty, typesdict):
+    count = 1
+    while typesdict[ty]['type_of_type'] == 'array':
+        count *= typesdict[ty]['element_count']
+        ty = typesdict[ty]['member_type']
+    return ty, count
+
+
+# fnv1a
+#   - 32 bit FNV-1a hash of a string, stable across python runs unlike hash()
+
+def fnv1a(s):
+    h = 0x811c9dc5
+    for b in s.encode('utf-8'):
+        h = ((h ^ b) * 0x01000193) & 0xffffffff
+    return h
+
+
+# generate_funcid
+#   - generates the 32 bit id that is sent over the wire in place of a
+#     function's name
+#   - derived from the name, arg types and return type, so a proxy and stub
+#     built from different versions of a function do not share an id
+#   - <func>_batch requests are sent with an id of their own, derived the
+#     same way
+#
+#   args:
+#   - funcname [str]: name of function
+#   - funcdict [dict]: json dict containing return type and args for funcname
+#   - typesdict [dict]: idl type declarations in json
+#   - batch [bool]: whether to generate the id of the function's batches
+#
+#   returns [int]: function id
+
+def generate_funcid(funcname, funcdict, typesdict, batch=False):
+    return fnv1a('{}{}({}){}'.format(
+        'batch ' if batch else '',
+        funcname,
+        ','.join([
+            canonical_type(p['type'], typesdict)
+            for p in funcdict['arguments']
+        ]),
+        canonical_type(funcdict['return_type'], typesdict),
+    ))
+
+
 # generate_forloop
 #   - generates the first line of a c++ for loop
 #   - assumes a for loop that increments an iterator by one each iteration until
@@ -0,0 +1,59 @@
+// rpclog.h
+//
+// Declares the asynchronous log sink: once started, logDebug copies each
+// line into a ring buffer of the calling thread's own, without a lock or a
+// system call, and a background thread formats and writes them out to the
+// debug and grading logs in batches
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCLOG_H_
+#define _RPCLOG_H_
+
+#include <string_view>
+#include <inttypes.h>
+
+using namespace std;
+
+
+// RPCLOGASYNC
+//  - set once rpcLogStart has been called, for logDebug
+
+extern bool RPCLOGASYNC;
+
+
+// rpcLogStart
+//  - starts the background thread, once, and has it stopped and everything
+//    still queued written when the program exits
+//  - call before the threads that log are started, eg. from initDebugLog
+
+void rpcLogStart();
+
+
+// rpcLogPost
+//  - queues one line of debugClasses, and for the grading log if grade, on
+//    the calling thread's ring, stamped with the time now
+//  - a debug line longer than a ring slot is cut short; if the ring is full,
+//    it is dropped and counted, and the writer logs how many were dropped
+//    once there is room again
+//  - a grading line is never cut or dropped: one that does not fit is
+//    written out on the calling thread instead, after everything queued
+//    before it, which waits for the writer
+//
+//  returns: false if the line was dropped
+
+bool rpcLogPost(uint32_t debugClasses, bool grade, string_view line);
+
+
+// rpcLogFlush
+//  - writes out every line queued so far, on the calling thread
+
+void rpcLogFlush();
+
+
+// rpcLogDropped
+//  - how many lines have been dropped so far, over every thread
+
+unsigned long long rpcLogDropped();
+
+#endif
@@ -0,0 +1,455 @@
+// rpcpoolserver.cpp
+//
+// Defines the concurrent server loop: a poll thread that watches the listener
+// and idle connections, and a pool of workers that read their requests and
+// run them, several of one connection's at once
+//
+// by: Justin Jo and Charles Wan
+
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "c150debug.h"
+#include "rpcpoolserver.h"
+#include "rpcshm.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+
+// constants
+const int SHM_ACCEPT_BACKOFF_MS = 100; // see rpcshmserve
+
+
+// PoolConnection
+//  - a client connection and whether its proxy has passed the handshake
+//  - refs counts the requests read off it that are not yet answered, plus one
+//    for as long as it is still being read; the last to let go deletes it
+//  - writeMutex keeps the response frames of requests running on different
+//    workers whole
+
+struct PoolConnection {
+    RPCSocketTransport *sock;
+    RPCConnection conn;
+    bool matched;
+    atomic<int> refs;
+    mutex writeMutex;
+    bool broken; // a write failed or timed out, under writeMutex
+
+    PoolConnection(RPCSocketTransport *sock) :
+        sock(sock), conn(sock), matched(false), refs(1), broken(false)
+    {};
+};
+
+
+// PoolRequest
+//  - a request frame read off a connection, with its args copied out of the
+//    connection's buffer so that reading can go on while it runs
+
+struct PoolRequest {
+    PoolConnection *pc;
+    uint32_t funcid;
+    uint32_t callid;
+    string args;
+};
+
+
+// PoolTask
+//  - work for a worker: a connection with bytes waiting to be read, or, if
+//    req is set, a request of pc's to run
+
+struct PoolTask {
+    PoolConnection *pc;
+    PoolRequest *req;
+};
+
+
+// work for the workers
+static deque<PoolTask> readyQueue;
+static mutex readyMutex;
+static condition_variable readyCond;
+
+// connections the workers are done reading, for the poll thread
+static vector<PoolConnection *> returnedConns;
+static mutex returnedMutex;
+static int wakePipe[2]; // written to when returnedConns grows
+
+
+// releaseConnection
+//  - lets go of one of pc's refs, and closes it if that was the last
+
+static void releaseConnection(PoolConnection *pc) {
+    if (--pc->refs == 0) {
+        delete pc; // closes the socket
+    }
+}
+
+
+// readRequest
+//  - reads one whole request frame off pc's connection onto requests
+//
+// returns: false if it could not, eg. eof, or a frame too big to read; the
+//          stream is then out of step with the frames and is abandoned
+
+static bool readRequest(PoolConnection *pc, vector<PoolRequest *> &requests) {
+    RPCReader &reader = pc->conn.reader;
+
+    try {
+        // func id, call id, args size, args; see dispatchFunction
+        reader.beginMessage();
+        uint32_t funcid = readInt(reader);
+        uint32_t callid = readInt(reader);
+        int argsSize = readInt(reader);
+        RPCCursor argsIn = readSpan(reader, argsSize);
+
+        size_t len = argsIn.remaining();
+        PoolRequest *req = new PoolRequest();
+        req->pc = pc;
+        req->funcid = funcid;
+        req->callid = callid;
+        req->args.assign(argsIn.take(len), len);
+        pc->refs++;
+        requests.push_back(req);
+    } catch (RPCException &e) { // frame never arrived whole, eg. eof
+        c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Caught %s",
+                          e.formattedExplanation().c_str());
+        reader.abandon();
+        return false;
+    }
+    return true;
+}
+
+
+// readConnection
+//  - handshakes with a new connection, or reads the request that made an
+//    idle one readable, and then every request already buffered behind it
+//
+// returns: true if the connection should go back to the poll thread, false
+//          if it is finished and should no longer be read
+
+static bool readConnection(PoolConnection *pc,
+                           vector<PoolRequest *> &requests) {
+    RPCConnection &conn = pc->conn;
+
+    try {
+        if (!pc->matched) {
+            pc->matched = rpcstubhandshake(conn);
+            if (!pc->matched) {
+                c150debug->printf(C150RPCDEBUG,
+                    "rpcpoolserver: Proxy idl does not match stubs");
+                return false;
+            }
+        } else if (!readRequest(pc, requests)) {
+            return false;
+        }
+
+        while (!conn.reader.eof() && !conn.reader.timedout() &&
+               conn.reader.buffered() > 0) {
+            if (!readRequest(pc, requests)) return false;
+        }
+    } catch (C150Exception &e) { // eg. client went away mid handshake
+        c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Caught %s",
+                          e.formattedExplanation().c_str());
+        return false;
+    }
+
+    if (conn.reader.eof()) {
+        c150debug->printf(C150RPCDEBUG, "rpcpoolserver: EOF signaled on input");
+        return false;
+    } else if (conn.reader.timedout()) {
+        c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Socket timed out");
+        return false;
+    }
+    return true;
+}
+
+
+// sendResponse
+//  - writes a finished request's response frame, whatever else of its
+//    connection's is still running, and lets go of the connection
+//  - the write times out like reads do, so a client that stops reading
+//    holds a worker for at most that long: the connection is then shut
+//    down, which the poll thread sees as eof, and responses still queued
+//    for it are dropped instead of each waiting out the timeout again
+
+static void sendResponse(PoolConnection *pc, RPCWriter &resOut) {
+    {
+        lock_guard<mutex> lock(pc->writeMutex);
+        if (!pc->broken) {
+            try {
+                writeAndCheck(pc->conn.transport, resOut.data(), resOut.size());
+            } catch (C150Exception &e) { // eg. client went away mid write
+                c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Caught %s",
+                                  e.formattedExplanation().c_str());
+                pc->broken = true;
+                shutdown(pc->sock->fileno(), SHUT_RDWR);
+            }
+        }
+    }
+    releaseConnection(pc);
+}
+
+
+// runRequest
+//  - dispatches a request and sends its response as soon as it is done;
+//    stubs generated with --coroutines start it on the executor instead,
+//    which sends it when it finishes, so the worker is free at once
+
+static void runRequest(PoolRequest *req) {
+    PoolConnection *pc = req->pc;
+    bool started = dispatchAsync(req->funcid, req->callid, req->args,
+        [pc](RPCWriter &resOut) { sendResponse(pc, resOut); });
+
+    if (!started) {
+        RPCCursor argsIn(req->args.data(), req->args.size());
+        RPCWriter resOut(NULL);
+        dispatchRequest(req->funcid, req->callid, argsIn, resOut);
+        sendResponse(pc, resOut);
+    }
+    delete req;
+}
+
+
+// workerLoop
+//  - runs tasks forever: reads a ready connection and hands it back to the
+//    poll thread, then runs the first request it read and queues the rest
+//    for other workers, so that a slow request does not hold up the ones
+//    behind it
+
+static void workerLoop() {
+    vector<PoolRequest *> requests;
+    while (1) {
+        PoolTask task;
+        {
+            unique_lock<mutex> lock(readyMutex);
+            readyCond.wait(lock, [] { return !readyQueue.empty(); });
+            task = readyQueue.front();
+            readyQueue.pop_front();
+        }
+
+        if (task.req != NULL) {
+            runRequest(task.req);
+            continue;
+        }
+
+        PoolConnection *pc = task.pc;
+        requests.clear();
+        if (readConnection(pc, requests)) {
+            lock_guard<mutex> lock(returnedMutex);
+            returnedConns.push_back(pc);
+            char c = 0;
+            if (write(wakePipe[1], &c, 1) < 0) {
+                // pipe full, the poll thread is already being woken
+            }
+        } else {
+            releaseConnection(pc); // its requests still hold it open
+        }
+
+        if (requests.size() > 1) {
+            {
+                lock_guard<mutex> lock(readyMutex);
+                for (size_t i = 1; i < requests.size(); i++) {
+                    PoolTask run = { pc, requests[i] };
+                    readyQueue.push_back(run);
+                }
+            }
+            readyCond.notify_all();
+        }
+        if (!requests.empty()) {
+            runRequest(requests[0]);
+        }
+    }
+}
+
+
+// rpcpoolserve
+//  - see rpcpoolserver.h
+
+void rpcpoolserve(RPCListener &listener, int nthreads, int timeout) {
+    if (pipe2(wakePipe, O_NONBLOCK) != 0) {
+        throw RPCException("rpcpoolserver: Could not create wake pipe");
+    }
+
+    c150debug->printf(C150RPCDEBUG,
+        "rpcpoolserver: Listening on %s with %d workers",
+        listener.address(), nthreads);
+    for (int i = 0; i < nthreads; i++) {
+        thread(workerLoop).detach();
+    }
+
+    vector<PoolConnection *> idle;
+    vector<struct pollfd> fds;
+    while (1) {
+        {
+            lock_guard<mutex> lock(returnedMutex);
+            idle.insert(idle.end(), returnedConns.begin(), returnedConns.end());
+            returnedConns.clear();
+        }
+
+        // listener, wake pipe, then one entry per idle connection
+        fds.resize(2 + idle.size());
+        fds[0].fd = listener.fileno();
+        fds[1].fd = wakePipe[0];
+        for (size_t i = 0; i < idle.size(); i++) {
+            fds[2 + i].fd = idle[i]->sock->fileno();
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+
+        if (poll(&fds[0], fds.size(), -1) < 0) continue; // eg. EINTR
+
+        if (fds[1].revents != 0) {
+            char drain[64];
+            if (read(wakePipe[0], drain, sizeof(drain)) < 0) {
+                // nothing left to drain
+            }
+        }
+
+        // hand readable connections to the workers, keep the rest
+        size_t kept = 0;
+        {
+            lock_guard<mutex> lock(readyMutex);
+            for (size_t i = 0; i < idle.size(); i++) {
+                if (fds[2 + i].revents != 0) {
+                    PoolTask read = { idle[i], NULL };
+                    readyQueue.push_back(read);
+                } else {
+                    idle[kept++] = idle[i];
+                }
+            }
+        }
+        if (kept != idle.size()) readyCond.notify_all();
+        idle.resize(kept);
+
+        // new clients go straight to a worker for the handshake, since the
+        // proxy sends its interface id as soon as it connects
+        if (fds[0].revents != 0) {
+            RPCSocketTransport *sock;
+            try {
+                sock = listener.accept();
+            } catch (RPCException &e) { // eg. client gave up while queued
+                c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Caught %s",
+                                  e.formattedExplanation().c_str());
+                continue;
+            }
+            c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Accepted client");
+            sock->turnOnTimeouts(timeout);
+            PoolConnection *pc = new PoolConnection(sock);
+            pc->conn.reader.setTimeout(timeout);
+            {
+                lock_guard<mutex> lock(readyMutex);
+                PoolTask handshake = { pc, NULL };
+                readyQueue.push_back(handshake);
+            }
+            readyCond.notify_one();
+        }
+    }
+}
+
+
+// serveTransport
+//  - handshakes with a connection that has a thread of its own, and
+//    dispatches its requests until the client closes it
+
+static void serveTransport(RPCTransport *transport) {
+    RPCConnection conn(transport);
+
+    try {
+        if (!rpcstubhandshake(conn)) {
+            c150debug->printf(C150RPCDEBUG,
+                "rpcpoolserver: Proxy idl does not match stubs");
+            return;
+        }
+
+        while (!conn.reader.eof()) {
+            dispatchFunction(conn);
+        }
+        c150debug->printf(C150RPCDEBUG, "rpcpoolserver: EOF signaled on input");
+    } catch (C150Exception &e) { // eg. client closed mid write
+        c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Caught %s",
+                          e.formattedExplanation().c_str());
+    }
+}
+
+
+// acceptMemory
+//  - starts a thread for a new memory connection
+
+static void acceptMemory(RPCTransport *server) {
+    thread(serveTransport, server).detach();
+}
+
+
+// rpcmemoryserve
+//  - see rpcpoolserver.h
+
+void rpcmemoryserve(const char *name) {
+    RPCMemoryTransport::listen(name, acceptMemory);
+    c150debug->printf(C150RPCDEBUG,
+        "rpcpoolserver: Listening on mem:%s", name);
+}
+
+
+// serveShm
+//  - takes the mapping a new shared memory client sends over sock, then
+//    serves it
+
+static void serveShm(int sock) {
+    try {
+        serveTransport(RPCShmTransport::accept(sock));
+    } catch (C150Exception &e) {
+        c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Caught %s",
+                          e.formattedExplanation().c_str());
+    }
+}
+
+
+// rpcshmserve
+//  - see rpcpoolserver.h
+//  - a failed accept, or a client no thread could be started for, is logged
+//    and dropped; out of fds, or threads, it waits SHM_ACCEPT_BACKOFF_MS for
+//    clients being served to close some, rather than spin on the listener
+
+void rpcshmserve(RPCListener &listener) {
+    c150debug->printf(C150RPCDEBUG,
+        "rpcpoolserver: Listening for shared memory on %s", listener.address());
+    while (1) {
+        int sock;
+        try {
+            sock = listener.acceptFd();
+        } catch (RPCException &e) { // eg. client gave up while queued
+            int error = errno;
+            c150debug->printf(C150RPCDEBUG, "rpcpoolserver: Caught %s",
+                              e.formattedExplanation().c_str());
+            if (error == EMFILE || error == ENFILE) {
+                this_thread::sleep_for(
+                    chrono::milliseconds(SHM_ACCEPT_BACKOFF_MS));
+            }
+            continue;
+        }
+
+        try {
+            thread(serveShm, sock).detach();
+        } catch (system_error &e) {
+            c150debug->printf(C150RPCDEBUG,
+                "rpcpoolserver: No thread for shared memory client, %s",
+                e.what());
+            close(sock);
+            this_thread::sleep_for(chrono::milliseconds(SHM_ACCEPT_BACKOFF_MS));
+        }
+    }
+}
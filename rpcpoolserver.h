@@ -0,0 +1,48 @@
+// rpcpoolserver.h
+//
+// Declares the concurrent server loop, which serves many clients at once on a
+// fixed pool of worker threads
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCPOOLSERVER_H_
+#define _RPCPOOLSERVER_H_
+
+#include "rpcstubhelper.h"
+
+
+// rpcpoolserve
+//  - accepts on listener and serves every client that connects, until the process
+//    is killed
+//  - one thread polls the listener and all idle connections; a connection
+//    with bytes waiting is handed to one of nthreads workers, which reads
+//    every request buffered for it and then hands it back
+//  - the requests read are spread over the workers, so requests on one
+//    connection run in parallel like those of different clients, and each
+//    response is sent as soon as it is ready, tagged with its call id: a slow
+//    call does not hold up quicker ones sent after it
+//  - timeout: ms allowed for each request once it starts arriving; idle
+//    connections are kept open until the client closes them
+
+void rpcpoolserve(RPCListener &listener, int nthreads, int timeout);
+
+
+// rpcmemoryserve
+//  - serves clients in this process that connect with a servername of
+//    mem:name, each on a thread of its own for as long as it stays connected
+//  - returns at once; a memory connection is never stalled by the kernel, so
+//    there are no timeouts
+
+void rpcmemoryserve(const char *name);
+
+
+// rpcshmserve
+//  - accepts on listener, a unix domain socket, clients that connect with a
+//    servername of shm:path or shmpoll:path, and serves each over the shared
+//    memory it sends, on a thread of its own, until the process is killed
+//  - the thread spins on the client's requests as long as the client asked
+//    for, so with shmpoll: each busy client keeps a core to itself
+
+void rpcshmserve(RPCListener &listener);
+
+#endif
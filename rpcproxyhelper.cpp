@@ -11,7 +11,30 @@
 //        OPERATION
 //
 //        Call rpcproxyinitialize(servername) to open the socket.
+//        servername may be host:port (or tcp:host:port) to
+//        connect to a server that is not on the framework's
+//        default port, eg. one run with rpcserver -p port, or
+//        uring:host:port to talk to it through io_uring where
+//        the kernel has it. unix:path connects to a server run
+//        with rpcserver -s path, and mem:name to stubs in this
+//        same process served with rpcmemoryserve(name). shm:path
+//        talks to a server run with rpcserver -s path -m through
+//        shared memory, and shmpoll:path does too, busy polling
+//        for the lowest latency.
+//        Proxies may then be called from any number of threads.
+//        rpcproxyinitialize(servername, poolsize) lets them open
+//        up to poolsize connections to the server, each thread
+//        keeping to the one it was given, so threads beyond
+//        poolsize share. With queued set, threads do not write
+//        to a connection themselves but queue their requests
+//        for a writer thread, see rpcqueue.h.
+//        servername may also list several servers, separated
+//        by commas, eg. host1:port,host2:port; calls are then
+//        balanced over them, see rpcbalance.h, and a server
+//        that fails is left out for a while.
 //        If there's a problem an exception will be thrown.
+//        An exception is also thrown if the server was generated
+//        from a different idl than the proxies.
 //
 //        LIMITATIONS
 //
@@ -23,9 +46,52 @@
 // --------------------------------------------------------------
 
 #include "rpcproxyhelper.h"
+#include "rpcutils.h"
+#include "rpcuring.h"
+#include "rpcshm.h"
+#include "rpcqueue.h"
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 using namespace C150NETWORK;  // for all the comp150 utilities 
 
+// most calls sent but not yet answered on a connection, see
+// rpcproxynextcall
+const unsigned MAX_CALLS_IN_FLIGHT = 256;
+
+// most connections open at once, to every server together; a call id holds
+// the slot of its connection in its top bits, then the slot's generation,
+// bumped each time the slot of a closed connection is reused, so a call id
+// of the connection before is never taken for one of the new, and its
+// sequence number in the rest
+const int MAX_POOL_SIZE = 4096;
+const int CALL_GEN_BITS = 4;
+const int CALL_SEQ_BITS = 16;
+const int CALL_SLOT_SHIFT = CALL_GEN_BITS + CALL_SEQ_BITS;
+const RPCCallId CALL_GEN_MASK = (1u << CALL_GEN_BITS) - 1;
+const RPCCallId CALL_SEQ_MASK = (1u << CALL_SEQ_BITS) - 1;
+
+// most connections to one server, and most servers, see rpcproxyinitialize
+const int MAX_ENDPOINT_CONNECTIONS = 256;
+const int MAX_ENDPOINTS = 32;
+
+// how long a server that failed is left out, doubled each time it fails
+// again before it answers a call
+const long long EJECT_MS = 1000;
+const long long MAX_EJECT_MS = 30000;
+
+// most bytes of queued requests a writer thread sends in one write
+const size_t MAX_QUEUED_WRITE = 1 << 20;
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 //
 //    Global variable where proxies can find socket.
@@ -33,24 +99,1163 @@ using namespace C150NETWORK;  // for all the comp150 utilities
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
 C150StreamSocket *RPCPROXYSOCKET;
- 
+RPCConnection *RPCPROXYCONNECTION;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    Endpoint: one of the servers the client was given, its
+//    stats for the balancer, and its connections. An
+//    ejected endpoint is not given calls until ejectedUntil
+//    (ms, see rpcNowMs) has passed; its connections are
+//    dead then, and are replaced once it is picked again,
+//    while each is closed once its calls are answered.
+//    opening counts the connections to it being opened,
+//    which is done without poolMutex held. conns,
+//    connCount and opening are guarded by poolMutex.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+struct Endpoint {
+  RPCEndpoint stats;
+  RPCProxyConnection *conns[MAX_ENDPOINT_CONNECTIONS];
+  int connCount;
+  int opening;
+  unsigned nextAffinity;
+  atomic<long long> ejectedUntil;
+  atomic<long long> ejectMs; // how long the next ejection lasts
+
+  Endpoint(const string &name, int index) :
+    stats(name, index), connCount(0), opening(0), nextAffinity(0),
+    ejectedUntil(0),
+    ejectMs(EJECT_MS)
+  {};
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    RPCProxyConnection: a connection of the pool, with the
+//    call ids it has handed out so far, calls whose
+//    responses have not been read yet, responses that
+//    were read before they were asked for, and calls that
+//    were abandoned, whose responses are dropped instead.
+//
+//    responseMutex guards all of these and reading, which
+//    is set while one thread has the connection to read
+//    from; threads that want a response meanwhile wait on
+//    responseArrived. sendMutex keeps request frames whole.
+//    completions are the calls to be told when their
+//    response is held, see rpcproxyoncomplete. A queued
+//    connection has a submission queue instead, which only
+//    its writer thread writes from. sentAt holds when each
+//    call in flight was sent, by the low bits of its id,
+//    while calls are being balanced. traceIds holds the
+//    trace id of each traced call in flight, by its id, as
+//    calls need not be answered in order; traceMutex guards
+//    it, as responses are read without responseMutex.
+//
+//    A dead connection is closed once nothing is left on
+//    it, see closeIfDrained, and freed once its pump and
+//    writer threads have stopped, see freeIfIdle; its slot
+//    then takes the next connection opened, in place, so
+//    that threads still holding it only ever find it dead
+//    or a live connection.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+struct HeldResponse {
+  StatusCode code;
+  string bytes;
+  RPCTraceId traceid;
+};
+
+struct RPCProxyConnection {
+  RPCConnection *conn;
+  Endpoint *endpoint;
+  RPCCallId index; // of the connection in the pool, shifted into place
+  RPCCallId lastSeq;
+  atomic<unsigned> callsInFlight;
+  unordered_map<RPCCallId, HeldResponse> heldResponses;
+  unordered_set<RPCCallId> abandoned;
+  bool reading;
+  mutex responseMutex;
+  condition_variable responseArrived;
+  mutex sendMutex;
+  unordered_map<RPCCallId, function<void()>> completions;
+  bool pumpRunning;
+  bool pumpStopped;
+  RPCSubmitQueue *queue;
+  bool writerRunning;
+  atomic<bool> writeFailed;
+  atomic<bool> dead; // its endpoint was ejected, no new calls
+  atomic<bool> closed; // dead and drained, its transport going away
+  long long sentAt[MAX_CALLS_IN_FLIGHT];
+  unordered_map<RPCCallId, RPCTraceId> traceIds;
+  mutex traceMutex;
+
+  RPCProxyConnection(int slot) :
+    conn(NULL), endpoint(NULL), index((RPCCallId)slot << CALL_SLOT_SHIFT),
+    lastSeq(0), callsInFlight(0), reading(false), pumpRunning(false),
+    pumpStopped(false), queue(NULL), writerRunning(false), writeFailed(false),
+    dead(false), closed(false)
+  {};
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    The pool. Slots are only ever added, and reused in
+//    place, so a call id finds its connection without a
+//    lock; poolMutex is held while one is opened or an
+//    endpoint ejected, and guards freeSlots, the slots of
+//    connections that were freed; a connection is opened
+//    without it, and threads that find every connection to
+//    an endpoint still being opened wait on
+//    connectionOpened. Each thread keeps the
+//    connection it was first given to each endpoint in
+//    threadConnections. balancing is set if there is more
+//    than one endpoint.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static RPCProxyConnection *pool[MAX_POOL_SIZE];
+static atomic<int> poolSize(0);
+static int poolLimit = 1;
+static bool poolQueued = false;
+static mutex poolMutex;
+static vector<int> freeSlots;
+static condition_variable connectionOpened;
+static Endpoint *endpoints[MAX_ENDPOINTS];
+static int endpointCount = 0;
+static bool balancing = false;
+static RPCBalancer *balancer = new RPCRoundRobin();
+static thread_local RPCProxyConnection *threadConnections[MAX_ENDPOINTS];
+static thread_local int awaitingNow = 0; // RPCAwaitNow's in scope
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                freeIfIdle
+//
+//     Called with pc's responseMutex held. Once pc is closed
+//     and neither its pump nor its writer thread is still
+//     running, deletes its transport and queue, and gives
+//     its slot back for the next connection opened.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void freeIfIdle(RPCProxyConnection &pc) {
+
+  if (!pc.closed || pc.conn == NULL || pc.pumpRunning || pc.writerRunning) {
+    return;
+  }
+  lock_guard<mutex> lock(poolMutex);
+  if (RPCPROXYCONNECTION == pc.conn) RPCPROXYCONNECTION = NULL;
+  delete pc.conn; // closes the transport
+  pc.conn = NULL;
+  delete pc.queue;
+  pc.queue = NULL;
+  pc.completions.clear();
+  pc.abandoned.clear(); // of calls that failed
+  {
+    lock_guard<mutex> traceLock(pc.traceMutex);
+    pc.traceIds.clear(); // of calls whose send failed
+  }
+  freeSlots.push_back(pc.index >> CALL_SLOT_SHIFT);
+  c150debug->printf(C150RPCDEBUG, "rpcproxyhelper: Freed connection %u",
+                    pc.index >> CALL_SLOT_SHIFT);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                closeIfDrained
+//
+//     Called with pc's responseMutex held. Closes pc if it
+//     is dead and nothing is left on it: no calls in flight,
+//     no responses held, and no thread reading. Its pump
+//     and writer thread are woken to stop, and anyone still
+//     waiting on one of its call ids to give up.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void closeIfDrained(RPCProxyConnection &pc) {
+
+  if (!pc.dead || pc.closed || pc.callsInFlight != 0 || pc.reading ||
+      !pc.heldResponses.empty()) {
+    return;
+  }
+  pc.closed = true;
+  pc.responseArrived.notify_all();
+  if (pc.writerRunning) {
+    string wakeup; // an empty frame, see writeQueued
+    pc.queue->push(wakeup);
+  }
+  freeIfIdle(pc);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                eject
+//
+//     Leaves endpoint e out of the balancing for a while,
+//     after one of its connections failed. Its connections
+//     are not given new calls; calls already in flight on
+//     them finish, or fail, as they would have, and each is
+//     closed once they have, see closeIfDrained.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void eject(Endpoint &e) {
+
+  vector<RPCProxyConnection *> ejected;
+  long long ms;
+  {
+    lock_guard<mutex> lock(poolMutex);
+    ms = e.ejectMs;
+    e.ejectedUntil = rpcNowMs() + ms;
+    e.ejectMs = min(2 * ms, MAX_EJECT_MS);
+
+    for (int i = 0; i < e.connCount; i++) {
+      if (!e.conns[i]->dead.exchange(true)) {
+        e.stats.outstanding -= e.conns[i]->callsInFlight; // never answered
+        ejected.push_back(e.conns[i]);
+      }
+    }
+    e.connCount = 0;
+  }
+
+  c150debug->printf(C150RPCDEBUG, "rpcproxyhelper: Ejected %s for %lld ms",
+                    e.stats.name.c_str(), ms);
+  for (RPCProxyConnection *pc : ejected) {
+    lock_guard<mutex> lock(pc->responseMutex);
+    closeIfDrained(*pc);
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                connectionFailed
+//
+//     Called as a read or write on pc throws. With more
+//     than one endpoint, ejects pc's, unless pc was already
+//     dead, ie. the endpoint ejected for the same failure.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void connectionFailed(RPCProxyConnection &pc) {
+
+  if (balancing && !pc.dead) {
+    eject(*pc.endpoint);
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                openConnection
+//
+//     Opens one connection to servername, and checks that
+//     the server's stubs were generated from the same idl.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static RPCConnection *openConnection(char *servername) {
+
+  RPCConnection *conn;
+  string host;
+  int port;
+  if (strncmp(servername, "tcp:", 4) == 0) {
+    servername += 4; // the same as no scheme
+  }
+
+  c150debug->printf(C150RPCDEBUG,"rpcproxyinitialize: Connecting to %s",
+                    servername);
+  if (strncmp(servername, "shm:", 4) == 0 ||
+      strncmp(servername, "shmpoll:", 8) == 0) {
+    // Server on the same machine run with rpcserver -s path -m, with
+    // requests and responses in memory shared with it
+    bool poll = (servername[3] != ':');
+    conn = new RPCConnection(RPCShmTransport::connect(
+      strchr(servername, ':') + 1,
+      poll ? RPCShmTransport::POLL_SPIN_US : RPCShmTransport::DEFAULT_SPIN_US));
+  } else if (strncmp(servername, "unix:", 5) == 0) {
+    // Server on the same machine, see rpcserver -s
+    conn = new RPCConnection(RPCSocketTransport::connectUnix(servername + 5));
+  } else if (strncmp(servername, "mem:", 4) == 0) {
+    // Stubs in this process, see rpcmemoryserve
+    conn = new RPCConnection(RPCMemoryTransport::connect(servername + 4));
+  } else if (strncmp(servername, "uring:", 6) == 0) {
+    // Same, but sends each request with the wait for its response
+    if (!splitHostPort(servername + 6, host, port)) {
+      throw RPCException("rpcproxyinitialize: No port in " +
+                         string(servername) + ", need uring:host:port");
+    }
+    conn = new RPCConnection(RPCUringTransport::connect(host.c_str(), port));
+  } else if (splitHostPort(servername, host, port)) {
+    // Server on a port of its own, see rpcserver -p
+    conn = new RPCConnection(RPCSocketTransport::connect(host.c_str(), port));
+  } else {
+    c150debug->printf(C150RPCDEBUG,"rpcproxyinitialize: Creating C150StreamSocket");
+    RPCPROXYSOCKET = new C150StreamSocket();
+
+    // Tell the Streamsocket which server to talk to
+    // Note that the port number is defaulted according to
+    // student logon by the COMP 150-IDS framework
+    RPCPROXYSOCKET -> connect(servername);  
+    conn = new RPCConnection(new RPCC150Transport(RPCPROXYSOCKET));
+  }
+
+  // Check that the server's stubs were generated from the same idl,
+  // otherwise function ids would be dispatched to the wrong stubs
+  writeInt(conn->transport, rpcInterfaceId());
+  StatusCode code = (StatusCode)readInt(conn->reader);
+  if (code != matching_interface) {
+    delete conn;
+    throw RPCException("rpcproxyinitialize: " + debugStatusCode(code));
+  }
+  return conn;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                writeQueued
+//
+//     A queued connection's writer thread. Sends whatever
+//     requests have been queued, up to MAX_QUEUED_WRITE at
+//     a time, in one write, and sleeps when there are none.
+//     Stops if a write fails; the requests it held are lost
+//     and rpcproxysend refuses any more. Also stops once
+//     the connection is closed, woken by an empty frame.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void writeQueued(RPCProxyConnection *pc) {
+
+  string frames;
+  try {
+    while (!pc->closed) {
+      pc->queue->wait();
+      while (pc->queue->take(frames, MAX_QUEUED_WRITE)) {
+        if (!frames.empty()) {
+          writeAndCheck(pc->conn->transport, frames.data(), frames.size());
+          pc->conn->transport->flush(); // this thread never waits on them
+        }
+        frames.clear();
+      }
+    }
+  } catch (C150Exception &e) {
+    c150debug->printf(C150RPCDEBUG, "rpcproxyhelper: Caught %s",
+                      e.formattedExplanation().c_str());
+  }
+
+  unique_lock<mutex> lock(pc->responseMutex);
+  pc->writerRunning = false;
+  if (pc->closed) {
+    freeIfIdle(*pc);
+    return;
+  }
+  lock.unlock();
+  pc->writeFailed = true;
+  connectionFailed(*pc);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                addConnection
+//
+//     Puts conn to endpoint e in the pool, with a queue and
+//     writer thread if the pool is queued, in the slot of
+//     a connection that was freed if there is one. Called
+//     with poolMutex held.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static RPCProxyConnection *addConnection(Endpoint &e, RPCConnection *conn) {
+
+  RPCProxyConnection *pc;
+  if (!freeSlots.empty()) {
+    pc = pool[freeSlots.back()];
+    freeSlots.pop_back();
+  } else if (poolSize < MAX_POOL_SIZE) {
+    pc = new RPCProxyConnection(poolSize);
+    pool[poolSize] = pc;
+    poolSize++;
+  } else {
+    delete conn;
+    throw RPCException("rpcproxyhelper: Too many connections open");
+  }
+
+  // a reused slot's old call ids may still be waited for, see rpcproxyawait
+  lock_guard<mutex> lock(pc->responseMutex);
+  RPCCallId slot = pc->index >> CALL_SLOT_SHIFT;
+  RPCCallId gen = ((pc->index >> CALL_SEQ_BITS) + 1) & CALL_GEN_MASK;
+  pc->index = (slot << CALL_SLOT_SHIFT) | (gen << CALL_SEQ_BITS);
+  pc->conn = conn;
+  pc->endpoint = &e;
+  pc->lastSeq = 0;
+  pc->pumpStopped = false;
+  pc->writeFailed = false;
+  pc->closed = false;
+  if (poolQueued) {
+    pc->queue = new RPCSubmitQueue();
+    pc->writerRunning = true;
+    thread(writeQueued, pc).detach();
+  }
+  pc->dead = false; // last, threads holding the slot check it first
+  e.conns[e.connCount++] = pc;
+  return pc;
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 //
 //                rpcproxyinitialize
 //
-//     Opens the socket and leaves it in global variable.
-//     Note that the socket call may throw an exception 
-//     which is NOT caught here.
+//     Opens a first connection to each server, and leaves
+//     the first in global variable; the rest of the pool is
+//     opened as threads first call proxies. Note that the
+//     socket call may throw an exception which is NOT caught
+//     here.
+//
+//     Once connected, the id of the proxies' idl is sent
+//     and the server answers whether its stubs match. An
+//     RPCException is thrown if they do not. Of several
+//     servers, those that cannot be reached or do not match
+//     are ejected instead, and only if none of them can is
+//     the exception thrown.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyinitialize(char *servername, int poolsize, bool queued) {
+
+  lock_guard<mutex> lock(poolMutex);
+  RPCPROXYSOCKET = NULL;
+  RPCPROXYCONNECTION = NULL;
+  poolQueued = queued;
+
+  vector<string> names;
+  stringstream list(servername);
+  string name;
+  while (getline(list, name, ',')) {
+    if (!name.empty()) names.push_back(name);
+  }
+  if (names.empty() || names.size() > (size_t)MAX_ENDPOINTS) {
+    throw RPCException("rpcproxyinitialize: Need 1 to 32 server names");
+  }
+  endpointCount = names.size();
+  balancing = (endpointCount > 1);
+
+  RPCException failure("rpcproxyinitialize: No server");
+  for (int i = 0; i < endpointCount; i++) {
+    endpoints[i] = new Endpoint(names[i], i);
+    try {
+      RPCProxyConnection *pc = addConnection(*endpoints[i],
+        openConnection(&names[i][0]));
+      if (RPCPROXYCONNECTION == NULL) RPCPROXYCONNECTION = pc->conn;
+    } catch (C150Exception &e) { // eg. the framework's socket, for a plain host
+      if (!balancing) throw;
+      failure = RPCException(e.explanation());
+      endpoints[i]->ejectedUntil = rpcNowMs() + EJECT_MS;
+      c150debug->printf(C150RPCDEBUG, "rpcproxyinitialize: Ejected %s, %s",
+                        names[i].c_str(), e.formattedExplanation().c_str());
+    }
+  }
+  if (RPCPROXYCONNECTION == NULL) {
+    throw failure;
+  }
+
+  // the framework's socket is the only connection to its server, which
+  // serves one at a time anyway
+  poolLimit = (RPCPROXYSOCKET != NULL) ? 1 :
+    max(1, min(poolsize, MAX_ENDPOINT_CONNECTIONS));
+  c150debug->printf(C150RPCDEBUG,
+                    "rpcproxyinitialize: %d servers, up to %d connections each%s",
+                    endpointCount, poolLimit, queued ? ", queued" : "");
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxybalance
+//
+//     See rpcproxyhelper.h. The old policy is not freed, a
+//     thread may still be in it.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxybalance(RPCBalancer *policy) {
+
+  balancer = policy;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                chooseEndpoint
+//
+//     Asks the balancer for an endpoint of those not
+//     ejected, or of all of them if every one is.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static Endpoint &chooseEndpoint() {
+
+  RPCEndpoint *healthy[MAX_ENDPOINTS];
+  int count = 0;
+  long long now = rpcNowMs();
+  for (int i = 0; i < endpointCount; i++) {
+    if (endpoints[i]->ejectedUntil <= now) {
+      healthy[count++] = &endpoints[i]->stats;
+    }
+  }
+  if (count == 0) {
+    for (int i = 0; i < endpointCount; i++) {
+      healthy[count++] = &endpoints[i]->stats;
+    }
+  }
+  return *endpoints[healthy[balancer->choose(healthy, count)]->index];
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                connectionTo
+//
+//     Gives the calling thread a connection to endpoint e: a
+//     new one while e has room, and the next one round robin
+//     after that. Room for the new one is taken first, and
+//     the connection and handshake made with poolMutex let
+//     go, so that a slow server holds up no other thread
+//     checking out a connection; it is only put in the pool
+//     once it is open.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static RPCProxyConnection *connectionTo(Endpoint &e) {
+
+  unique_lock<mutex> lock(poolMutex);
+  while (e.connCount + e.opening >= poolLimit) {
+    if (e.connCount > 0) {
+      return e.conns[e.nextAffinity++ % e.connCount];
+    }
+    connectionOpened.wait(lock); // every one is still being opened
+  }
+  e.opening++;
+  lock.unlock();
+
+  RPCConnection *conn;
+  try {
+    conn = openConnection(&e.stats.name[0]);
+  } catch (...) {
+    lock.lock();
+    e.opening--;
+    connectionOpened.notify_all(); // a waiter may open one instead
+    throw;
+  }
+
+  lock.lock();
+  e.opening--;
+  connectionOpened.notify_all();
+  return addConnection(e, conn);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxycheckout
+//
+//     See rpcproxyhelper.h. With more than one endpoint, the
+//     balancer picks one for every call, and the thread's
+//     connection to it is used, unless it died, or was
+//     freed and its slot reused for another endpoint. If a
+//     connection cannot be opened, the endpoint is ejected
+//     and another picked.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCProxyConnection *rpcproxycheckout() {
+
+  if (endpointCount == 0) {
+    throw RPCException("rpcproxycheckout: rpcproxyinitialize was not called");
+  }
+  if (!balancing) {
+    RPCProxyConnection *&mine = threadConnections[0];
+    if (mine == NULL) mine = connectionTo(*endpoints[0]);
+    return mine;
+  }
+
+  for (int tries = 0; tries < endpointCount; tries++) {
+    Endpoint &e = chooseEndpoint();
+    RPCProxyConnection *&mine = threadConnections[e.stats.index];
+    if (mine != NULL && !mine->dead && mine->endpoint == &e) {
+      return mine; // its slot may have been reused, but for e
+    }
+    try {
+      mine = connectionTo(e);
+      return mine;
+    } catch (C150Exception &ex) {
+      c150debug->printf(C150RPCDEBUG, "rpcproxycheckout: %s",
+                        ex.formattedExplanation().c_str());
+      eject(e);
+    }
+  }
+  throw RPCException("rpcproxycheckout: No server could be reached");
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxycheckout(endpoint)
+//
+//     See rpcproxyhelper.h. The thread's connection to that
+//     server, or a new one if it has none or it died; an
+//     endpoint that is ejected is still tried.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCProxyConnection *rpcproxycheckout(int endpoint) {
+
+  if (endpoint < 0 || endpoint >= endpointCount) {
+    throw RPCException("rpcproxycheckout: No such server");
+  }
+  Endpoint &e = *endpoints[endpoint];
+  RPCProxyConnection *&mine = threadConnections[endpoint];
+  if (mine != NULL && !mine->dead && mine->endpoint == &e) {
+    return mine;
+  }
+  try {
+    mine = connectionTo(e);
+  } catch (C150Exception &ex) {
+    if (balancing) eject(e);
+    throw;
+  }
+  return mine;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyendpoints
+//
+//     See rpcproxyhelper.h
 //
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
-void rpcproxyinitialize(char *servername) {
+int rpcproxyendpoints() {
+
+  return endpointCount;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxytransport
+//
+//     See rpcproxyhelper.h
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCTransport *rpcproxytransport(RPCProxyConnection *pc) {
+
+  return pc->conn->transport;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                connectionOf
+//
+//     Finds the slot of the connection a call was sent on.
+//     The connection may have been closed since, and the
+//     slot reused; see sentOn.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static RPCProxyConnection &connectionOf(RPCCallId callid) {
+
+  int slot = callid >> CALL_SLOT_SHIFT;
+  if (slot >= poolSize) {
+    throw RPCException("rpcproxyhelper: Call id of no connection");
+  }
+  return *pool[slot];
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                sentOn
+//
+//     Whether call callid was sent on pc as it is now, ie.
+//     pc is not closed and its slot not reused since. Called
+//     with pc's responseMutex held.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static bool sentOn(RPCProxyConnection &pc, RPCCallId callid) {
+
+  return !pc.closed && (callid & ~CALL_SEQ_MASK) == pc.index;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                readResponse
+//
+//     Reads the next response frame off the connection.
+//     resIn points into the read-ahead buffer, so it is only
+//     good until the next read. traceid is the trace id its
+//     call was sent with, or 0.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static RPCCallId readResponse(RPCProxyConnection &pc, StatusCode &code,
+                              RPCCursor &resIn, RPCTraceId &traceid) {
+
+  RPCReader &reader = pc.conn->reader;
+  reader.beginMessage();
+  RPCCallId callid = readInt(reader);
+  code = (StatusCode)readInt(reader);
+  int resSize = readInt(reader);
+  resIn = readSpan(reader, resSize); // no copy of result
+  traceid = 0;
+  if (rpcTracing()) {
+    lock_guard<mutex> lock(pc.traceMutex);
+    unordered_map<RPCCallId, RPCTraceId>::iterator traced =
+      pc.traceIds.find(callid);
+    if (traced != pc.traceIds.end()) {
+      traceid = traced->second;
+      pc.traceIds.erase(traced);
+    }
+  }
+  pc.callsInFlight--;
+
+  if (balancing && !pc.dead) {
+    RPCEndpoint &stats = pc.endpoint->stats;
+    stats.outstanding--;
+    stats.recordLatency(rpcNowUs() - pc.sentAt[callid % MAX_CALLS_IN_FLIGHT]);
+    pc.endpoint->ejectMs = EJECT_MS; // it answers again
+  }
+  return callid;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                holdResponse
+//
+//     Copies a response out of the read-ahead buffer until
+//     its call is waited for, unless its call was abandoned
+//     and never will be.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void holdResponse(RPCProxyConnection &pc, RPCCallId callid,
+                         StatusCode code, RPCCursor &resIn,
+                         RPCTraceId traceid) {
+
+  if (pc.abandoned.erase(callid) != 0) {
+    return;
+  }
+  size_t resSize = resIn.remaining();
+  HeldResponse &held = pc.heldResponses[callid];
+  held.code = code;
+  held.traceid = traceid;
+  held.bytes.assign(resIn.take(resSize), resSize);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                readOne
+//
+//     Called with lock held and no other thread reading.
+//     Reads the next response with the lock let go, so other
+//     threads can still send and check for held responses.
+//     If it is callid's, response is filled in and left
+//     leased, and true returned with the lock still let go;
+//     otherwise the response is held for its caller, the
+//     threads waiting are woken, and false returned with the
+//     lock taken again.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static bool readOne(RPCProxyConnection &pc, unique_lock<mutex> &lock,
+                    RPCCallId callid, RPCProxyResponse *response) {
+
+  StatusCode code;
+  RPCCursor resIn(NULL, 0);
+  RPCTraceId traceid;
+  RPCCallId got;
+  pc.reading = true;
+  lock.unlock();
+  try {
+    got = readResponse(pc, code, resIn, traceid);
+  } catch (...) {
+    connectionFailed(pc);
+    lock.lock();
+    pc.reading = false;
+    pc.responseArrived.notify_all(); // let another try, and fail the same
+    throw;
+  }
+
+  if (response != NULL && got == callid) {
+    response->code = code;
+    response->resIn = resIn;
+    response->leased = &pc;
+    response->traceid = traceid;
+    return true;
+  }
+
+  lock.lock();
+  holdResponse(pc, got, code, resIn, traceid);
+  pc.reading = false;
+  pc.responseArrived.notify_all();
+  closeIfDrained(pc); // if it was dropped
+
+  unordered_map<RPCCallId, function<void()>>::iterator completion =
+    pc.completions.find(got);
+  if (completion != pc.completions.end()) {
+    function<void()> done = move(completion->second);
+    pc.completions.erase(completion);
+    lock.unlock();
+    done();
+    lock.lock();
+  }
+  return false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyrelease
+//
+//     See rpcproxyhelper.h
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyrelease(RPCProxyConnection *pc) {
+
+  lock_guard<mutex> lock(pc->responseMutex);
+  pc->reading = false;
+  pc->responseArrived.notify_all();
+  closeIfDrained(*pc);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxynextcall
+//
+//     See rpcproxyhelper.h. The server stops reading a
+//     connection while it cannot write its responses, so a
+//     client that only ever wrote could deadlock against it.
+//     pc may have been closed since it was checked out, if
+//     it was dead by then; the call fails as those in
+//     flight on it would have.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCCallId rpcproxynextcall(RPCProxyConnection *pc, RPCTraceId traceid) {
+
+  unique_lock<mutex> lock(pc->responseMutex);
+  if (pc->closed) {
+    throw RPCException("rpcproxynextcall: Connection was closed");
+  }
+  while (pc->callsInFlight >= MAX_CALLS_IN_FLIGHT) {
+    if (pc->reading) {
+      pc->responseArrived.wait(lock); // the reader makes room
+    } else {
+      readOne(*pc, lock, 0, NULL);
+    }
+  }
+
+  pc->callsInFlight++;
+  pc->lastSeq = (pc->lastSeq + 1) & CALL_SEQ_MASK;
+  if (pc->lastSeq == 0) pc->lastSeq = 1; // 0 is never a call
+  if (pc->pumpRunning) {
+    pc->responseArrived.notify_all(); // something to read, see pumpResponses
+  }
+
+  // a call's slot is free again by the time its seq comes around, as no
+  // more than MAX_CALLS_IN_FLIGHT are ever in flight, but for the one seq
+  // skipped at the wrap, which costs at most a latency sample
+  if (balancing) {
+    pc->sentAt[pc->lastSeq % MAX_CALLS_IN_FLIGHT] = rpcNowUs();
+    pc->endpoint->stats.outstanding++;
+  }
+  if (traceid != 0) {
+    lock_guard<mutex> traceLock(pc->traceMutex);
+    pc->traceIds[pc->index | pc->lastSeq] = traceid;
+  }
+  return pc->index | pc->lastSeq;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxysend
+//
+//     See rpcproxyhelper.h. On a queued connection the frame
+//     is only queued, and goes out with whatever else the
+//     writer thread finds queued by the time it gets to it.
+//     A call that could not be sent is no longer in flight,
+//     its caller never gets its call id to wait for it.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void sendFailed(RPCProxyConnection *pc) {
+
+  lock_guard<mutex> lock(pc->responseMutex);
+  pc->callsInFlight--;
+  closeIfDrained(*pc);
+}
+
+void rpcproxysend(RPCProxyConnection *pc, RPCWriter &argsOut,
+                  RPCTraceId traceid) {
+
+  RPCTraceSpan span("send", traceid, 's');
+  if (pc->queue != NULL) {
+    if (pc->writeFailed) {
+      sendFailed(pc);
+      throw RPCException("rpcproxysend: Connection can no longer be written");
+    }
+    string frame;
+    argsOut.moveTo(frame);
+    pc->queue->push(frame);
+    return;
+  }
+
+  lock_guard<mutex> lock(pc->sendMutex);
+  try {
+    argsOut.flush();
+    if (awaitingNow == 0) pc->conn->transport->flush();
+  } catch (...) {
+    connectionFailed(*pc);
+    sendFailed(pc);
+    throw;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyunsent
+//
+//     See rpcproxyhelper.h. Undoes what rpcproxynextcall
+//     counted the call in; the connection is still good.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyunsent(RPCProxyConnection *pc, RPCCallId callid) {
+
+  {
+    lock_guard<mutex> traceLock(pc->traceMutex);
+    pc->traceIds.erase(callid);
+  }
+  if (balancing && !pc->dead) {
+    pc->endpoint->stats.outstanding--;
+  }
+  sendFailed(pc);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyawait
+//
+//     See rpcproxyhelper.h. The server may answer calls out
+//     of order, eg. a quick call sent after a slow one, so
+//     even a client that receives its calls in the order it
+//     sent them may have responses held. A call whose
+//     response cannot be read is no longer in flight either,
+//     so that a dead connection still drains.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyawait(RPCCallId callid, RPCProxyResponse &response) {
+
+  RPCProxyConnection &pc = connectionOf(callid);
+  unique_lock<mutex> lock(pc.responseMutex);
+  long long waitNs = rpcTracing() ? rpcNowNs() : 0;
+  while (1) {
+    unordered_map<RPCCallId, HeldResponse>::iterator held =
+      pc.heldResponses.find(callid);
+    if (held != pc.heldResponses.end()) {
+      response.code = held->second.code;
+      response.held.swap(held->second.bytes);
+      response.resIn = RPCCursor(response.held.data(), response.held.size());
+      response.traceid = held->second.traceid;
+      pc.heldResponses.erase(held);
+      closeIfDrained(pc);
+      if (waitNs != 0) {
+        rpctracespan("wait", waitNs, rpcNowNs(), response.traceid, 'f');
+      }
+      return;
+    }
+    if (!sentOn(pc, callid)) {
+      throw RPCException("rpcproxyawait: Connection of the call was closed");
+    }
+
+    if (pc.reading) {
+      pc.responseArrived.wait(lock); // someone else is reading, maybe ours
+      continue;
+    }
+    bool ours;
+    try {
+      ours = readOne(pc, lock, callid, &response);
+    } catch (...) {
+      pc.callsInFlight--; // never answered
+      closeIfDrained(pc);
+      throw;
+    }
+    if (ours) {
+      if (waitNs != 0) { // lock already let go, see readOne
+        rpctracespan("wait", waitNs, rpcNowNs(), response.traceid, 'f');
+      }
+      return;
+    }
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                pumpResponses
+//
+//     Reads and holds responses until the connection breaks,
+//     for rpcproxyoncomplete. Then every call still waiting
+//     is completed, so its caller finds out from its recv.
+//     Only reads while calls are in flight, so that it never
+//     sits in a read that keeps a dead connection from
+//     closing, and stops once it is closed.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void pumpResponses(RPCProxyConnection *pc) {
+
+  unique_lock<mutex> lock(pc->responseMutex);
+  try {
+    while (!pc->closed) {
+      if (pc->reading || pc->callsInFlight == 0) {
+        pc->responseArrived.wait(lock); // see rpcproxynextcall
+      } else {
+        readOne(*pc, lock, 0, NULL);
+      }
+    }
+  } catch (C150Exception &e) {
+    c150debug->printf(C150RPCDEBUG, "rpcproxyhelper: Caught %s",
+                      e.formattedExplanation().c_str());
+    pc->pumpStopped = true;
+  }
+
+  pc->pumpRunning = false;
+  unordered_map<RPCCallId, function<void()>> waiting;
+  waiting.swap(pc->completions);
+  freeIfIdle(*pc);
+  lock.unlock();
+  for (auto &completion : waiting) {
+    completion.second();
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyoncomplete
+//
+//     See rpcproxyhelper.h. Each connection that has calls
+//     completed this way gets a pump of its own, until it
+//     is closed.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+bool rpcproxyoncomplete(RPCCallId callid, function<void()> done) {
+
+  RPCProxyConnection &pc = connectionOf(callid);
+  lock_guard<mutex> lock(pc.responseMutex);
+  if (pc.pumpStopped || pc.heldResponses.count(callid) != 0 ||
+      !sentOn(pc, callid)) {
+    return false; // recv finds it, or the error, without waiting
+  }
+  pc.completions[callid] = move(done);
+
+  if (!pc.pumpRunning) {
+    pc.pumpRunning = true;
+    thread(pumpResponses, &pc).detach();
+  }
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxygather
+//
+//     See rpcproxyhelper.h. Each call is completed through
+//     rpcproxyoncomplete, whose done notes it as ready, or,
+//     once enough are, receives and drops its response, so
+//     that calls not gathered are still received once.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+struct Gathering {
+  mutex readyMutex;
+  condition_variable readyArrived;
+  vector<int> ready;
+  bool gathered = false;
+};
+
+vector<int> rpcproxygather(const vector<RPCCallId> &callids, size_t first) {
+
+  shared_ptr<Gathering> g = make_shared<Gathering>();
+  size_t sent = 0;
+  for (size_t i = 0; i < callids.size(); i++) {
+    if (callids[i] == 0) continue;
+    sent++;
+
+    RPCCallId callid = callids[i];
+    function<void()> done = [g, i, callid] {
+      {
+        lock_guard<mutex> lock(g->readyMutex);
+        if (!g->gathered) {
+          g->ready.push_back(i);
+          g->readyArrived.notify_all();
+          return;
+        }
+      }
+      RPCProxyResponse dropped;
+      try {
+        rpcproxyawait(callid, dropped);
+      } catch (C150Exception &e) {
+        // its connection broke, nothing left to receive
+      }
+    };
+    if (!rpcproxyoncomplete(callid, done)) {
+      done();
+    }
+  }
+
+  size_t wanted = (first == 0) ? sent : min(first, sent);
+  unique_lock<mutex> lock(g->readyMutex);
+  g->readyArrived.wait(lock, [&] { return g->ready.size() >= wanted; });
+  g->gathered = true;
+  return g->ready;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                RPCAwaitNow
+//
+//     See rpcproxyhelper.h. They nest, eg. a batch made in
+//     the scope of another.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCAwaitNow::RPCAwaitNow() {
+  awaitingNow++;
+}
+
+RPCAwaitNow::~RPCAwaitNow() {
+  awaitingNow--;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyabandon
+//
+//     See rpcproxyhelper.h. Called from destructors, so it
+//     never throws; a call id of a connection that has been
+//     closed since has nothing left to drop.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
-  c150debug->printf(C150RPCDEBUG,"rpcproxyinitialize: Creating C150StreamSocket");
-  RPCPROXYSOCKET = new C150StreamSocket();
+void rpcproxyabandon(RPCCallId callid) {
 
-  // Tell the Streamsocket which server to talk to
-  // Note that the port number is defaulted according to
-  // student logon by the COMP 150-IDS framework
-  RPCPROXYSOCKET -> connect(servername);  
+  if ((int)(callid >> CALL_SLOT_SHIFT) >= poolSize) {
+    return;
+  }
+  RPCProxyConnection &pc = connectionOf(callid);
+  lock_guard<mutex> lock(pc.responseMutex);
+  if (!sentOn(pc, callid)) {
+    return;
+  }
+  if (pc.heldResponses.erase(callid) == 0) {
+    pc.abandoned.insert(callid); // still in flight
+  }
+  closeIfDrained(pc);
 }
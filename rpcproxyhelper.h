@@ -6,12 +6,39 @@
 //   
 //
 //        This file provides a helper routine to open a socket and pu
-//        it in a global variable where individual proxy routines can find it.
+//        it in a global variable where individual proxy routines can find it,
+//        along with a read-ahead buffer for reading from it.
 //
 //        OPERATION
 //
 //        Call rpcproxyinitialize(servername) to open the socket.
+//        servername may be host:port (or tcp:host:port) to
+//        connect to a server that is not on the framework's
+//        default port, eg. one run with rpcserver -p port, or
+//        uring:host:port to talk to it through io_uring where
+//        the kernel has it (requests a proxy with the idl
+//        signature waits on are sent together with that wait,
+//        see RPCAwaitNow; the others as they are made).
+//        unix:path connects to a server run
+//        with rpcserver -s path, and mem:name to stubs in this
+//        same process served with rpcmemoryserve(name). shm:path
+//        talks to a server run with rpcserver -s path -m through
+//        shared memory, and shmpoll:path does too, busy polling
+//        for the lowest latency.
+//        Proxies may then be called from any number of threads.
+//        rpcproxyinitialize(servername, poolsize) lets them open
+//        up to poolsize connections to the server, each thread
+//        keeping to the one it was given, so threads beyond
+//        poolsize share. With queued set, threads do not write
+//        to a connection themselves but queue their requests
+//        for a writer thread, see rpcqueue.h.
+//        servername may also list several servers, separated
+//        by commas, eg. host1:port,host2:port; calls are then
+//        balanced over them, see rpcbalance.h, and a server
+//        that fails is left out for a while.
 //        If there's a problem an exception will be thrown.
+//        An exception is also thrown if the server was generated
+//        from a different idl than the proxies.
 //
 //        LIMITATIONS
 //
@@ -27,6 +54,14 @@
 
 #include "c150streamsocket.h"
 #include "c150debug.h"
+#include "rpcutils.h"
+#include "rpctransport.h"
+#include "rpcbalance.h"
+#include "rpctrace.h"
+#include <string>
+#include <functional>
+#include <vector>
+#include <inttypes.h>
 // #include <fstream>
 
 using namespace C150NETWORK;  // for all the comp150 utilities 
@@ -34,10 +69,26 @@ using namespace C150NETWORK;  // for all the comp150 utilities
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 //
 //    Global variable where proxies can find socket.
+//    NULL unless servername was a plain host name.
 //
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
 extern C150StreamSocket *RPCPROXYSOCKET;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    Global variable where proxies can find the connection,
+//    ie. the transport over the socket and its read-ahead
+//    buffer. All reads must go through the buffer, reading
+//    the transport directly would skip buffered bytes.
+//    With a pool, this is its first connection; generated
+//    proxies check one out instead, see rpcproxycheckout.
+//    NULL once that connection's server was ejected and
+//    the connection closed.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+extern RPCConnection *RPCPROXYCONNECTION;
  
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 //
@@ -47,8 +98,341 @@ extern C150StreamSocket *RPCPROXYSOCKET;
 //     Note that the socket call may throw an exception 
 //     which is NOT caught here.
 //
+//     poolsize is the most connections the proxies may
+//     open, up to 256; the rest are opened as they are
+//     needed. Servers reached through the framework's
+//     socket always get just the one.
+//
+//     Of several servers, up to 32, each gets up to
+//     poolsize connections. A server that cannot be
+//     reached is ejected, ie. given no calls, for a second
+//     at first, doubling up to 30 seconds while it keeps
+//     failing; the same happens when a connection to it
+//     fails later. Its connections are then closed as soon
+//     as the calls in flight on them are answered, or fail,
+//     and their place in the pool reused. An exception is
+//     only thrown if none of them can be reached.
+//
+//     With queued, each connection gets a writer thread:
+//     proxies push their request frames onto a lock-free
+//     queue instead of taking turns to write, and the
+//     writer sends all the frames it finds queued in one
+//     write. For many threads sharing few connections.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyinitialize(char *servername, int poolsize = 1,
+                        bool queued = false);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxybalance
+//
+//     Sets the policy that picks a server for each call,
+//     when there are several: RPCRoundRobin unless this is
+//     called, eg. rpcproxybalance(new RPCPowerOfTwo()).
+//     policy is kept for good.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxybalance(RPCBalancer *policy);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    RPCProxyConnection: a connection of the pool, with the
+//    calls in flight on it. Opaque; see rpcproxyhelper.cpp.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+struct RPCProxyConnection;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxycheckout
+//
+//     Returns the connection the calling thread's calls go
+//     out on. A thread is given one the first time it asks,
+//     and keeps it, so its calls stay in order on one
+//     connection. Threads share a connection safely once
+//     the pool is full. With several servers, the balancer
+//     picks one first, and the thread keeps a connection to
+//     each.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCProxyConnection *rpcproxycheckout();
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxycheckout(endpoint)
+//
+//     Returns the calling thread's connection to one server
+//     in particular, by its place in the list passed to
+//     rpcproxyinitialize, for <func>_fanout, which calls
+//     every server. Throws if it cannot be reached.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCProxyConnection *rpcproxycheckout(int endpoint);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyendpoints
+//
+//     How many servers were passed to rpcproxyinitialize.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+int rpcproxyendpoints();
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxytransport
+//
+//     The transport a checked out connection writes to, for
+//     the RPCWriter that a request frame is built in.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCTransport *rpcproxytransport(RPCProxyConnection *pc);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    Call ids. Every request frame carries one, and the
+//    server repeats it at the start of the response, so
+//    several calls can be outstanding on the connection
+//    at once and their responses told apart. A call id
+//    also tells which connection of the pool it went out
+//    on.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+typedef uint32_t RPCCallId;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    RPCBatchResult: one answer from a <func>_batch proxy,
+//    the status of the call and, if it succeeded and the
+//    function returns anything, its result.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+template <class T>
+struct RPCBatchResult {
+  StatusCode code;
+  T res;
+};
+
+template <>
+struct RPCBatchResult<void> {
+  StatusCode code;
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyrelease
+//
+//     Lets other threads read connection pc again, once
+//     a response still in its read-ahead buffer has been
+//     decoded. RPCProxyResponse calls it when it goes away.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyrelease(RPCProxyConnection *pc);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    RPCProxyResponse: a response the proxy waited for, ie.
+//    its status and a cursor over its result bytes. These
+//    are still in the connection's read-ahead buffer, valid
+//    until the next read, unless the response arrived while
+//    another was being waited for; then they are in held.
+//    While the bytes are in the buffer, no other thread
+//    reads the connection (leased) until the response goes
+//    away. traceid is the trace id the call was sent with.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+struct RPCProxyResponse {
+  StatusCode code;
+  string held;
+  RPCCursor resIn;
+  RPCProxyConnection *leased;
+  RPCTraceId traceid;
+
+  RPCProxyResponse() :
+    code(success), resIn(NULL, 0), leased(NULL), traceid(0) {};
+  ~RPCProxyResponse() { if (leased != NULL) rpcproxyrelease(leased); };
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxynextcall
+//
+//     Returns the call id for a request about to be sent
+//     on connection pc. If too many calls are already in
+//     flight on it, their responses are read and held
+//     first, so that neither side ends up blocked writing
+//     to the other. A call that is traced passes its trace
+//     id, which its response is given back, see rpctrace.h.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+RPCCallId rpcproxynextcall(RPCProxyConnection *pc, RPCTraceId traceid = 0);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxysend
+//
+//     Writes a whole request frame to connection pc, so
+//     that frames sent from different threads never
+//     interleave, or queues it for the connection's writer
+//     thread if it is queued. A transport that holds writes
+//     sends it at once, unless an RPCAwaitNow is in scope.
+//     If traceid is not 0, the send is recorded as the span
+//     that starts the call's flow.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxysend(RPCProxyConnection *pc, RPCWriter &argsOut,
+                  RPCTraceId traceid = 0);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyunsent
+//
+//     Gives back call id callid, from rpcproxynextcall on
+//     connection pc, when its request will never be sent,
+//     eg. because encoding its args threw. Not for a call
+//     rpcproxysend failed to send, which it gives back
+//     itself.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyunsent(RPCProxyConnection *pc, RPCCallId callid);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyawait
+//
+//     Fills in response with the response to call callid,
+//     reading responses off the connection it was sent on
+//     until it comes and holding any others that come
+//     first.
+//
+//     Any number of threads may wait at once: one of them
+//     reads the connection and hands each response to the
+//     thread waiting for it, while the rest sleep. The wait
+//     for a traced call is recorded as the span that ends
+//     its flow.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyawait(RPCCallId callid, RPCProxyResponse &response);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyoncomplete
+//
+//     Instead of waiting for call callid, arranges for done
+//     to be called once its response has arrived and been
+//     held, so that <func>_recv finds it at once. done is
+//     called on the thread that read it, and should only
+//     hand the work on, eg. to the coroutine executor (see
+//     rpccoro.h). Returns false, without calling done, if
+//     the response is already here.
+//
+//     The first call on a connection starts a thread that
+//     reads its responses for as long as it lasts; if it
+//     breaks, every done is called, and the <func>_recv then
+//     throws.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+bool rpcproxyoncomplete(RPCCallId callid, function<void()> done);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxygather
+//
+//     Waits until the first of calls callids have their
+//     responses, or all of them if first is 0, and returns
+//     their positions in callids in the order they came;
+//     each must then be received with rpcproxyawait. The
+//     rest are received, and dropped, when they arrive.
+//     Call ids of 0 are skipped, for calls never sent.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+vector<int> rpcproxygather(const vector<RPCCallId> &callids, size_t first);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcproxyabandon
+//
+//     Gives up on call callid, which will never be waited
+//     for: its response is dropped, now if it is held, or
+//     as soon as it arrives. For calls whose caller lost
+//     interest, see RPCPendingCall.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcproxyabandon(RPCCallId callid);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    RPCPendingCall: a call sent by <func>_async, which the
+//    future it returns keeps until get receives it (take).
+//    If the future goes away without get, so does this,
+//    and the call is abandoned, so its response is not
+//    held for good.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+class RPCPendingCall {
+  RPCCallId callid;
+
+public:
+  explicit RPCPendingCall(RPCCallId callid) : callid(callid) {};
+  RPCPendingCall(RPCPendingCall &&other) : callid(other.callid) {
+    other.callid = 0;
+  };
+  RPCPendingCall(const RPCPendingCall &) = delete;
+  ~RPCPendingCall() { if (callid != 0) rpcproxyabandon(callid); };
+
+  RPCCallId take() { RPCCallId taken = callid; callid = 0; return taken; };
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//    RPCAwaitNow: while one is in scope, the calling thread
+//    waits for the responses to what it sends straight
+//    away, so a transport that sends a request together
+//    with that wait, ie. uring:, may hold it until then.
+//    Otherwise requests are sent at once, since the caller
+//    may not wait for a while, or wait on another server
+//    first. Made by the proxies with the idl signature, and
+//    by <func>_batch.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+class RPCAwaitNow {
+public:
+  RPCAwaitNow();
+  ~RPCAwaitNow();
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcInterfaceId
+//
+//     Like dispatchFunction for stubs, this is defined in
+//     each of the generated proxies. It returns the id of
+//     the idl the proxies were generated from, which is
+//     sent to the server on connect.
+//
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
-void rpcproxyinitialize(char *servername);
+uint32_t rpcInterfaceId();
 
 #endif
@@ -0,0 +1,92 @@
+// rpcqueue.cpp
+//
+// Defines the submission queue of queued proxy connections
+//
+// by: Justin Jo and Charles Wan
+
+#include "rpcqueue.h"
+
+
+// RPCSubmitQueue::RPCSubmitQueue
+//  - starts with one node whose frame counts as taken, so that head and tail
+//    are never NULL and producers never touch tail
+
+RPCSubmitQueue::RPCSubmitQueue() : consumerWaiting(0), wakeups(0) {
+    Node *stub = new Node();
+    head = stub;
+    tail = stub;
+}
+
+
+// RPCSubmitQueue::~RPCSubmitQueue
+//  - frees the nodes of frames never taken; nothing may push meanwhile
+
+RPCSubmitQueue::~RPCSubmitQueue() {
+    while (tail != NULL) {
+        Node *next = tail->next;
+        delete tail;
+        tail = next;
+    }
+}
+
+
+// RPCSubmitQueue::push
+//  - appends a node holding frame, and wakes the consumer if it is asleep
+//  - between the exchange and the link the node is not reachable yet, and
+//    the consumer sees the queue as empty; the link and the check of
+//    consumerWaiting are both sequentially consistent, as are the consumer's
+//    matching store and load, so either the consumer sees the link before it
+//    sleeps or the producer sees it asleep and wakes it
+
+void RPCSubmitQueue::push(string &frame) {
+    Node *node = new Node();
+    node->frame.swap(frame);
+
+    Node *prev = head.exchange(node, memory_order_acq_rel);
+    prev->next.store(node);
+
+    if (consumerWaiting.load()) {
+        wakeups.fetch_add(1);
+        wakeups.notify_one();
+    }
+}
+
+
+// RPCSubmitQueue::take
+//  - appends frames to out, oldest first, until none are left or out holds
+//    at least maxBytes
+//  - consumer only
+//
+//  returns: false if there was no frame to take
+
+bool RPCSubmitQueue::take(string &out, size_t maxBytes) {
+    bool took = false;
+    while (out.size() < maxBytes) {
+        Node *next = tail->next.load(memory_order_acquire);
+        if (next == NULL) break;
+
+        out.append(next->frame);
+        next->frame.clear();
+        delete tail;
+        tail = next; // its frame taken, it is the stub now
+        took = true;
+    }
+    return took;
+}
+
+
+// RPCSubmitQueue::wait
+//  - returns at once if there is a frame to take, otherwise sleeps until a
+//    producer wakes it
+//  - consumer only
+
+void RPCSubmitQueue::wait() {
+    while (tail->next.load() == NULL) {
+        uint32_t seen = wakeups.load();
+        consumerWaiting.store(1);
+        if (tail->next.load() == NULL) {
+            wakeups.wait(seen);
+        }
+        consumerWaiting.store(0);
+    }
+}
@@ -0,0 +1,52 @@
+// rpcqueue.h
+//
+// Declares the submission queue of a queued proxy connection, see
+// rpcproxyinitialize: any number of threads push request frames onto it
+// without taking a lock, and the connection's writer thread takes off all
+// that are waiting at once, to send them in a single write
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCQUEUE_H_
+#define _RPCQUEUE_H_
+
+#include <atomic>
+#include <string>
+#include <inttypes.h>
+
+using namespace std;
+
+
+// RPCSubmitQueue
+//  - multiple producer, single consumer queue of frames, a linked list that
+//    producers append to with one atomic exchange each and the consumer reads
+//    from the other end, so neither side ever waits on the other
+//  - the consumer sleeps on wakeups when there is nothing to take; producers
+//    only touch it if consumerWaiting says it is asleep
+//  - frames come off in the order their pushes exchanged head, so one
+//    thread's frames stay in the order it pushed them
+
+class RPCSubmitQueue {
+private:
+    struct Node {
+        atomic<Node *> next;
+        string frame;
+
+        Node() : next(NULL) {};
+    };
+
+    alignas(64) atomic<Node *> head; // last pushed, where producers append
+    alignas(64) Node *tail; // consumer's end, its frame already taken
+    atomic<uint32_t> consumerWaiting;
+    atomic<uint32_t> wakeups;
+
+public:
+    RPCSubmitQueue();
+    ~RPCSubmitQueue();
+
+    void push(string &frame); // takes frame's bytes, leaving it empty
+    bool take(string &out, size_t maxBytes); // appends frames, false if none
+    void wait(); // sleeps until there is a frame to take
+};
+
+#endif
@@ -25,10 +25,36 @@
 //
 //        COMMAND LINE
 //
-//              <whatevernameyoulinkthis as>
+//              <whatevernameyoulinkthis as> [-p port | -s path]
+//                                           [-t threads | -e | -u | -m] [-a]
 //
 //        OPERATION
 //
+//        With no options, clients are served one at a time on the
+//        framework's C150StreamSocket.
+//
+//        With -p, the server listens on the given tcp port instead
+//        and serves all its clients at once on a pool of worker
+//        threads (default: one per core), see rpcpoolserver.h.
+//        With -e as well, all clients are served by a single epoll
+//        event loop instead, for many mostly idle clients, see
+//        rpcepollserver.h. With -u, the event loop runs on io_uring,
+//        see rpcuringserver.h, or on epoll if the kernel cannot. Either
+//        way, clients reach the server with a servername of
+//        host:port.
+//
+//        With -s instead of -p, the server listens on a unix domain
+//        socket at path, which clients on the same machine reach with
+//        a servername of unix:path, skipping the tcp/ip stack. The
+//        same -t, -e and -u apply. With -m as well, clients instead
+//        connect with shm:path or shmpoll:path and send requests
+//        through shared memory, each served on a thread of its own,
+//        see rpcshm.h.
+//
+//        With -a, debug and grading output goes through the
+//        asynchronous log sink, so calls only queue their lines and
+//        a background thread writes them out, see rpclog.h.
+//
 //
 //       Copyright: 2012 Noah Mendelsohn
 //
@@ -47,18 +73,27 @@
 #include "c150grading.h"
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
 #include "rpcutils.h"
+#include "rpcpoolserver.h"
+#include "rpcepollserver.h"
+#include "rpcuringserver.h"
 
 using namespace std;          // for C++ std library
 using namespace C150NETWORK;  // for all the comp150 utilities 
 
 
-// fwd declarations
-void usage(char *progname, int exitCode);
+// how clients on -p or -s are served
+enum ServerLoop { POOL_LOOP, EPOLL_LOOP, URING_LOOP, SHM_LOOP };
 
 
-// cmd line args
-const int numberOfArgs = 0;
+// fwd declarations
+void usage(char *progname, int exitCode);
+void parseArgs(int argc, char *argv[], int &port, char *&path, int &nthreads,
+               ServerLoop &loop, bool &asyncLog);
+void serveListener(RPCListener &listener, int nthreads, ServerLoop loop);
 
 
 // constants
@@ -75,15 +110,28 @@ int main(int argc, char *argv[]) {
     GRADEME(argc, argv); // obligatory grading line
 
     // cmd line handling
-    if (argc != 1 + numberOfArgs) {
-        usage(argv[0], 1);
-    }
+    int port = 0; // 0 and no path for the C150 socket
+    char *path = NULL;
+    int nthreads = 0;
+    ServerLoop loop = POOL_LOOP;
+    bool asyncLog = false;
+    parseArgs(argc, argv, port, path, nthreads, loop, asyncLog);
 
     // debugging
     uint32_t debugClasses = C150APPLICATION | C150RPCDEBUG | VARDEBUG;
-    initDebugLog(_DEBUG_FILE_, argv[0], debugClasses);
+    initDebugLog(_DEBUG_FILE_, argv[0], debugClasses, asyncLog);
 
     try {
+        if (port != 0) {
+            RPCListener listener(port);
+            serveListener(listener, nthreads, loop);
+            return 0; // not reached, serves forever
+        } else if (path != NULL) {
+            RPCListener listener(path);
+            serveListener(listener, nthreads, loop);
+            return 0; // not reached, serves forever
+        }
+
         // set up socket
         rpcstubinitialize();
 
@@ -95,27 +143,35 @@ int main(int argc, char *argv[]) {
             );
             RPCSTUBSOCKET->accept();
 
-            // turn on time outs
+            // turn on time outs, for idle waits and per message
             RPCSTUBSOCKET->turnOnTimeouts(TIMEOUT_DURATION);
+            RPCConnection conn(new RPCC150Transport(RPCSTUBSOCKET));
+            conn.reader.setTimeout(TIMEOUT_DURATION);
+
+            // refuse proxies generated from a different idl
+            bool matched = rpcstubhandshake(conn);
+            if (!matched) {
+                c150debug->printf(C150RPCDEBUG,
+                    "rpcserver: Proxy idl does not match stubs");
+            }
 
             // infinite message processing
-            while (1) {
-                dispatchFunction();
+            while (matched) {
+                dispatchFunction(conn);
 
-                if (RPCSTUBSOCKET->eof()) {
+                if (conn.reader.eof()) {
                     c150debug->printf(C150RPCDEBUG,
                         "rpcserver: EOF signaled on input");
                     break;
-                } else if (RPCSTUBSOCKET->timedout()) {
+                } else if (conn.reader.timedout()) {
                     c150debug->printf(C150RPCDEBUG,
                         "rpcserver: Socket timed out");
                     break;
                 }
             }
 
-            // close current, wait for next client
+            // close current (when conn goes out of scope), wait for next
             c150debug->printf(C150RPCDEBUG,"Calling C150StreamSocket::close");
-            RPCSTUBSOCKET->close();
         }
 
     } catch (C150Exception e) {
@@ -130,7 +186,7 @@ int main(int argc, char *argv[]) {
             cerr << argv[0] << ": " << e.formattedExplanation() << endl; 
     }
 
-    RPCSTUBSOCKET->close(); // just in case
+    if (RPCSTUBSOCKET != NULL) RPCSTUBSOCKET->close(); // just in case
     return 0;
 }
 
@@ -145,8 +201,61 @@ int main(int argc, char *argv[]) {
 // GENERAL
 // ==========
 
+// Serves every client of listener with the chosen loop, forever
+void serveListener(RPCListener &listener, int nthreads, ServerLoop loop) {
+    if (loop == SHM_LOOP) {
+        rpcshmserve(listener);
+    } else if (loop == URING_LOOP &&
+               rpcuringserve(listener, TIMEOUT_DURATION)) {
+        return;
+    } else if (loop != POOL_LOOP) {
+        // -e, or -u on a kernel without io_uring
+        rpcepollserve(listener, TIMEOUT_DURATION);
+    } else {
+        rpcpoolserve(listener, nthreads, TIMEOUT_DURATION);
+    }
+}
+
 // Prints command line usage to stderr and exits
 void usage(char *progname, int exitCode) {
-    fprintf(stderr, "usage: %s\n", progname);
+    fprintf(stderr,
+            "usage: %s [-p port | -s path] [-t threads | -e | -u | -m] [-a]\n",
+            progname);
     exit(exitCode);
 }
+
+// Reads -p, -s, -t, -e, -u, -m and -a, leaving port 0 and path NULL if
+// neither -p nor -s is given; nthreads defaults to one per core
+void parseArgs(int argc, char *argv[], int &port, char *&path, int &nthreads,
+               ServerLoop &loop, bool &asyncLog) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-p") == 0 && path == NULL) {
+            port = atoi(argv[++i]);
+            if (port <= 0) usage(argv[0], 1);
+        } else if (i + 1 < argc && strcmp(argv[i], "-s") == 0 && port == 0) {
+            path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+            nthreads = atoi(argv[++i]);
+            if (nthreads <= 0) usage(argv[0], 1);
+        } else if (strcmp(argv[i], "-e") == 0 && loop == POOL_LOOP) {
+            loop = EPOLL_LOOP;
+        } else if (strcmp(argv[i], "-u") == 0 && loop == POOL_LOOP) {
+            loop = URING_LOOP;
+        } else if (strcmp(argv[i], "-m") == 0 && loop == POOL_LOOP) {
+            loop = SHM_LOOP;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            asyncLog = true;
+        } else {
+            usage(argv[0], 1);
+        }
+    }
+
+    bool listening = (port != 0 || path != NULL);
+    if ((nthreads != 0 || loop != POOL_LOOP) && !listening) usage(argv[0], 1);
+    if (nthreads != 0 && loop != POOL_LOOP) usage(argv[0], 1);
+    if (loop == SHM_LOOP && path == NULL) usage(argv[0], 1);
+    if (nthreads == 0) {
+        nthreads = thread::hardware_concurrency();
+        if (nthreads == 0) nthreads = 4;
+    }
+}
@@ -0,0 +1,396 @@
+// rpcshm.cpp
+//
+// Defines the shared memory transport: setting up the mapping over a unix
+// domain socket, and the ring buffer reads and writes with their futex
+// wakeups
+//
+// by: Justin Jo and Charles Wan
+
+
+#include <sstream>
+#include <thread>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "c150debug.h"
+#include "rpcshm.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t) &&
+              ATOMIC_INT_LOCK_FREE == 2,
+              "futex words must be plain lock free ints");
+
+
+// constants
+const uint32_t SHM_MAGIC = 0x52504353; // "RPCS"
+const uint32_t SHM_RING_SIZE = 1 << 18; // bytes per direction
+const size_t SHM_HEADER_SIZE = 4096; // rings' bytes start a page in
+const int SHM_SLEEP_SLICE = 100; // ms a sleeper sleeps before checking its peer
+
+
+// spinning only helps if the other side can run meanwhile
+static const bool _canSpin = thread::hardware_concurrency() > 1;
+
+
+// _throwErrno
+//  - throws an RPCException explaining errno err
+
+static void _throwErrno(const char *where, int err) {
+    stringstream ss;
+    ss << where << ": " << strerror(err);
+    throw RPCException(ss.str());
+}
+
+
+// _nowUs
+//  - monotonic clock in us; read without a system call
+
+static long long _nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// _futexWait
+//  - sleeps while word is val, for at most ms; shared, not private, since the
+//    other side is in another process
+
+static void _futexWait(atomic<uint32_t> &word, uint32_t val, int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+
+// _wake
+//  - wakes whoever is asleep on a waiting word; costs nothing if nobody is
+
+static void _wake(atomic<uint32_t> &waiting) {
+    if (waiting.load() != 0 && waiting.exchange(0) != 0) {
+        syscall(SYS_futex, (uint32_t *)&waiting, FUTEX_WAKE, INT_MAX,
+                NULL, NULL, 0);
+    }
+}
+
+
+// _mapSize
+//  - size of the mapping for rings of ringSize bytes
+
+static size_t _mapSize(uint32_t ringSize) {
+    return SHM_HEADER_SIZE + 2 * (size_t)ringSize;
+}
+
+
+// RPCShmTransport
+//  - takes ownership of sock and the mapping; the client writes the first
+//    ring and reads the second, the server the other way around
+
+RPCShmTransport::RPCShmTransport(int sock, char *map, size_t mapSize,
+                                 bool isClient) :
+    sock(sock), map(map), mapSize(mapSize), eofFlag(false),
+    timedoutFlag(false), timeout(0)
+{
+    static_assert(sizeof(RPCShmHeader) <= SHM_HEADER_SIZE,
+                  "shared memory header outgrew its page");
+
+    RPCShmHeader *header = (RPCShmHeader *)map;
+    ringSize = header->ringSize;
+    spinUs = _canSpin ? header->spinUs : 0;
+
+    char *data = map + SHM_HEADER_SIZE;
+    int outIndex = isClient ? 0 : 1;
+    out = &header->rings[outIndex];
+    in = &header->rings[1 - outIndex];
+    outData = data + (size_t)outIndex * ringSize;
+    inData = data + (size_t)(1 - outIndex) * ringSize;
+}
+
+RPCShmTransport::~RPCShmTransport() {
+    close();
+}
+
+
+// RPCShmTransport::connect
+//  - connects to the server listening at path, creates the mapping and
+//    hands it over; spinUs is how long both sides spin before sleeping
+//  - throws if the server cannot be reached or does not take the mapping
+
+RPCShmTransport *RPCShmTransport::connect(const char *path, uint32_t spinUs) {
+    int sock = RPCSocketTransport::connectUnixFd(path);
+
+    size_t mapSize = _mapSize(SHM_RING_SIZE);
+    int fd = memfd_create("rpcshm", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, mapSize) != 0) {
+        int err = errno;
+        if (fd >= 0) ::close(fd);
+        ::close(sock);
+        _throwErrno("RPCShmTransport.connect", err);
+    }
+
+    char *map = (char *)mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        ::close(fd);
+        ::close(sock);
+        _throwErrno("RPCShmTransport.connect", err);
+    }
+
+    // the memfd starts zeroed, ie. both rings empty and open
+    RPCShmHeader *header = (RPCShmHeader *)map;
+    header->magic = SHM_MAGIC;
+    header->ringSize = SHM_RING_SIZE;
+    header->spinUs = spinUs;
+
+    // send the memfd, then wait for the server to say it has mapped it
+    char ok = 0;
+    struct iovec iov = { &ok, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    bool sent = sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+    ::close(fd); // the mapping keeps it alive
+    if (!sent || recv(sock, &ok, 1, 0) != 1 || ok != 1) {
+        munmap(map, mapSize);
+        ::close(sock);
+        throw RPCException("RPCShmTransport.connect: Server at " +
+                           string(path) + " did not accept shared memory");
+    }
+
+    return new RPCShmTransport(sock, map, mapSize, true);
+}
+
+
+// RPCShmTransport::accept
+//  - takes the mapping a client sends over sock, just accepted, checks it,
+//    and tells the client it can start
+//  - throws, closing sock, if the client does not send a usable one
+
+RPCShmTransport *RPCShmTransport::accept(int sock) {
+    char ok;
+    struct iovec iov = { &ok, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t got;
+    do {
+        got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+
+    struct cmsghdr *cmsg = (got == 1) ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+        ::close(sock);
+        throw RPCException("RPCShmTransport.accept: Client sent no mapping");
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+    // the size is checked before anything in the header is trusted
+    struct stat st;
+    char *map = (char *)MAP_FAILED;
+    size_t mapSize = 0;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= SHM_HEADER_SIZE) {
+        mapSize = st.st_size;
+        map = (char *)mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (map != MAP_FAILED) {
+        RPCShmHeader *header = (RPCShmHeader *)map;
+        uint32_t ringSize = header->ringSize;
+        if (header->magic != SHM_MAGIC || ringSize == 0 ||
+            (ringSize & (ringSize - 1)) != 0 ||
+            mapSize != _mapSize(ringSize)) {
+            munmap(map, mapSize);
+            map = (char *)MAP_FAILED;
+        }
+    }
+    if (map == MAP_FAILED) {
+        ::close(sock);
+        throw RPCException("RPCShmTransport.accept: Client sent a bad mapping");
+    }
+
+    ok = 1;
+    if (send(sock, &ok, 1, MSG_NOSIGNAL) != 1) {
+        munmap(map, mapSize);
+        ::close(sock);
+        throw RPCException("RPCShmTransport.accept: Client went away");
+    }
+    return new RPCShmTransport(sock, map, mapSize, false);
+}
+
+
+// RPCShmTransport::peerGone
+//  - whether the other process has closed the socket, eg. by dying; nothing
+//    is sent on it once the mapping is set up
+
+bool RPCShmTransport::peerGone() {
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    return poll(&pfd, 1, 0) != 0;
+}
+
+
+// RPCShmTransport::waitFor
+//  - waits until word, a head or tail of a ring, is no longer seen: spins for
+//    spinUs, then sleeps on waiting until the other side wakes it
+//  - ms: longest wait, 0 for none
+//
+//  returns: 1 once word has moved, 0 on timeout, -1 if the connection is
+//           closed or the other process has gone
+
+int RPCShmTransport::waitFor(atomic<uint32_t> &word, atomic<uint32_t> &waiting,
+                             uint32_t seen, int ms) {
+    long long spinUntil = _nowUs() + spinUs;
+    for (unsigned i = 1; word.load(memory_order_acquire) == seen; i++) {
+        if (in->closed) return -1;
+        if (i % 64 == 0 && _nowUs() >= spinUntil) break;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    long long deadline = rpcNowMs() + ms;
+    while (word.load(memory_order_acquire) == seen) {
+        if (in->closed || peerGone()) return -1;
+
+        int slice = SHM_SLEEP_SLICE;
+        if (ms != 0) {
+            long long left = deadline - rpcNowMs();
+            if (left <= 0) return 0;
+            if (left < slice) slice = left;
+        }
+
+        // the other side moves word before it checks waiting, and this side
+        // sets waiting before it checks word again, so one of them sees the
+        // other and a wakeup cannot be lost
+        waiting.store(1);
+        if (word.load() == seen && !in->closed) {
+            _futexWait(waiting, 1, slice);
+        }
+        waiting.store(0);
+    }
+    return 1;
+}
+
+
+// RPCShmTransport::read
+//  - reads whatever the other side has written, up to len bytes
+//  - if timeouts are on, waits at most that long for anything to arrive
+//
+//  returns: number of bytes read, 0 on eof or timeout (see eof, timedout)
+
+ssize_t RPCShmTransport::read(char *buf, ssize_t len) {
+    timedoutFlag = false;
+    if (map == NULL) {
+        eofFlag = true;
+        return 0;
+    }
+
+    uint32_t head = in->head.load(memory_order_relaxed);
+    uint32_t tail = in->tail.load(memory_order_acquire);
+    if (tail == head) {
+        int moved = waitFor(in->tail, in->dataWaiting, head, timeout);
+        if (moved <= 0) {
+            if (moved == 0) timedoutFlag = true; else eofFlag = true;
+            return 0;
+        }
+        tail = in->tail.load(memory_order_acquire);
+    }
+
+    size_t readlen = tail - head;
+    if (readlen > (size_t)len) readlen = len;
+    size_t at = head & (ringSize - 1);
+    size_t first = (readlen < ringSize - at) ? readlen : ringSize - at;
+    memcpy(buf, inData + at, first);
+    memcpy(buf + first, inData, readlen - first);
+
+    in->head.store(head + readlen);
+    _wake(in->spaceWaiting);
+    return readlen;
+}
+
+
+// RPCShmTransport::write
+//  - writes all len bytes of buf, waiting for the reader to make room if the
+//    ring fills; throws if the connection is closed
+
+void RPCShmTransport::write(const char *buf, ssize_t len) {
+    if (map == NULL) throw RPCException("RPCShmTransport.write: Connection closed");
+
+    while (len > 0) {
+        if (out->closed) {
+            throw RPCException("RPCShmTransport.write: Connection closed");
+        }
+
+        uint32_t tail = out->tail.load(memory_order_relaxed);
+        uint32_t head = out->head.load(memory_order_acquire);
+        size_t space = ringSize - (tail - head);
+        if (space == 0) {
+            if (waitFor(out->head, out->spaceWaiting, head, 0) < 0) {
+                throw RPCException("RPCShmTransport.write: Connection closed");
+            }
+            continue;
+        }
+
+        size_t writelen = ((size_t)len < space) ? len : space;
+        size_t at = tail & (ringSize - 1);
+        size_t first = (writelen < ringSize - at) ? writelen : ringSize - at;
+        memcpy(outData + at, buf, first);
+        memcpy(outData, buf + first, writelen - first);
+
+        out->tail.store(tail + writelen);
+        _wake(out->dataWaiting);
+        buf += writelen;
+        len -= writelen;
+    }
+}
+
+
+// RPCShmTransport::close
+//  - marks both rings closed, wakes the other side if it sleeps on either,
+//    and lets go of the mapping; safe to call more than once
+
+void RPCShmTransport::close() {
+    if (map == NULL) return;
+
+    RPCShmRing *rings[2] = { in, out };
+    for (RPCShmRing *ring : rings) {
+        ring->closed.store(1);
+        _wake(ring->dataWaiting);
+        _wake(ring->spaceWaiting);
+    }
+
+    munmap(map, mapSize);
+    ::close(sock);
+    map = NULL;
+}
@@ -0,0 +1,97 @@
+// rpcshm.h
+//
+// Declares the shared memory transport, for a client and server on the same
+// machine: a pair of ring buffers in memory both processes map, so a call
+// moves no bytes through the kernel at all
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCSHM_H_
+#define _RPCSHM_H_
+
+#include <atomic>
+#include <inttypes.h>
+#include "rpctransport.h"
+
+using namespace std;
+
+
+// RPCShmRing
+//  - control words of one direction of a shared memory connection; its bytes
+//    follow the header in the mapping
+//  - single producer, single consumer: head only moves on the reader's side
+//    and tail on the writer's, both counting bytes since the connection
+//    opened, so tail - head is how many are unread
+//  - dataWaiting and spaceWaiting are futex words: set by a reader about to
+//    sleep for bytes, or a writer about to sleep for room, and cleared by the
+//    other side as it wakes them
+//  - kept on separate cache lines, so each side mostly writes its own
+
+struct RPCShmRing {
+    alignas(64) atomic<uint32_t> head;
+    atomic<uint32_t> spaceWaiting;
+    alignas(64) atomic<uint32_t> tail;
+    atomic<uint32_t> dataWaiting;
+    alignas(64) atomic<uint32_t> closed;
+};
+
+
+// RPCShmHeader
+//  - start of the shared mapping; written by the client before it is shared
+//  - spinUs is how long either side spins for the other before it sleeps,
+//    chosen by the client for both
+
+struct RPCShmHeader {
+    uint32_t magic;
+    uint32_t ringSize; // bytes per direction, a power of 2
+    uint32_t spinUs;
+    RPCShmRing rings[2]; // client to server, server to client
+};
+
+
+// RPCShmTransport
+//  - transport over a shared memory mapping: a memfd the client creates and
+//    sends to the server over a unix domain socket, which then stays open
+//    only so that each side notices if the other process dies
+//  - reads and writes copy straight into and out of the rings; a side
+//    waiting on the other spins for spinUs, then sleeps on a futex, so a
+//    busy connection makes no system calls and an idle one uses no cpu
+//  - frames larger than a ring are written in pieces as the reader drains it
+
+class RPCShmTransport : public RPCTransport {
+private:
+    int sock; // the unix domain socket it was set up over
+    char *map;
+    size_t mapSize;
+    RPCShmRing *in, *out;
+    char *inData, *outData;
+    uint32_t ringSize;
+    int spinUs;
+    bool eofFlag;
+    bool timedoutFlag;
+    int timeout; // ms, 0 for none
+
+    RPCShmTransport(int sock, char *map, size_t mapSize, bool isClient);
+
+    bool peerGone();
+    int waitFor(atomic<uint32_t> &word, atomic<uint32_t> &waiting,
+                uint32_t seen, int ms);
+
+public:
+    ~RPCShmTransport();
+
+    static const uint32_t DEFAULT_SPIN_US = 20; // shm:
+    static const uint32_t POLL_SPIN_US = 100000; // shmpoll:, busy polls
+
+    static RPCShmTransport *connect(const char *path, uint32_t spinUs);
+    static RPCShmTransport *accept(int sock); // takes ownership of sock
+
+    ssize_t read(char *buf, ssize_t len);
+    void write(const char *buf, ssize_t len);
+    bool eof() { return eofFlag; };
+    bool timedout() { return timedoutFlag; };
+    void turnOnTimeouts(int ms) { timeout = ms; };
+    void close();
+};
+
+#endif
@@ -0,0 +1,317 @@
+// rpcstats.cpp
+//
+// Defines the per function statistics that stubs keep, and the built-in
+// call that returns a snapshot of them
+//
+// by: Justin Jo and Charles Wan
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include "rpcstats.h"
+
+
+// RPCStatsShard
+//  - one thread's part of a function's stats, which only it writes, on
+//    cache lines of its own
+//  - owned while a thread has it; the shards of a thread that has ended go
+//    to the next new thread to call the function, and keep what they hold
+//  - shards are never freed, and only ever added to the front of the list
+
+struct alignas(64) RPCStatsShard {
+    atomic<uint64_t> calls{0};
+    atomic<uint64_t> bytesIn{0};
+    atomic<uint64_t> bytesOut{0};
+    atomic<uint64_t> codes[RPCSTATS_CODES] = {}; // calls per status
+    RPCHistogram phases[RPCSTATS_PHASES];
+    atomic<bool> owned{true};
+    RPCStatsShard *next = NULL;
+};
+
+static mutex registryMutex;
+static vector<RPCFuncStats *> registry; // never shrinks, entries never freed
+
+
+// RPCHistogram
+//  - see rpcstats.h
+
+RPCHistogram::RPCHistogram() {
+    for (int b = 0; b < RPCHISTOGRAM_BUCKETS; b++) {
+        counts[b].store(0, memory_order_relaxed);
+    }
+}
+
+void RPCHistogram::record(long long ns) {
+    atomic<uint64_t> &c = counts[bucketOf(ns)];
+    c.store(c.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+
+// RPCHistogram::bucketOf
+//  - values under 8 have a bucket each; above, a value with its highest bit
+//    at e goes in one of the 8 buckets of [2^e, 2^(e+1)), by its next 3 bits
+
+int RPCHistogram::bucketOf(long long ns) {
+    if (ns < 8) return (ns < 0) ? 0 : ns;
+
+    int e = 63 - __builtin_clzll(ns);
+    int sub = (ns >> (e - 3)) & 7;
+    return min((e - 2) * 8 + sub, RPCHISTOGRAM_BUCKETS - 1);
+}
+
+
+// RPCHistogram::bucketTop
+//  - see rpcstats.h
+
+long long RPCHistogram::bucketTop(int bucket) {
+    if (bucket < 8) return bucket;
+
+    int e = bucket / 8 + 2;
+    long long low = (long long)(8 + bucket % 8) << (e - 3);
+    return low + (1LL << (e - 3)) - 1;
+}
+
+
+// rpcstatsfunction
+//  - see rpcstats.h
+
+RPCFuncStats *rpcstatsfunction(const char *name) {
+    lock_guard<mutex> lock(registryMutex);
+    for (RPCFuncStats *stats : registry) {
+        if (stats->name == name) return stats;
+    }
+    registry.push_back(new RPCFuncStats(name, registry.size()));
+    return registry.back();
+}
+
+
+#ifndef RPC_NO_STATS // nothing is recorded otherwise, see rpcstats.h
+
+// claimShard
+//  - a shard of stats for the calling thread: one a thread that ended left,
+//    or else a new one
+
+static RPCStatsShard *claimShard(RPCFuncStats *stats) {
+    for (RPCStatsShard *s = stats->shards.load(memory_order_acquire);
+         s != NULL; s = s->next) {
+        bool free = false;
+        if (!s->owned.load(memory_order_relaxed) &&
+            s->owned.compare_exchange_strong(free, true,
+                                             memory_order_acquire)) {
+            return s;
+        }
+    }
+
+    RPCStatsShard *s = new RPCStatsShard();
+    s->next = stats->shards.load(memory_order_relaxed);
+    while (!stats->shards.compare_exchange_weak(s->next, s,
+                                                memory_order_release)) {
+        // s->next was refreshed, try again
+    }
+    return s;
+}
+
+
+// RPCStatsHolder
+//  - the calling thread's shards, by function index, claimed on its first
+//    call to each and given back when it ends
+
+struct RPCStatsHolder {
+    vector<RPCStatsShard *> shards;
+
+    ~RPCStatsHolder() {
+        for (RPCStatsShard *s : shards) {
+            if (s != NULL) s->owned.store(false, memory_order_release);
+        }
+    };
+};
+
+static thread_local RPCStatsHolder holder;
+
+
+// bump
+//  - adds n to a count only the calling thread writes, without a locked
+//    instruction
+
+static inline void bump(atomic<uint64_t> &count, uint64_t n) {
+    count.store(count.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+
+// rpcstatsrecord
+//  - see rpcstats.h
+
+void rpcstatsrecord(RPCFuncStats *stats, StatusCode code, size_t bytesIn,
+                    size_t bytesOut, long long decodeNs, long long executeNs,
+                    long long encodeNs) {
+    if ((size_t)stats->index >= holder.shards.size()) {
+        holder.shards.resize(stats->index + 1, NULL);
+    }
+    RPCStatsShard *&mine = holder.shards[stats->index];
+    if (mine == NULL) mine = claimShard(stats);
+    RPCStatsShard &s = *mine;
+
+    bump(s.calls, 1);
+    bump(s.bytesIn, bytesIn);
+    bump(s.bytesOut, bytesOut);
+    s.phases[decode_phase].record(decodeNs);
+    s.phases[execute_phase].record(executeNs);
+    s.phases[encode_phase].record(encodeNs);
+    s.phases[total_phase].record(decodeNs + executeNs + encodeNs);
+
+    unsigned c = (unsigned)code;
+    if (c < RPCSTATS_CODES) bump(s.codes[c], 1);
+}
+#endif
+
+
+// writeCount, extractCount
+//  - a 64 bit count, as its high and low 32 bits
+
+static void writeCount(RPCWriter &out, uint64_t count) {
+    writeInt(out, (int)(count >> 32));
+    writeInt(out, (int)(count & 0xffffffffu));
+}
+
+static uint64_t extractCount(RPCCursor &in) {
+    uint64_t hi = (uint32_t)extractInt(in);
+    return (hi << 32) | (uint32_t)extractInt(in);
+}
+
+
+// writeSparse
+//  - the nonzero counts of counts, as their number, then each one's index
+//    and count
+
+static void writeSparse(RPCWriter &out, const vector<uint64_t> &counts) {
+    int nonzero = count_if(counts.begin(), counts.end(),
+                           [](uint64_t c) { return c != 0; });
+    writeInt(out, nonzero);
+    for (size_t i = 0; i < counts.size(); i++) {
+        if (counts[i] == 0) continue;
+        writeInt(out, i);
+        writeCount(out, counts[i]);
+    }
+}
+
+
+// extractSparse
+//  - reads what writeSparse wrote into counts, which has room for every
+//    index
+//
+//  returns: false if an index was out of range
+
+static bool extractSparse(RPCCursor &in, vector<uint64_t> &counts) {
+    int nonzero = extractInt(in);
+    for (int n = 0; n < nonzero && !in.fail(); n++) {
+        uint32_t i = extractInt(in);
+        if (i >= counts.size()) return false;
+        counts[i] = extractCount(in);
+    }
+    return !in.fail();
+}
+
+
+// rpcstatsanswer
+//  - result: the number of functions, then for each its name, calls, bytes
+//    in and out, then its codes and each phase's buckets, see writeSparse
+//  - the snapshot is not atomic: calls made while it is taken may be
+//    counted in some sums and not yet in others
+
+void rpcstatsanswer(RPCCursor &argsIn, RPCWriter &resOut) {
+    StatusCode argsCode = checkBytes(argsIn);
+    if (argsCode != good_bytes) {
+        writeStatusFrame(resOut, argsCode);
+        return;
+    }
+
+    vector<RPCFuncStats *> funcs;
+    {
+        lock_guard<mutex> lock(registryMutex);
+        funcs = registry;
+    }
+
+    RPCWriter res(NULL);
+    writeInt(res, funcs.size());
+    for (RPCFuncStats *stats : funcs) {
+        uint64_t calls = 0, bytesIn = 0, bytesOut = 0;
+        vector<uint64_t> codes(RPCSTATS_CODES, 0);
+        vector<uint64_t> phases[RPCSTATS_PHASES];
+        for (int p = 0; p < RPCSTATS_PHASES; p++) {
+            phases[p].assign(RPCHISTOGRAM_BUCKETS, 0);
+        }
+        for (RPCStatsShard *s = stats->shards.load(memory_order_acquire);
+             s != NULL; s = s->next) {
+            calls += s->calls.load(memory_order_relaxed);
+            bytesIn += s->bytesIn.load(memory_order_relaxed);
+            bytesOut += s->bytesOut.load(memory_order_relaxed);
+            for (int c = 0; c < RPCSTATS_CODES; c++) {
+                codes[c] += s->codes[c].load(memory_order_relaxed);
+            }
+            for (int p = 0; p < RPCSTATS_PHASES; p++) {
+                for (int b = 0; b < RPCHISTOGRAM_BUCKETS; b++) {
+                    phases[p][b] += s->phases[p].count(b);
+                }
+            }
+        }
+
+        writeString(res, stats->name);
+        writeCount(res, calls);
+        writeCount(res, bytesIn);
+        writeCount(res, bytesOut);
+        writeSparse(res, codes);
+        for (int p = 0; p < RPCSTATS_PHASES; p++) {
+            writeSparse(res, phases[p]);
+        }
+    }
+
+    resOut.reserve(8 + res.size());
+    writeInt(resOut, success);
+    writeInt(resOut, res.size());
+    resOut.append(res.data(), res.size());
+}
+
+
+// rpcstatsdecode
+//  - see rpcstats.h
+
+bool rpcstatsdecode(RPCCursor &resIn, vector<RPCFuncSnapshot> &funcs) {
+    try {
+        int nfuncs = extractInt(resIn);
+        for (int f = 0; f < nfuncs && !resIn.fail(); f++) {
+            RPCFuncSnapshot snap;
+            snap.name = extractString(resIn);
+            snap.calls = extractCount(resIn);
+            snap.bytesIn = extractCount(resIn);
+            snap.bytesOut = extractCount(resIn);
+            snap.codes.assign(RPCSTATS_CODES, 0);
+            if (!extractSparse(resIn, snap.codes)) return false;
+            for (int p = 0; p < RPCSTATS_PHASES; p++) {
+                snap.phases[p].assign(RPCHISTOGRAM_BUCKETS, 0);
+                if (!extractSparse(resIn, snap.phases[p])) return false;
+            }
+            funcs.push_back(move(snap));
+        }
+    } catch (RPCException &e) { // a name without its null term
+        return false;
+    }
+    return checkBytes(resIn) == good_bytes;
+}
+
+
+// rpcstatspercentile
+//  - see rpcstats.h
+
+long long rpcstatspercentile(const vector<uint64_t> &buckets, double p) {
+    uint64_t total = 0;
+    for (uint64_t count : buckets) total += count;
+    if (total == 0) return 0;
+
+    uint64_t rank = max<uint64_t>(1, ceil(p * total));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < buckets.size(); b++) {
+        seen += buckets[b];
+        if (seen >= rank) return RPCHistogram::bucketTop(b);
+    }
+    return RPCHistogram::bucketTop(buckets.size() - 1);
+}
@@ -0,0 +1,152 @@
+// rpcstats.h
+//
+// Declares the per function statistics that stubs keep: calls, statuses,
+// bytes in and out, and latency histograms of each call's decode, execute
+// and encode phases; and the built-in call that returns a snapshot of them,
+// which rpctop prints
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCSTATS_H_
+#define _RPCSTATS_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+#include "rpcutils.h"
+#include "rpctrace.h"
+
+using namespace std;
+
+
+// RPCSTATSID, RPCSTATSINTERFACEID
+//  - the function id of the stats call, which every stub answers, and the
+//    interface id a proxy with no idl sends to make it; rpcgenerate refuses
+//    an idl with a function whose id is RPCSTATSID
+
+const uint32_t RPCSTATSID = 0xfffffffeu;
+const uint32_t RPCSTATSINTERFACEID = 0xffffffffu;
+
+
+// phases of a call, and every phase together
+enum RPCStatsPhase {
+    decode_phase = 0,
+    execute_phase = 1,
+    encode_phase = 2,
+    total_phase = 3
+};
+const int RPCSTATS_PHASES = 4;
+
+// highest status code counted, see StatusCode
+const int RPCSTATS_CODES = 256;
+
+
+// RPCHistogram
+//  - counts of latencies in ns, in log linear buckets: 8 per power of 2, so
+//    any value is known to within 12.5%, from 0 to over an hour
+//  - only one thread may record to a histogram, without a lock or a locked
+//    instruction; any thread may read its counts
+
+const int RPCHISTOGRAM_BUCKETS = 320;
+
+class RPCHistogram {
+private:
+    atomic<uint64_t> counts[RPCHISTOGRAM_BUCKETS];
+
+public:
+    RPCHistogram();
+
+    void record(long long ns);
+    uint64_t count(int bucket) const {
+        return counts[bucket].load(memory_order_relaxed);
+    };
+
+    static int bucketOf(long long ns);
+    static long long bucketTop(int bucket); // highest value in bucket
+};
+
+
+// RPCFuncStats
+//  - what a stub records for its function; each thread that calls it
+//    records to a shard of its own, so recording takes no lock and shares
+//    no cache lines, and a snapshot sums up every shard
+//  - one per function, for as long as the program runs
+
+struct RPCStatsShard;
+
+struct RPCFuncStats {
+    string name;
+    int index; // in the order made, from 0
+    atomic<RPCStatsShard *> shards; // newest first
+
+    RPCFuncStats(const string &name, int index) :
+        name(name), index(index), shards(NULL)
+    {};
+};
+
+
+// rpcstatsfunction
+//  - the stats of function name, made the first time it is asked for;
+//    stubs keep theirs in a static
+
+RPCFuncStats *rpcstatsfunction(const char *name);
+
+
+// rpcstatsclock, rpcstatsrecord
+//  - the time in ns, for timing the phases of a call, and records one call
+//    answered with code, how many bytes its args and its answer took, and
+//    how long each phase took
+//  - compiled with -DRPC_NO_STATS both do nothing, so stubs keep no stats
+//    and only read the clock for a trace; the stats call then counts no
+//    calls
+
+#ifdef RPC_NO_STATS
+inline long long rpcstatsclock() { return rpcTracing() ? rpcNowNs() : 0; }
+inline void rpcstatsrecord(RPCFuncStats *, StatusCode, size_t, size_t,
+                           long long, long long, long long) {}
+#else
+inline long long rpcstatsclock() { return rpcNowNs(); }
+void rpcstatsrecord(RPCFuncStats *stats, StatusCode code, size_t bytesIn,
+                    size_t bytesOut, long long decodeNs, long long executeNs,
+                    long long encodeNs);
+#endif
+
+
+// rpcstatsanswer
+//  - answers the stats call with a snapshot of every function's stats, see
+//    rpcstatsdecode; argsIn should be empty
+
+void rpcstatsanswer(RPCCursor &argsIn, RPCWriter &resOut);
+
+
+// RPCFuncSnapshot
+//  - one function's stats as the stats call returns them; codes holds the
+//    number of calls per status code, and phases the bucket counts of each
+//    phase's histogram
+
+struct RPCFuncSnapshot {
+    string name;
+    uint64_t calls;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    vector<uint64_t> codes;
+    vector<uint64_t> phases[RPCSTATS_PHASES];
+};
+
+
+// rpcstatsdecode
+//  - reads the result of the stats call
+//
+//  returns: false if the bytes were not a snapshot
+
+bool rpcstatsdecode(RPCCursor &resIn, vector<RPCFuncSnapshot> &funcs);
+
+
+// rpcstatspercentile
+//  - the latency in ns that fraction p, eg. 0.99, of the calls counted in
+//    buckets took at most, to within a bucket; 0 if there are none
+
+long long rpcstatspercentile(const vector<uint64_t> &buckets, double p);
+
+#endif
@@ -15,7 +15,9 @@
 //
 //        After calling rpcstubinitialize, call 
 //        RPCSTUBSOCKET->accept() to accept a new connection,
-//        RPCSTUBSOCKET-> read/write
+//        wrap it in an RPCConnection for reads/writes,
+//        rpcstubhandshake(conn) to check the proxy's idl,
+//        dispatchFunction(conn) for each call
 //        when RPCSTUBSOCKET->eof goes true, then 
 //        RPCSTUBSOCKET->closerpcstubaccept
 //        to wait for a new incoming connection
@@ -33,6 +35,9 @@
 // --------------------------------------------------------------
 
 #include "rpcstubhelper.h"
+#include "rpcutils.h"
+#include <algorithm>
+#include <sstream>
 
 using namespace C150NETWORK;  // for all the comp150 utilities 
 
@@ -65,3 +70,164 @@ void rpcstubinitialize() {
   // The application will pick those up one at a time by doing accept calls
   RPCSTUBSOCKET -> listen();  
 }
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcstubhandshake
+//
+//     Reads the idl id sent by a newly accepted proxy and
+//     answers matching_interface or mismatched_interface.
+//     A proxy that never sends its id is treated as a
+//     mismatch.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+bool rpcstubhandshake(RPCConnection &conn) {
+
+  StatusCode code;
+  try {
+    code = rpcstubcheckinterface(readInt(conn.reader));
+  } catch (const RPCException &e) {
+    return false; // eof or timed out before id arrived
+  }
+
+  writeInt(conn.transport, code);
+  return code == matching_interface;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcstubcheckinterface
+//
+//     Compares a proxy's idl id with the stubs' own. Every
+//     stub also matches RPCSTATSINTERFACEID, which a proxy
+//     that only makes the stats call sends, see rpcstats.h.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+StatusCode rpcstubcheckinterface(uint32_t interfaceid) {
+
+  StatusCode code = (interfaceid == rpcInterfaceId() ||
+                     interfaceid == RPCSTATSINTERFACEID) ?
+    matching_interface : mismatched_interface;
+
+  c150debug->printf(C150RPCDEBUG,"rpcstubhandshake: %s",
+                    debugStatusCode(code).c_str());
+  return code;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                splitBatch, answerBatch
+//
+//     The halves of rpcstubbatch either side of the calls.
+//     splitBatch cuts argsIn into a cursor per call, or, if
+//     they do not add up, answers with a status frame and
+//     throws. answerBatch writes the response around the
+//     answers the stub left in results.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+static void splitBatch(RPCCursor &argsIn, RPCWriter &resOut,
+                       vector<RPCCursor> &calls) {
+
+  int count = extractInt(argsIn);
+  if (count > 0) {
+    // every call takes at least its size, so count cannot be more
+    calls.reserve(min((size_t)count, argsIn.remaining() / 4));
+  }
+  for (int i = 0; i < count && !argsIn.fail(); i++) {
+    calls.push_back(extractSpan(argsIn));
+  }
+
+  StatusCode code = (count < 0) ? scrambled_bytes : checkBytes(argsIn);
+  if (code != good_bytes) {
+    stringstream debugStream;
+    writeStatusFrame(resOut, code);
+    debugStream << "rpcstubbatch: " << debugStatusCode(code)
+                << ", for batch of " << count << " calls";
+    logThrow(debugStream, C150APPLICATION, true);
+  }
+}
+
+static void answerBatch(size_t count, RPCWriter &results, RPCWriter &resOut) {
+
+  resOut.reserve(12 + results.size());
+  writeInt(resOut, success);
+  writeInt(resOut, 4 + results.size());
+  writeInt(resOut, count);
+  resOut.append(results.data(), results.size());
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcstubfailed
+//
+//     An answer is whole if its status and size are there
+//     and exactly size bytes follow them.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcstubfailed(RPCWriter &resOut, size_t answerStart) {
+
+  size_t written = resOut.size() - answerStart;
+  if (written >= 8) {
+    RPCCursor answer(resOut.data() + answerStart, written);
+    extractInt(answer); // status
+    int resSize = extractInt(answer);
+    if (resSize >= 0 && answer.remaining() == (size_t)resSize) {
+      return;
+    }
+  }
+
+  resOut.truncate(answerStart);
+  writeStatusFrame(resOut, func_failed);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcstubbatch
+//
+//     A call that fails is answered with its status, see
+//     rpcstubfailed, and the rest of the batch goes on.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcstubbatch(void (*stub)(RPCCursor &argsIn, RPCWriter &resOut),
+                  RPCCursor &argsIn, RPCWriter &resOut) {
+
+  vector<RPCCursor> calls;
+  splitBatch(argsIn, resOut, calls);
+
+  RPCWriter results(NULL);
+  for (size_t i = 0; i < calls.size(); i++) {
+    size_t answerStart = results.size();
+    try {
+      stub(calls[i], results);
+    } catch (...) {
+      rpcstubfailed(results, answerStart);
+    }
+  }
+  answerBatch(calls.size(), results, resOut);
+}
+
+#ifdef __cpp_impl_coroutine
+RPCTask<void> rpcstubbatch(RPCTask<void> (*stub)(RPCCursor &argsIn,
+                                                 RPCWriter &resOut),
+                           RPCCursor &argsIn, RPCWriter &resOut) {
+
+  vector<RPCCursor> calls;
+  splitBatch(argsIn, resOut, calls);
+
+  RPCWriter results(NULL);
+  for (size_t i = 0; i < calls.size(); i++) {
+    size_t answerStart = results.size();
+    try {
+      co_await stub(calls[i], results);
+    } catch (...) {
+      rpcstubfailed(results, answerStart);
+    }
+  }
+  answerBatch(calls.size(), results, resOut);
+}
+#endif
@@ -15,7 +15,9 @@
 //
 //        After calling rpcstubinitialize, call 
 //        RPCSTUBSOCKET->accept() to accept a new connection,
-//        RPCSTUBSOCKET-> read/write
+//        wrap it in an RPCConnection for reads/writes,
+//        rpcstubhandshake(conn) to check the proxy's idl,
+//        dispatchFunction(conn) for each call
 //        when RPCSTUBSOCKET->eof goes true, then 
 //        RPCSTUBSOCKET->closerpcstubaccept
 //        to wait for a new incoming connection
@@ -23,6 +25,10 @@
 //        All the operations listed above can be repeated from accept
 //        to close, to process new connections.
 //
+//        Servers that take many connections at once do not use
+//        RPCSTUBSOCKET, see rpcpoolserver.h. Since stubs only ever
+//        use the connection they are given, they work with both.
+//
 //        LIMITATIONS
 //
 //              This version does not timeout 
@@ -39,6 +45,17 @@
 
 #include "c150streamsocket.h"
 #include "c150debug.h"
+#include "rpcutils.h"
+#include "rpctransport.h"
+#include "rpcstats.h"
+#include "rpctrace.h"
+#include <inttypes.h>
+#include <functional>
+#include <string>
+#include <vector>
+#ifdef __cpp_impl_coroutine
+#include "rpccoro.h"
+#endif
 
 
 using namespace C150NETWORK;  // for all the comp150 utilities 
@@ -67,6 +84,34 @@ extern C150StreamSocket *RPCSTUBSOCKET;
 void
 rpcstubinitialize();
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcstubhandshake
+//
+//     Reads the idl id sent by a newly accepted proxy and
+//     tells it whether the stubs were generated from the
+//     same idl. Returns true if they were, in which case
+//     the connection can be used for calls.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+bool
+rpcstubhandshake(RPCConnection &conn);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcstubcheckinterface
+//
+//     The check behind rpcstubhandshake, for servers that
+//     read the proxy's idl id themselves. Returns the status
+//     to send back, matching_interface or
+//     mismatched_interface.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+StatusCode
+rpcstubcheckinterface(uint32_t interfaceid);
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 //
 //                dispatchFunction
@@ -75,8 +120,98 @@ rpcstubinitialize();
 //     generated stubs, but this is a common place to
 //     declare it where rpcserver will see it.
 //
+//     Reads one request frame from conn and answers it.
+//     Only touches conn, so different connections can be
+//     dispatched on different threads at once.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void dispatchFunction(RPCConnection &conn);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                dispatchRequest
+//
+//     Also in each generated stub. Answers one request
+//     whose frame has already been read: the function id,
+//     the call id, and a cursor over its args. The response
+//     frame, which starts with the call id, is appended to
+//     resOut, which the caller sends. Never throws; errors
+//     are answered with a status frame.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void dispatchRequest(uint32_t funcid, uint32_t callid, RPCCursor &argsIn,
+                     RPCWriter &resOut);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                dispatchAsync
+//
+//     Also in each generated stub. For stubs generated with
+//     rpcgenerate --coroutines, starts a request as a
+//     coroutine on the executor (see rpccoro.h), taking its
+//     args, and returns true; done is called with the
+//     response frame when it finishes, on whichever thread
+//     that is. Other stubs return false at once, and the
+//     request should go to dispatchRequest.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+bool dispatchAsync(uint32_t funcid, uint32_t callid, string &args,
+                   function<void(RPCWriter &resOut)> done);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcstubfailed
+//
+//     Called where a stub threw, with where in resOut its
+//     answer starts. A stub that answers a bad call with a
+//     status frame and then throws has answered it whole, and
+//     that is kept; otherwise, eg. the function itself threw,
+//     whatever the stub wrote is dropped and the call is
+//     answered with func_failed, so the response frames that
+//     follow stay in step.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcstubfailed(RPCWriter &resOut, size_t answerStart);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcstubbatch
+//
+//     Answers a <func>_batch request, called by the generated
+//     dispatch with the function's own stub. argsIn holds the
+//     number of calls and then each call's args, preceded by
+//     their size; stub answers each call in turn, and the
+//     result is the number of answers and then each one,
+//     status, size and bytes, as the call on its own would
+//     have been answered. A batch whose calls do not add up
+//     to its args is answered with a status frame, and none
+//     of its calls are made; a call that throws is answered
+//     as rpcstubfailed does, and the rest still made. The coroutine version is for
+//     stubs generated with rpcgenerate --coroutines.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+void rpcstubbatch(void (*stub)(RPCCursor &argsIn, RPCWriter &resOut),
+                  RPCCursor &argsIn, RPCWriter &resOut);
+#ifdef __cpp_impl_coroutine
+RPCTask<void> rpcstubbatch(RPCTask<void> (*stub)(RPCCursor &argsIn,
+                                                 RPCWriter &resOut),
+                           RPCCursor &argsIn, RPCWriter &resOut);
+#endif
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                rpcInterfaceId
+//
+//     Also in each of the generated stubs, returns the
+//     id of the idl the stubs were generated from.
+//
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
-void dispatchFunction();
+uint32_t rpcInterfaceId();
 
 #endif
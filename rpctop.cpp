@@ -0,0 +1,164 @@
+// rpctop.cpp
+//
+// Prints the stats a running rpcserver keeps for each of its functions, see
+// rpcstats.h
+//  - usage: ./rpctop <servername> [seconds]
+//  - works with any server, whatever its idl: it makes only the built-in
+//    stats call, which every stub answers
+//  - per function: calls, calls that failed by status, bytes in and out,
+//    and the p50, p99 and p999 latencies of the whole call and of each of
+//    its decode, execute and encode phases, as the stub timed them
+//  - with seconds, prints them again every that many seconds, until killed
+//
+// by: Justin Jo and Charles Wan
+
+
+// define debug file, can be set by compiler
+#ifndef _DEBUG_FILE_
+#define _DEBUG_FILE_ NULL
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "rpcproxyhelper.h"
+#include "c150debug.h"
+#include "c150grading.h"
+#include "rpcutils.h"
+#include "rpcstats.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+
+// fwd declarations
+void usage(char *progname, int exitCode);
+vector<RPCFuncSnapshot> fetchStats();
+void printStats(const vector<RPCFuncSnapshot> &funcs);
+
+
+// cmd line args
+const int serverArg = 1;
+const int secondsArg = 2;
+
+// the phases printed, in order, see rpcstats.h
+const char *PHASE_NAMES[RPCSTATS_PHASES] = {
+    "decode", "execute", "encode", "total"
+};
+
+
+// ==========
+// 
+// MAIN
+//
+// ==========
+
+int main(int argc, char *argv[]) {
+    GRADEME(argc, argv); // obligatory grading line
+
+    // cmd line handling
+    if (argc < 2 || argc > 3) {
+        usage(argv[0], 1);
+    }
+    int seconds = (argc == 3) ? atoi(argv[secondsArg]) : 0;
+    if (seconds < 0) usage(argv[0], 1);
+
+    initDebugLog(_DEBUG_FILE_, argv[0], 0);
+
+    try {
+        rpcproxyinitialize(argv[serverArg]);
+
+        while (1) {
+            printStats(fetchStats());
+            if (seconds == 0) break;
+            sleep(seconds);
+            printf("\n");
+        }
+
+    } catch (C150Exception &e) {
+        // write to debug log
+        c150debug->printf(
+            C150ALWAYSLOG,
+            "Caught %s",
+            e.formattedExplanation().c_str()
+        );
+        cerr << argv[0] << ": " << e.formattedExplanation() << endl; 
+        return 1;
+    }
+    return 0;
+}
+
+
+// ==========
+// 
+// DEFS
+//
+// ==========
+
+// Identifies rpctop to the stub when it connects, as a generated proxy
+// would, with the id every stub accepts
+uint32_t rpcInterfaceId() {
+    return RPCSTATSINTERFACEID;
+}
+
+// Prints command line usage to stderr and exits
+void usage(char *progname, int exitCode) {
+    fprintf(stderr, "usage: %s <servername> [seconds]\n", progname);
+    exit(exitCode);
+}
+
+// Makes the stats call, a request frame with no args, and decodes its
+// result
+vector<RPCFuncSnapshot> fetchStats() {
+    RPCProxyConnection *conn = rpcproxycheckout();
+    RPCCallId callid = rpcproxynextcall(conn);
+    RPCWriter argsOut(rpcproxytransport(conn), 12);
+    writeInt(argsOut, RPCSTATSID);
+    writeInt(argsOut, callid);
+    writeInt(argsOut, 0);
+    rpcproxysend(conn, argsOut);
+
+    RPCProxyResponse response;
+    rpcproxyawait(callid, response);
+    if (response.code != success) {
+        throw RPCException("rpctop: " + debugStatusCode(response.code));
+    }
+
+    vector<RPCFuncSnapshot> funcs;
+    if (!rpcstatsdecode(response.resIn, funcs)) {
+        throw RPCException("rpctop: Stats were scrambled");
+    }
+    return funcs;
+}
+
+// Prints each function's counts, then a line per phase of its latencies
+void printStats(const vector<RPCFuncSnapshot> &funcs) {
+    printf("%-20s %10s %8s %12s %12s\n",
+           "function", "calls", "errors", "bytes in", "bytes out");
+    for (const RPCFuncSnapshot &f : funcs) {
+        uint64_t errors = 0;
+        string failed;
+        for (int c = 0; c < RPCSTATS_CODES; c++) {
+            if (c == success || f.codes[c] == 0) continue;
+            errors += f.codes[c];
+            failed += "  " + debugStatusCode((StatusCode)c) + ": " +
+                      to_string(f.codes[c]);
+        }
+        printf("%-20s %10llu %8llu %12llu %12llu%s\n", f.name.c_str(),
+               (unsigned long long)f.calls, (unsigned long long)errors,
+               (unsigned long long)f.bytesIn,
+               (unsigned long long)f.bytesOut, failed.c_str());
+
+        for (int p = RPCSTATS_PHASES - 1; p >= 0; p--) { // total first
+            printf("  %-10s p50 %10.1f us  p99 %10.1f us  p999 %10.1f us\n",
+                   PHASE_NAMES[p],
+                   rpcstatspercentile(f.phases[p], 0.50) / 1e3,
+                   rpcstatspercentile(f.phases[p], 0.99) / 1e3,
+                   rpcstatspercentile(f.phases[p], 0.999) / 1e3);
+        }
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,268 @@
+// rpctrace.cpp
+//
+// Defines call tracing: per thread buffers of trace events, written out to a
+// Chrome trace event file in batches
+//
+// by: Justin Jo and Charles Wan
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "c150debug.h"
+#include "rpctrace.h"
+
+
+// constants
+const size_t TRACE_BATCH = 4096; // events a thread buffers before writing
+const int TRACE_FLUSH_MS = 100; // longest events wait to be written
+
+
+// RPCTraceEvent
+//  - one recorded event; names are the string literals generated code
+//    passes, so they are only formatted when written out
+
+struct RPCTraceEvent {
+    char ph; // X: span, b/e: call begins/ends, s/t/f: flow
+    const char *name;
+    long long ns;
+    long long durNs;
+    RPCTraceId traceid;
+};
+
+
+// RPCTraceBuffer
+//  - one thread's events; the thread appends and writes them, and
+//    flushLoop and exit write what is left in any, so each has a lock,
+//    which only then is ever contended
+
+struct RPCTraceBuffer {
+    mutex lock;
+    int tid;
+    vector<RPCTraceEvent> events;
+};
+
+bool RPCTRACING = false;
+static int traceFd = -1;
+static int tracePid = 0;
+static atomic<uint32_t> nextId(0);
+static mutex buffersMutex;
+static vector<RPCTraceBuffer *> buffers;
+
+
+// writeEvents
+//  - formats buf's events as json, one per line, and appends them to the
+//    trace file in a single write, under a lock on the file, so events of
+//    other processes tracing to it stay whole; then empties buf
+//  - called with buf's lock held
+
+static void writeEvents(RPCTraceBuffer &buf) {
+    string out;
+    char line[320];
+    for (const RPCTraceEvent &e : buf.events) {
+        int len;
+        double ts = e.ns / 1e3; // us
+        if (e.ph == 'X') {
+            len = snprintf(line, sizeof(line),
+                "{\"name\":\"%s\",\"cat\":\"rpc\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"trace\":\"%#llx\"}},\n",
+                e.name, ts, e.durNs / 1e3, tracePid, buf.tid,
+                (unsigned long long)e.traceid);
+        } else {
+            len = snprintf(line, sizeof(line),
+                "{\"name\":\"%s\",\"cat\":\"rpc\",\"ph\":\"%c\",\"ts\":%.3f,"
+                "\"pid\":%d,\"tid\":%d,\"id\":\"%#llx\"%s},\n",
+                e.name, e.ph, ts, tracePid, buf.tid,
+                (unsigned long long)e.traceid,
+                (e.ph == 'f') ? ",\"bp\":\"e\"" : "");
+        }
+        out.append(line, min<size_t>(len, sizeof(line) - 1));
+    }
+    buf.events.clear();
+
+    flock(traceFd, LOCK_EX);
+    ssize_t written = write(traceFd, out.data(), out.size());
+    flock(traceFd, LOCK_UN);
+    if (written != (ssize_t)out.size()) {
+        c150debug->printf(C150ALWAYSLOG, "rpctrace: Could not write trace");
+    }
+}
+
+
+// RPCTraceHolder
+//  - the calling thread's buffer, made on its first event; written out and
+//    dropped when the thread ends
+
+struct RPCTraceHolder {
+    RPCTraceBuffer *buf = NULL;
+
+    ~RPCTraceHolder() {
+        if (buf == NULL) return;
+        lock_guard<mutex> lock(buffersMutex);
+        {
+            lock_guard<mutex> bufLock(buf->lock);
+            if (!buf->events.empty()) writeEvents(*buf);
+        }
+        for (size_t b = 0; b < buffers.size(); b++) {
+            if (buffers[b] == buf) {
+                buffers.erase(buffers.begin() + b);
+                break;
+            }
+        }
+        delete buf;
+    };
+};
+
+static thread_local RPCTraceHolder holder;
+
+
+// record
+//  - appends e to the calling thread's buffer, and writes the buffer out
+//    once it is full
+
+static void record(const RPCTraceEvent &e) {
+    if (holder.buf == NULL) {
+        holder.buf = new RPCTraceBuffer();
+        holder.buf->tid = syscall(SYS_gettid);
+        holder.buf->events.reserve(TRACE_BATCH);
+        lock_guard<mutex> lock(buffersMutex);
+        buffers.push_back(holder.buf);
+    }
+
+    RPCTraceBuffer &buf = *holder.buf;
+    lock_guard<mutex> lock(buf.lock);
+    buf.events.push_back(e);
+    if (buf.events.size() >= TRACE_BATCH) writeEvents(buf);
+}
+
+
+// flushAll
+//  - writes out every thread's events, at exit and from flushLoop
+
+static void flushAll() {
+    lock_guard<mutex> lock(buffersMutex);
+    for (RPCTraceBuffer *buf : buffers) {
+        lock_guard<mutex> bufLock(buf->lock);
+        if (!buf->events.empty()) writeEvents(*buf);
+    }
+}
+
+
+// flushLoop
+//  - writes out every thread's events every so often, for threads that
+//    run until the process is killed, as server threads do, or go quiet
+
+static void flushLoop() {
+    while (1) {
+        this_thread::sleep_for(chrono::milliseconds(TRACE_FLUSH_MS));
+        flushAll();
+    }
+}
+
+
+// rpcTraceStart
+//  - see rpctrace.h; the file is never closed, so threads still running at
+//    exit can write to it
+
+void rpcTraceStart(const char *path) {
+    static once_flag started;
+    call_once(started, [path] {
+        traceFd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (traceFd < 0) {
+            throw RPCException("rpctrace: Could not open " + string(path));
+        }
+
+        // the array's [ once, by whoever gets the file first; the trace
+        // event format allows the array to be left unclosed
+        flock(traceFd, LOCK_EX);
+        if (lseek(traceFd, 0, SEEK_END) == 0 && write(traceFd, "[\n", 2) != 2) {
+            c150debug->printf(C150ALWAYSLOG, "rpctrace: Could not write trace");
+        }
+        flock(traceFd, LOCK_UN);
+
+        tracePid = getpid();
+        RPCTRACING = true;
+        atexit(flushAll);
+        thread(flushLoop).detach();
+    });
+}
+
+
+// rpctracenewid
+//  - the process id in the high bits, so ids from processes tracing to the
+//    same file do not collide
+
+RPCTraceId rpctracenewid() {
+    uint32_t n = nextId.fetch_add(1, memory_order_relaxed) + 1;
+    return ((RPCTraceId)getpid() << 32) | n;
+}
+
+
+// rpctraceheader
+//  - see rpctrace.h
+
+void rpctraceheader(RPCWriter &out, uint32_t funcid, uint32_t callid,
+                    int argsSize, RPCTraceId traceid) {
+    if (traceid == 0) {
+        writeInt(out, funcid);
+        writeInt(out, callid);
+        writeInt(out, argsSize);
+        return;
+    }
+
+    writeInt(out, RPCTRACEID);
+    writeInt(out, callid);
+    writeInt(out, 12 + argsSize);
+    writeInt(out, (int)(traceid >> 32));
+    writeInt(out, (int)(traceid & 0xffffffffu));
+    writeInt(out, funcid);
+}
+
+
+// rpctraceunwrap
+//  - see rpctrace.h
+
+uint32_t rpctraceunwrap(RPCCursor &argsIn, RPCTraceId &traceid) {
+    if (argsIn.remaining() < 12) return RPCTRACEID;
+
+    RPCTraceId hi = (uint32_t)extractInt(argsIn);
+    traceid = (hi << 32) | (uint32_t)extractInt(argsIn);
+    return extractInt(argsIn);
+}
+
+
+// rpctracespan
+//  - a flow event is put inside its span, so it is bound to it: at the
+//    start, but for the end of the flow, which is at the end of the wait,
+//    when the response came, so the arrows always point forwards
+
+void rpctracespan(const char *name, long long startNs, long long endNs,
+                  RPCTraceId traceid, char flow) {
+    record({'X', name, startNs, endNs - startNs, traceid});
+    if (flow != 0 && traceid != 0) {
+        long long ns = (flow == 'f') ? max(startNs, endNs - 1) : startNs;
+        record({flow, "call", ns, 0, traceid});
+    }
+}
+
+
+// rpctracebegin, rpctraceend
+//  - see rpctrace.h
+
+void rpctracebegin(const char *name, RPCTraceId traceid, long long ns) {
+    record({'b', name, ns, 0, traceid});
+}
+
+void rpctraceend(const char *name, RPCTraceId traceid, long long ns) {
+    record({'e', name, ns, 0, traceid});
+}
@@ -0,0 +1,146 @@
+// rpctrace.h
+//
+// Declares call tracing: once started, proxies and stubs record when each
+// phase of a call began and ended, and the trace is written out as Chrome
+// trace events, which chrome://tracing or Perfetto show as a timeline per
+// thread
+//  - a traced call is sent wrapped in a trace id, so the server's spans for
+//    it are linked to the client's, see rpctraceheader
+//  - processes tracing to the same file append to it, so a client and a
+//    server on one machine show up side by side, on the same clock
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCTRACE_H_
+#define _RPCTRACE_H_
+
+#include <inttypes.h>
+#include "rpcutils.h"
+
+using namespace std;
+
+
+// RPCTRACEID
+//  - the function id of a traced call's wrapper: its args are the trace id,
+//    as two ints, then the function id and args of the call itself;
+//    rpcgenerate refuses an idl with a function whose id is RPCTRACEID
+
+const uint32_t RPCTRACEID = 0xfffffffdu;
+
+
+// RPCTraceId
+//  - identifies one call across processes, 0 if it is not traced
+
+typedef uint64_t RPCTraceId;
+
+
+// RPCTRACING
+//  - set once rpcTraceStart has been called, for rpcTracing
+
+extern bool RPCTRACING;
+
+
+// rpcTracing
+//  - whether calls are being traced; generated code checks it before it
+//    reads the clock for a trace
+//  - compiled with -DRPC_NO_TRACING it is always false, so the compiler can
+//    drop tracing from proxies and stubs entirely
+
+inline bool rpcTracing() {
+#ifdef RPC_NO_TRACING
+    return false;
+#else
+    return RPCTRACING;
+#endif
+}
+
+
+// rpcTraceStart
+//  - starts tracing to the file at path, which is created with the start of
+//    a json array of events if it does not exist, and appended to if it
+//    does; delete it between runs
+//  - each thread's events are written out in batches as it records them,
+//    and whatever is left every 100ms, when it ends, and when the program
+//    exits; a process that is killed loses at most its last 100ms
+//  - initDebugLog calls it with $RPCTRACE, if it is set
+
+void rpcTraceStart(const char *path);
+
+
+// rpctracenewid
+//  - a trace id for a new call, unique among every process on the machine
+
+RPCTraceId rpctracenewid();
+
+
+// rpctraceheadersize, rpctraceheader
+//  - the size of, and writes, a request frame's header for a call to funcid
+//    with args of argsSize: func id, call id, args size; or, if traceid is
+//    not 0, the header of its RPCTRACEID wrapper
+
+inline size_t rpctraceheadersize(RPCTraceId traceid) {
+    return (traceid == 0) ? 12 : 24;
+}
+
+void rpctraceheader(RPCWriter &out, uint32_t funcid, uint32_t callid,
+                    int argsSize, RPCTraceId traceid);
+
+
+// rpctraceunwrap
+//  - takes the trace id off the args of an RPCTRACEID wrapper, for
+//    dispatchRequest
+//
+//  returns: the function id of the call inside, which is RPCTRACEID, ie.
+//    no function, if the wrapper is too short
+
+uint32_t rpctraceunwrap(RPCCursor &argsIn, RPCTraceId &traceid);
+
+
+// rpctracespan
+//  - records that phase name of a call took from startNs to endNs, on the
+//    calling thread, in rpcNowNs time
+//  - with a flow of 's', 't' or 'f', the span of a traced call also starts,
+//    passes through or ends the arrow that links the spans of call traceid
+//    across threads and processes: the proxy's send starts it, the server's
+//    dispatch passes through, and the proxy's wait for the response ends it
+
+void rpctracespan(const char *name, long long startNs, long long endNs,
+                  RPCTraceId traceid = 0, char flow = 0);
+
+
+// rpctracebegin, rpctraceend
+//  - record the start and end of call traceid to function name as a whole,
+//    which may be on different threads, and overlap other calls
+
+void rpctracebegin(const char *name, RPCTraceId traceid, long long ns);
+void rpctraceend(const char *name, RPCTraceId traceid, long long ns);
+
+
+// RPCTraceSpan
+//  - records a span from when it is made until it goes away, however the
+//    scope ends, if calls are being traced; for the phases that can be left
+//    by exceptions, or from a coroutine
+//  - flow is as for rpctracespan
+
+class RPCTraceSpan {
+private:
+    const char *name;
+    RPCTraceId traceid;
+    char flow;
+    long long startNs;
+
+public:
+    RPCTraceSpan(const char *name, RPCTraceId traceid, char flow = 0) :
+        name(name), traceid(traceid), flow(flow),
+        startNs(rpcTracing() ? rpcNowNs() : 0)
+    {};
+    ~RPCTraceSpan() {
+        if (startNs != 0) {
+            rpctracespan(name, startNs, rpcNowNs(), traceid, flow);
+        }
+    };
+
+    void rename(const char *newName) { name = newName; }; // eg. once known
+};
+
+#endif
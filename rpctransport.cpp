@@ -0,0 +1,522 @@
+// rpctransport.cpp
+//
+// Defines the byte stream transports that proxies and stubs read and write
+// through
+//
+// by: Justin Jo and Charles Wan
+
+
+#include <string>
+#include <sstream>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "c150debug.h"
+#include "rpctransport.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+
+// constants
+const int MEMORY_SPIN = 4096; // checks before a memory read sleeps
+const size_t MEMORY_PIPE_SIZE = 1 << 22; // unread bytes a writer may get ahead
+
+
+// _throwErrno
+//  - throws an RPCException explaining the current errno
+
+static void _throwErrno(const char *where) {
+    stringstream ss;
+    ss << where << ": " << strerror(errno);
+    throw RPCException(ss.str());
+}
+
+
+// _unixAddress
+//  - fills in addr for the unix domain socket at path, throws if the path
+//    is too long for one
+//
+//  returns: the length of addr to bind or connect with
+
+static socklen_t _unixAddress(const char *path, struct sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        throw RPCException("Unix socket path too long: " + string(path));
+    }
+    strcpy(addr.sun_path, path);
+    return sizeof(addr);
+}
+
+
+// RPCSocketTransport
+//  - takes ownership of fd, a connected socket
+//  - frames are written whole, so Nagle would only delay them; unix domain
+//    sockets do not have it, and ignore the option
+
+RPCSocketTransport::RPCSocketTransport(int fd) :
+    fd(fd), eofFlag(false), timedoutFlag(false), timeout(0)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+RPCSocketTransport::~RPCSocketTransport() {
+    close();
+}
+
+
+// RPCSocketTransport::connect
+//  - opens a connection to host:port, throws if it cannot
+
+RPCSocketTransport *RPCSocketTransport::connect(const char *host, int port) {
+    return new RPCSocketTransport(connectFd(host, port));
+}
+
+
+// RPCSocketTransport::connectFd
+//  - opens a connection to host:port and returns the socket, for transports
+//    that drive it themselves; throws if it cannot
+
+int RPCSocketTransport::connectFd(const char *host, int port) {
+    struct addrinfo hints, *addrs;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    stringstream portstr;
+    portstr << port;
+    if (getaddrinfo(host, portstr.str().c_str(), &hints, &addrs) != 0) {
+        throw RPCException("RPCSocketTransport.connect: Unknown host " +
+                           string(host));
+    }
+
+    int fd = -1;
+    for (struct addrinfo *a = addrs; a != NULL && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+
+    if (fd < 0) _throwErrno("RPCSocketTransport.connect");
+    return fd;
+}
+
+
+// RPCSocketTransport::connectUnix
+//  - opens a connection to the unix domain socket at path, throws if it
+//    cannot
+
+RPCSocketTransport *RPCSocketTransport::connectUnix(const char *path) {
+    return new RPCSocketTransport(connectUnixFd(path));
+}
+
+
+// RPCSocketTransport::connectUnixFd
+//  - opens a connection to the unix domain socket at path and returns the
+//    socket, for transports that drive it themselves; throws if it cannot
+
+int RPCSocketTransport::connectUnixFd(const char *path) {
+    struct sockaddr_un addr;
+    socklen_t addrlen = _unixAddress(path, addr);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) _throwErrno("RPCSocketTransport.connectUnix");
+    if (::connect(fd, (struct sockaddr *)&addr, addrlen) != 0) {
+        ::close(fd);
+        _throwErrno("RPCSocketTransport.connectUnix");
+    }
+    return fd;
+}
+
+
+// RPCSocketTransport::read
+//  - reads whatever has arrived, up to len bytes
+//  - if timeouts are on, waits at most that long for anything to arrive
+//
+//  returns: number of bytes read, 0 on eof or timeout (see eof, timedout)
+
+ssize_t RPCSocketTransport::read(char *buf, ssize_t len) {
+    timedoutFlag = false;
+    if (fd < 0) {
+        eofFlag = true;
+        return 0;
+    }
+
+    if (timeout != 0) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready;
+        do {
+            ready = poll(&pfd, 1, timeout);
+        } while (ready < 0 && errno == EINTR);
+
+        if (ready == 0) {
+            timedoutFlag = true;
+            return 0;
+        }
+    }
+
+    ssize_t readlen;
+    do {
+        readlen = recv(fd, buf, len, 0);
+    } while (readlen < 0 && errno == EINTR);
+
+    if (readlen <= 0) { // closed by peer, or broken
+        eofFlag = true;
+        return 0;
+    }
+    return readlen;
+}
+
+
+// RPCSocketTransport::write
+//  - writes all len bytes of buf, throws if the connection is broken
+//  - if timeouts are on, also throws once the peer has taken nothing for
+//    that long, eg. a client that sends requests but never reads the
+//    responses, rather than blocking until it does
+
+void RPCSocketTransport::write(const char *buf, ssize_t len) {
+    timedoutFlag = false;
+    int flags = MSG_NOSIGNAL | (timeout != 0 ? MSG_DONTWAIT : 0);
+    while (len > 0) {
+        ssize_t writelen = send(fd, buf, len, flags);
+        if (writelen < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                _throwErrno("RPCSocketTransport.write");
+
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            int ready;
+            do {
+                ready = poll(&pfd, 1, timeout);
+            } while (ready < 0 && errno == EINTR);
+
+            if (ready == 0) {
+                timedoutFlag = true;
+                throw RPCException("RPCSocketTransport.write: Timed out");
+            }
+            continue;
+        }
+        buf += writelen;
+        len -= writelen;
+    }
+}
+
+
+// RPCSocketTransport::close
+//  - closes the socket, safe to call more than once
+
+void RPCSocketTransport::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+
+// RPCListener
+//  - binds to port on all interfaces and starts listening, throws if it cannot
+
+RPCListener::RPCListener(int port) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) _throwErrno("RPCListener");
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        _throwErrno("RPCListener");
+    }
+
+    stringstream ss;
+    ss << "port " << port;
+    label = ss.str();
+}
+
+
+// RPCListener
+//  - listens on a unix domain socket at path, replacing anything left there
+//    by an earlier server; throws if it cannot
+
+RPCListener::RPCListener(const char *path) : path(path), label(path) {
+    struct sockaddr_un addr;
+    socklen_t addrlen = _unixAddress(path, addr);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) _throwErrno("RPCListener");
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, addrlen) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        _throwErrno("RPCListener");
+    }
+}
+
+RPCListener::~RPCListener() {
+    ::close(fd);
+    if (!path.empty()) unlink(path.c_str());
+}
+
+
+// RPCListener::accept
+//  - waits for the next connection and returns a transport for it
+
+RPCSocketTransport *RPCListener::accept() {
+    return new RPCSocketTransport(acceptFd());
+}
+
+
+// RPCListener::acceptFd
+//  - waits for the next connection and returns its socket, for transports
+//    that drive it themselves
+
+int RPCListener::acceptFd() {
+    int connfd;
+    do {
+        connfd = ::accept(fd, NULL, NULL);
+    } while (connfd < 0 && errno == EINTR);
+
+    if (connfd < 0) _throwErrno("RPCListener.accept");
+    return connfd;
+}
+
+
+// splitHostPort
+//  - splits a server name of the form host:port
+//
+//  returns: true if servername had a port, false if it is just a host name,
+//           ie. the framework's default port should be used
+
+bool splitHostPort(const char *servername, string &host, int &port) {
+    const char *colon = strrchr(servername, ':');
+    if (colon == NULL) return false;
+
+    host = string(servername, colon - servername);
+    port = atoi(colon + 1);
+    return true;
+}
+
+
+// RPCMemoryPipe
+//  - one direction of a memory transport: bytes written by one end and not
+//    yet read by the other
+//  - unread and closed are also kept outside the lock, so a reader can spin
+//    on them without taking it
+//  - holds at most MEMORY_PIPE_SIZE unread bytes, as the shared memory ring
+//    does; a writer past that waits for the reader to make room
+
+struct RPCMemoryPipe {
+    mutex lock;
+    condition_variable cond;
+    condition_variable roomCond;
+    string buf; // unread bytes are buf[start, end)
+    size_t start;
+    atomic<size_t> unread;
+    atomic<bool> closed;
+    bool sleeping; // a reader is waiting on cond
+    int full; // writers waiting on roomCond
+
+    RPCMemoryPipe() :
+        start(0), unread(0), closed(false), sleeping(false), full(0)
+    {};
+
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        cond.notify_all();
+        roomCond.notify_all();
+    }
+};
+
+
+// checks before a memory read sleeps; with one cpu the writer cannot run
+// while the reader spins, so it sleeps at once
+static const int _memorySpin =
+    (thread::hardware_concurrency() > 1) ? MEMORY_SPIN : 0;
+
+// servers listening for memory connections, by name
+static map<string, RPCMemoryTransport::Acceptor> _memoryListeners;
+static mutex _memoryListenersLock;
+
+
+// RPCMemoryTransport
+//  - an end that reads from in and writes to out
+
+RPCMemoryTransport::RPCMemoryTransport(shared_ptr<RPCMemoryPipe> in,
+                                       shared_ptr<RPCMemoryPipe> out) :
+    in(in), out(out), eofFlag(false), timedoutFlag(false), timeout(0)
+{}
+
+RPCMemoryTransport::~RPCMemoryTransport() {
+    close();
+}
+
+
+// RPCMemoryTransport::pair
+//  - makes two connected ends; what is written to one is read from the other
+
+void RPCMemoryTransport::pair(RPCMemoryTransport *&a, RPCMemoryTransport *&b) {
+    shared_ptr<RPCMemoryPipe> ab(new RPCMemoryPipe());
+    shared_ptr<RPCMemoryPipe> ba(new RPCMemoryPipe());
+    a = new RPCMemoryTransport(ba, ab);
+    b = new RPCMemoryTransport(ab, ba);
+}
+
+
+// RPCMemoryTransport::listen
+//  - from now on, each connect to name makes a pair and hands the second end
+//    to accept, on the connecting thread
+
+void RPCMemoryTransport::listen(const char *name, Acceptor accept) {
+    lock_guard<mutex> guard(_memoryListenersLock);
+    _memoryListeners[name] = accept;
+}
+
+
+// RPCMemoryTransport::connect
+//  - connects to the server listening on name, throws if there is none
+
+RPCMemoryTransport *RPCMemoryTransport::connect(const char *name) {
+    Acceptor accept;
+    {
+        lock_guard<mutex> guard(_memoryListenersLock);
+        map<string, Acceptor>::iterator it = _memoryListeners.find(name);
+        if (it == _memoryListeners.end()) {
+            throw RPCException("RPCMemoryTransport.connect: Nothing listening on " +
+                               string(name));
+        }
+        accept = it->second;
+    }
+
+    RPCMemoryTransport *client, *server;
+    pair(client, server);
+    accept(server);
+    return client;
+}
+
+
+// RPCMemoryTransport::read
+//  - reads whatever has been written, up to len bytes
+//  - spins for a while before sleeping; if timeouts are on, sleeps at most
+//    that long
+//
+//  returns: number of bytes read, 0 on eof or timeout (see eof, timedout)
+
+ssize_t RPCMemoryTransport::read(char *buf, ssize_t len) {
+    timedoutFlag = false;
+    if (!in) {
+        eofFlag = true;
+        return 0;
+    }
+
+    RPCMemoryPipe &pipe = *in;
+    for (int i = 0; i < _memorySpin && pipe.unread == 0 && !pipe.closed; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    unique_lock<mutex> guard(pipe.lock);
+    if (pipe.unread == 0 && !pipe.closed) {
+        pipe.sleeping = true;
+        if (timeout != 0) {
+            pipe.cond.wait_for(guard, chrono::milliseconds(timeout), [&pipe] {
+                return pipe.unread != 0 || pipe.closed;
+            });
+        } else {
+            pipe.cond.wait(guard, [&pipe] {
+                return pipe.unread != 0 || pipe.closed;
+            });
+        }
+        pipe.sleeping = false;
+    }
+
+    size_t avail = pipe.unread;
+    if (avail == 0) {
+        if (pipe.closed) eofFlag = true; else timedoutFlag = true;
+        return 0;
+    }
+
+    size_t readlen = (avail < (size_t)len) ? avail : (size_t)len;
+    memcpy(buf, &pipe.buf[pipe.start], readlen);
+    pipe.start += readlen;
+    if (pipe.start == pipe.buf.size()) {
+        pipe.buf.clear(); // all read, rewind for free
+        pipe.start = 0;
+    } else if (pipe.start > pipe.buf.size() / 2) {
+        pipe.buf.erase(0, pipe.start); // moves less than was read
+        pipe.start = 0;
+    }
+    pipe.unread = avail - readlen;
+    if (pipe.full > 0) pipe.roomCond.notify_all();
+    return readlen;
+}
+
+
+// RPCMemoryTransport::write
+//  - appends all len bytes of buf for the other end, waiting for it to make
+//    room if the pipe fills; throws if either end has closed
+
+void RPCMemoryTransport::write(const char *buf, ssize_t len) {
+    if (!out) throw RPCException("RPCMemoryTransport.write: Connection closed");
+
+    RPCMemoryPipe &pipe = *out;
+    unique_lock<mutex> guard(pipe.lock);
+    while (len > 0) {
+        if (pipe.closed) {
+            throw RPCException("RPCMemoryTransport.write: Connection closed");
+        }
+
+        size_t space = MEMORY_PIPE_SIZE - pipe.unread;
+        if (space == 0) {
+            pipe.full++;
+            pipe.roomCond.wait(guard, [&pipe] {
+                return pipe.unread < MEMORY_PIPE_SIZE || pipe.closed;
+            });
+            pipe.full--;
+            continue;
+        }
+
+        size_t writelen = ((size_t)len < space) ? len : space;
+        pipe.buf.append(buf, writelen);
+        pipe.unread = pipe.buf.size() - pipe.start;
+        if (pipe.sleeping) pipe.cond.notify_one();
+        buf += writelen;
+        len -= writelen;
+    }
+}
+
+
+// RPCMemoryTransport::close
+//  - closes both directions, safe to call more than once
+
+void RPCMemoryTransport::close() {
+    if (in) in->close();
+    if (out) out->close();
+    in.reset();
+    out.reset();
+}
@@ -0,0 +1,165 @@
+// rpctransport.h
+//
+// Declares the byte stream transports that proxies and stubs read and write
+// through, so that rpcutils is not tied to C150StreamSocket
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCTRANSPORT_H_
+#define _RPCTRANSPORT_H_
+
+#include <string>
+#include <memory>
+#include <sys/types.h>
+#include "c150streamsocket.h"
+#include "rpcutils.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+
+// RPCTransport
+//  - a connected byte stream, with the same read/eof/timeout behaviour as
+//    C150StreamSocket
+//      - read returns whatever has arrived, up to len, and 0 on eof/timeout
+//      - write writes all of buf or throws
+//  - flush sends anything write held back; only the uring transport holds
+//    writes, until the next read
+
+class RPCTransport {
+public:
+    virtual ~RPCTransport() {};
+
+    virtual ssize_t read(char *buf, ssize_t len) = 0;
+    virtual void write(const char *buf, ssize_t len) = 0;
+    virtual void flush() {};
+    virtual bool eof() = 0;
+    virtual bool timedout() = 0;
+    virtual void turnOnTimeouts(int ms) = 0;
+    virtual void close() = 0;
+};
+
+
+// RPCC150Transport
+//  - transport over a C150StreamSocket, which it does not own; used for the
+//    framework's default ports
+
+class RPCC150Transport : public RPCTransport {
+private:
+    C150StreamSocket *sock;
+
+public:
+    RPCC150Transport(C150StreamSocket *sock) : sock(sock) {};
+
+    ssize_t read(char *buf, ssize_t len) { return sock->read(buf, len); };
+    void write(const char *buf, ssize_t len) { sock->write(buf, len); };
+    bool eof() { return sock->eof(); };
+    bool timedout() { return sock->timedout(); };
+    void turnOnTimeouts(int ms) { sock->turnOnTimeouts(ms); };
+    void close() { sock->close(); };
+};
+
+
+// RPCSocketTransport
+//  - transport over a connected stream socket that it owns, tcp or unix domain
+//  - unlike C150StreamSocket, any number of these can be open at once, eg. one
+//    per client accepted by a concurrent server
+
+class RPCSocketTransport : public RPCTransport {
+private:
+    int fd;
+    bool eofFlag;
+    bool timedoutFlag;
+    int timeout; // ms, 0 for none
+
+public:
+    RPCSocketTransport(int fd);
+    ~RPCSocketTransport();
+
+    static RPCSocketTransport *connect(const char *host, int port);
+    static int connectFd(const char *host, int port); // the bare socket
+    static RPCSocketTransport *connectUnix(const char *path);
+    static int connectUnixFd(const char *path); // the bare socket
+
+    ssize_t read(char *buf, ssize_t len);
+    void write(const char *buf, ssize_t len);
+    bool eof() { return eofFlag; };
+    bool timedout() { return timedoutFlag; };
+    void turnOnTimeouts(int ms) { timeout = ms; };
+    void close();
+
+    int fileno() const { return fd; };
+};
+
+
+// RPCListener
+//  - listening socket that hands out an RPCSocketTransport per accepted
+//    connection: a tcp port, or a unix domain socket at a path, which skips
+//    the tcp/ip stack for clients on the same machine
+//  - a unix socket's path is removed when the listener is
+
+class RPCListener {
+private:
+    int fd;
+    string path; // unix domain only
+    string label; // for logs
+
+public:
+    RPCListener(int port);
+    RPCListener(const char *path);
+    ~RPCListener();
+
+    RPCSocketTransport *accept();
+    int acceptFd(); // the bare socket
+    int fileno() const { return fd; };
+    const char *address() const { return label.c_str(); };
+};
+
+
+// RPCMemoryTransport
+//  - one end of an in-process byte stream between two threads, eg. proxies
+//    and stubs linked into the same program, so calls cost serialization and
+//    dispatch but no system calls
+//  - a reader spins briefly before it sleeps, since the other end is
+//    usually about to answer; a writer that gets too far ahead of the reader
+//    waits for it
+//  - ends are made in pairs, or by connecting to a name that a server has
+//    listened on; close makes the other end see eof once it has read
+//    everything written before
+
+struct RPCMemoryPipe;
+
+class RPCMemoryTransport : public RPCTransport {
+public:
+    // takes ownership of the server's end of each new connection
+    typedef void (*Acceptor)(RPCTransport *server);
+
+private:
+    shared_ptr<RPCMemoryPipe> in, out;
+    bool eofFlag;
+    bool timedoutFlag;
+    int timeout; // ms, 0 for none
+
+    RPCMemoryTransport(shared_ptr<RPCMemoryPipe> in,
+                       shared_ptr<RPCMemoryPipe> out);
+
+public:
+    ~RPCMemoryTransport();
+
+    static void pair(RPCMemoryTransport *&a, RPCMemoryTransport *&b);
+    static void listen(const char *name, Acceptor accept);
+    static RPCMemoryTransport *connect(const char *name); // throws if unknown
+
+    ssize_t read(char *buf, ssize_t len);
+    void write(const char *buf, ssize_t len);
+    bool eof() { return eofFlag; };
+    bool timedout() { return timedoutFlag; };
+    void turnOnTimeouts(int ms) { timeout = ms; };
+    void close();
+};
+
+
+// function declarations
+bool splitHostPort(const char *servername, string &host, int &port);
+
+#endif
@@ -0,0 +1,451 @@
+// rpcuring.cpp
+//
+// Defines the io_uring ring, provided buffers and transport
+//  - the ring is set up and driven with the raw io_uring system calls, as
+//    liburing is not assumed to be installed
+//
+// by: Justin Jo and Charles Wan
+
+
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "c150debug.h"
+#include "rpcuring.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+
+// _throwErrno
+//  - throws an RPCException explaining errno err
+
+static void _throwErrno(const char *where, int err) {
+    stringstream ss;
+    ss << where << ": " << strerror(err);
+    throw RPCException(ss.str());
+}
+
+
+#ifdef RPC_HAVE_URING
+
+// RPCUring
+//  - sets up a ring with room for entries submissions and maps its queues
+//  - needs the single mmap layout (linux 5.4+)
+
+RPCUring::RPCUring(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) _throwErrno("RPCUring", errno);
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        ::close(fd);
+        throw RPCException("RPCUring: Kernel io_uring is too old");
+    }
+
+    sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cqMapSize > sqMapSize) sqMapSize = cqMapSize;
+    cqMapSize = 0; // shares the sq mapping
+
+    sqMap = mmap(NULL, sqMapSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, fd,
+                                       IORING_OFF_SQES);
+    if (sqMap == MAP_FAILED || sqes == MAP_FAILED) {
+        int err = errno;
+        if (sqMap != MAP_FAILED) munmap(sqMap, sqMapSize);
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        ::close(fd);
+        _throwErrno("RPCUring", err);
+    }
+    cqMap = sqMap;
+
+    char *sq = (char *)sqMap;
+    sqHead = (unsigned *)(sq + p.sq_off.head);
+    sqTail = (unsigned *)(sq + p.sq_off.tail);
+    sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + p.sq_off.array);
+    sqEntries = p.sq_entries;
+    sqPrepared = *sqTail;
+    for (unsigned i = 0; i < sqEntries; i++) {
+        sqArray[i] = i; // sqe i always sits in slot i
+    }
+
+    char *cq = (char *)cqMap;
+    cqHead = (unsigned *)(cq + p.cq_off.head);
+    cqTail = (unsigned *)(cq + p.cq_off.tail);
+    cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+RPCUring::~RPCUring() {
+    munmap(sqes, sqesSize);
+    munmap(sqMap, sqMapSize);
+    ::close(fd);
+}
+
+
+// RPCUring::getSqe
+//  - next free submission entry, zeroed; if every entry is already prepared,
+//    they are submitted first to make room
+
+struct io_uring_sqe *RPCUring::getSqe() {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqPrepared - head >= sqEntries) {
+        submit();
+        head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    }
+
+    struct io_uring_sqe *sqe = &sqes[sqPrepared & *sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqPrepared++;
+    return sqe;
+}
+
+
+// RPCUring::submit
+//  - hands every prepared sqe to the kernel and, if waitFor is not 0, waits
+//    until at least that many completions are waiting, in one system call
+//
+//  returns: what io_uring_enter returns, ie. sqes submitted or -1
+
+int RPCUring::submit(unsigned waitFor) {
+    unsigned toSubmit = sqPrepared - *sqTail;
+    __atomic_store_n(sqTail, sqPrepared, __ATOMIC_RELEASE);
+
+    unsigned flags = (waitFor != 0) ? IORING_ENTER_GETEVENTS : 0;
+    int ret = syscall(__NR_io_uring_enter, fd, toSubmit, waitFor, flags,
+                      NULL, 0);
+    while (ret < 0 && errno == EINTR) { // sqes went in, just wait again
+        ret = syscall(__NR_io_uring_enter, fd, 0, waitFor, flags, NULL, 0);
+    }
+    return ret;
+}
+
+
+// RPCUring::peekCqe, RPCUring::cqeSeen
+//  - oldest waiting completion, which stays queued until cqeSeen
+
+struct io_uring_cqe *RPCUring::peekCqe() {
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return NULL;
+    return &cqes[head & *cqMask];
+}
+
+void RPCUring::cqeSeen() {
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+
+// RPCUringBuffers
+//  - registers count buffers of size bytes under group; count must be a
+//    power of 2
+//  - throws if the kernel has no provided buffer rings (linux 5.19+)
+
+RPCUringBuffers::RPCUringBuffers(RPCUring &ring, uint16_t group,
+                                 unsigned count, size_t size) :
+    ring(ring), group(group), count(count), size(size)
+{
+    brSize = count * sizeof(struct io_uring_buf);
+    br = (struct io_uring_buf_ring *)mmap(NULL, brSize, PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED) _throwErrno("RPCUringBuffers", errno);
+    memset(br, 0, brSize); // fault the ring in before the kernel pins it
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ring.fileno(),
+                IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        int err = errno;
+        munmap(br, brSize);
+        _throwErrno("RPCUringBuffers", err);
+    }
+
+    bufs = new char[count * size];
+    for (unsigned bid = 0; bid < count; bid++) {
+        recycle(bid);
+    }
+}
+
+RPCUringBuffers::~RPCUringBuffers() {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = group;
+    syscall(__NR_io_uring_register, ring.fileno(),
+            IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(br, brSize);
+    delete[] bufs;
+}
+
+
+// RPCUringBuffers::recycle
+//  - puts buffer bid back at the tail of the ring for the kernel to fill
+//  - entries are indexed from the start of the ring rather than through
+//    br->bufs, which C++ lays out 8 bytes late (the header's flexible array
+//    sits behind an empty struct, which has size 1 in C++ but 0 in C)
+
+void RPCUringBuffers::recycle(unsigned bid) {
+    uint16_t tail = br->tail;
+    struct io_uring_buf *buf = (struct io_uring_buf *)br + (tail & (count - 1));
+    buf->addr = (uint64_t)(uintptr_t)buffer(bid);
+    buf->len = size;
+    buf->bid = bid;
+    __atomic_store_n(&br->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+#endif
+
+
+// RPCUringTransport
+//  - takes ownership of fd, a connected tcp socket
+//  - frames are written whole, so Nagle would only delay them
+
+RPCUringTransport::RPCUringTransport(int fd) :
+    fd(fd), eofFlag(false), timedoutFlag(false), timeout(0), receiving(false)
+#ifdef RPC_HAVE_URING
+    , ring(8)
+#endif
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+RPCUringTransport::~RPCUringTransport() {
+    close();
+}
+
+
+// RPCUringTransport::available
+//  - whether io_uring can be set up here, checked once
+
+bool RPCUringTransport::available() {
+#ifdef RPC_HAVE_URING
+    static int usable = -1;
+    if (usable < 0) {
+        try {
+            RPCUring probe(2);
+            usable = 1;
+        } catch (RPCException &e) {
+            usable = 0;
+        }
+    }
+    return usable == 1;
+#else
+    return false;
+#endif
+}
+
+
+// RPCUringTransport::connect
+//  - opens a connection to host:port over io_uring, or over a plain socket
+//    transport if io_uring is not available; throws if it cannot connect
+
+RPCTransport *RPCUringTransport::connect(const char *host, int port) {
+    if (!available()) {
+        c150debug->printf(C150RPCDEBUG,
+            "RPCUringTransport: io_uring not available, using sockets");
+        return RPCSocketTransport::connect(host, port);
+    }
+    return new RPCUringTransport(RPCSocketTransport::connectFd(host, port));
+}
+
+
+// RPCUringTransport::write
+//  - holds buf until the next read or close, or sends it now if another
+//    thread's read is already waiting to receive, see rpcuring.h
+
+void RPCUringTransport::write(const char *buf, ssize_t len) {
+    lock_guard<mutex> lock(pendingMutex);
+    pending.append(buf, len);
+    if (receiving) sendAll(pending);
+}
+
+
+// RPCUringTransport::flush
+//  - sends anything held now, with plain system calls
+
+void RPCUringTransport::flush() {
+    lock_guard<mutex> lock(pendingMutex);
+    if (!pending.empty()) sendAll(pending);
+}
+
+
+// RPCUringTransport::sendAll
+//  - sends data with plain system calls and empties it, for close, the rare
+//    short send, and writes made while a read waits
+
+void RPCUringTransport::sendAll(string &data) {
+    size_t sentlen = 0;
+    while (sentlen < data.size()) {
+        ssize_t writelen = send(fd, data.data() + sentlen,
+                                data.size() - sentlen, MSG_NOSIGNAL);
+        if (writelen < 0) {
+            if (errno == EINTR) continue;
+            int err = errno;
+            data.clear();
+            _throwErrno("RPCUringTransport.write", err);
+        }
+        sentlen += writelen;
+    }
+    data.clear();
+}
+
+
+// RPCUringTransport::startReceiving
+//  - called once the read's own sends are out; from here on writes go
+//    straight out, starting with any made while they were being sent
+
+void RPCUringTransport::startReceiving() {
+    lock_guard<mutex> lock(pendingMutex);
+    receiving = true;
+    try {
+        sendAll(pending);
+    } catch (RPCException &e) {
+        // the socket is broken, which the receive will find too
+    }
+}
+
+
+#ifdef RPC_HAVE_URING
+
+// user_data of the transport's sqes
+enum { TRANSPORT_SEND = 1, TRANSPORT_RECV, TRANSPORT_TIMEOUT };
+
+#endif
+
+// RPCUringTransport::read
+//  - sends any held writes and reads whatever arrives, up to len, in one
+//    submission: a send linked to a receive, linked to a timeout if on
+//
+//  returns: number of bytes read, 0 on eof or timeout (see eof, timedout)
+
+ssize_t RPCUringTransport::read(char *buf, ssize_t len) {
+    timedoutFlag = false;
+    if (fd < 0) {
+        eofFlag = true;
+        return 0;
+    }
+
+#ifdef RPC_HAVE_URING
+    while (1) {
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+
+        {
+            lock_guard<mutex> lock(pendingMutex);
+            sending.swap(pending);
+            receiving = sending.empty();
+        }
+
+        unsigned expected = 0;
+        struct io_uring_sqe *sqe;
+        if (!sending.empty()) {
+            // all or nothing, so a short send does not split a frame
+            sqe = ring.getSqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)sending.data();
+            sqe->len = sending.size();
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = TRANSPORT_SEND;
+            expected++;
+        }
+
+        sqe = ring.getSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = len;
+        sqe->flags = (timeout != 0) ? IOSQE_IO_LINK : 0;
+        sqe->user_data = TRANSPORT_RECV;
+        expected++;
+
+        if (timeout != 0) {
+            sqe = ring.getSqe();
+            sqe->opcode = IORING_OP_LINK_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t)(uintptr_t)&ts;
+            sqe->len = 1;
+            sqe->user_data = TRANSPORT_TIMEOUT;
+            expected++;
+        }
+
+        if (ring.submit(expected) < 0) _throwErrno("RPCUringTransport", errno);
+
+        // every sqe in the chain completes, one way or another
+        int sendRes = 0, recvRes = 0, timeoutRes = 0;
+        for (unsigned got = 0; got < expected; got++) {
+            struct io_uring_cqe *cqe;
+            while ((cqe = ring.peekCqe()) == NULL) {
+                ring.submit(1);
+            }
+            if (cqe->user_data == TRANSPORT_SEND) {
+                sendRes = cqe->res;
+                if (sendRes == (int)sending.size()) startReceiving();
+            }
+            else if (cqe->user_data == TRANSPORT_RECV) recvRes = cqe->res;
+            else timeoutRes = cqe->res;
+            ring.cqeSeen();
+        }
+
+        {
+            lock_guard<mutex> lock(pendingMutex);
+            receiving = false;
+        }
+
+        if (!sending.empty()) {
+            if (sendRes < 0) {
+                sending.clear();
+                _throwErrno("RPCUringTransport.write", -sendRes);
+            }
+            sending.erase(0, sendRes);
+            sendAll(sending); // anything a short send left
+        }
+
+        if (recvRes > 0) return recvRes;
+        if (recvRes == -ECANCELED && timeoutRes == -ETIME) {
+            timedoutFlag = true;
+            return 0;
+        }
+        if (recvRes == -ECANCELED || recvRes == -EINTR || recvRes == -EAGAIN) {
+            continue; // eg. broken off by a short send, receive again
+        }
+
+        eofFlag = true; // closed by peer, or broken
+        return 0;
+    }
+#else
+    eofFlag = true;
+    return 0;
+#endif
+}
+
+
+// RPCUringTransport::close
+//  - sends anything held and closes the socket, safe to call more than once
+
+void RPCUringTransport::close() {
+    if (fd < 0) return;
+    try {
+        lock_guard<mutex> lock(pendingMutex);
+        sendAll(pending);
+    } catch (RPCException &e) {
+        // peer is gone, nothing more to tell it
+    }
+    ::close(fd);
+    fd = -1;
+}
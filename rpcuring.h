@@ -0,0 +1,138 @@
+// rpcuring.h
+//
+// Declares a minimal io_uring ring, spoken to with raw system calls so no
+// library is needed, and the io_uring transport built on it
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCURING_H_
+#define _RPCURING_H_
+
+#include <string>
+#include <mutex>
+#include <inttypes.h>
+#include "rpctransport.h"
+
+// io_uring is only compiled in where the kernel headers have it; everywhere
+// else RPCUring::available is false and callers fall back to plain sockets
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define RPC_HAVE_URING 1
+#include <linux/io_uring.h>
+#endif
+#endif
+
+using namespace std;
+
+
+#ifdef RPC_HAVE_URING
+
+// RPCUring
+//  - one io_uring instance: a submission queue that requests are prepared in,
+//    and a completion queue that their results come back on
+//  - prepared requests are only handed to the kernel on submit, so many of
+//    them cost a single system call
+//  - not thread safe; each ring belongs to one thread
+
+class RPCUring {
+private:
+    int fd;
+    void *sqMap, *cqMap;
+    size_t sqMapSize, cqMapSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned sqEntries;
+    unsigned sqPrepared; // tail including sqes not yet published
+
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+
+public:
+    RPCUring(unsigned entries); // throws RPCException if io_uring is unusable
+    ~RPCUring();
+
+    struct io_uring_sqe *getSqe(); // zeroed, submits first if the queue is full
+    int submit(unsigned waitFor = 0); // publishes prepared sqes, waits for cqes
+    struct io_uring_cqe *peekCqe(); // NULL if none are waiting
+    void cqeSeen(); // done with the cqe from peekCqe
+
+    int fileno() const { return fd; };
+};
+
+
+// RPCUringBuffers
+//  - a provided buffer ring: a pool of equal sized buffers registered with a
+//    ring under a group id, that receives pick from as data arrives, so idle
+//    connections do not each hold a buffer
+//  - a completion says which buffer it used; it must be recycled once read
+
+class RPCUringBuffers {
+private:
+    RPCUring &ring;
+    uint16_t group;
+    unsigned count;
+    size_t size;
+    struct io_uring_buf_ring *br;
+    size_t brSize;
+    char *bufs;
+
+public:
+    RPCUringBuffers(RPCUring &ring, uint16_t group, unsigned count, size_t size);
+    ~RPCUringBuffers();
+
+    uint16_t groupId() const { return group; };
+    char *buffer(unsigned bid) { return bufs + (size_t)bid * size; };
+    void recycle(unsigned bid); // hands buffer bid back to the kernel
+};
+
+#endif
+
+
+// RPCUringTransport
+//  - transport over a connected tcp socket whose reads and writes go through
+//    a small io_uring of its own
+//  - writes are held until the next read, and then sent together with it:
+//    a proxy's request and the wait for its response are one submission, ie.
+//    one system call per call instead of two; flush and close send anything
+//    held, for requests whose response is not waited for straight away
+//  - write errors therefore surface from the following read, flush or close
+//  - one thread may write while another reads: once the reader's own sends
+//    are out and it is only waiting to receive, writes are sent straight away
+//    rather than held for a read that may be waiting on them
+
+class RPCUringTransport : public RPCTransport {
+private:
+    int fd;
+    bool eofFlag;
+    bool timedoutFlag;
+    int timeout; // ms, 0 for none
+    string pending; // written, not yet sent
+    string sending; // taken from pending by the read in progress
+    bool receiving; // a read is waiting to receive, with nothing to send
+    mutex pendingMutex; // guards pending and receiving
+#ifdef RPC_HAVE_URING
+    RPCUring ring;
+#endif
+
+    void sendAll(string &data);
+    void startReceiving();
+
+public:
+    RPCUringTransport(int fd);
+    ~RPCUringTransport();
+
+    static bool available(); // whether this kernel can run it
+    static RPCTransport *connect(const char *host, int port); // or a socket
+
+    ssize_t read(char *buf, ssize_t len);
+    void write(const char *buf, ssize_t len);
+    void flush();
+    bool eof() { return eofFlag; };
+    bool timedout() { return timedoutFlag; };
+    void turnOnTimeouts(int ms) { timeout = ms; };
+    void close();
+};
+
+#endif
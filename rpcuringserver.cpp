@@ -0,0 +1,316 @@
+// rpcuringserver.cpp
+//
+// Defines the io_uring event loop server: multishot accept and receives,
+// with every connection's frames and responses kept by RPCEventConnection
+//
+// by: Justin Jo and Charles Wan
+
+
+#include <vector>
+#include <unordered_map>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "c150debug.h"
+#include "rpcuringserver.h"
+#include "rpceventconn.h"
+
+using namespace std;
+using namespace C150NETWORK;
+
+
+#ifdef RPC_HAVE_URING
+
+// constants
+const unsigned SERVER_RING_ENTRIES = 4096;
+const unsigned SERVER_BUFFERS = 256; // power of 2
+const size_t SERVER_BUFFER_SIZE = 16384;
+const uint16_t SERVER_BUFFER_GROUP = 0;
+const size_t MAX_QUEUED_OUTPUT = 1 << 20; // stop reading a client past this
+
+// user_data of the server's sqes: op in the top byte, connection id below
+enum { SERVER_ACCEPT = 1, SERVER_RECV, SERVER_SEND, SERVER_TIMER,
+       SERVER_CANCEL };
+const uint64_t ID_MASK = (1ULL << 56) - 1;
+
+static uint64_t _userData(int op, uint64_t id) {
+    return ((uint64_t)op << 56) | id;
+}
+
+
+// UringConnection
+//  - a client socket, its frames and queued responses, and what it has in
+//    flight on the ring
+//  - responses are moved from conn.out into sending for each send, so the
+//    bytes the kernel is sending are never touched while new responses queue
+//  - a receive is cancelled while more than MAX_QUEUED_OUTPUT of responses
+//    are waiting to be sent, as rpcepollserve stops reading, and armed
+//    again once they drain
+
+struct UringConnection {
+    uint64_t id;
+    int fd;
+    RPCEventConnection conn;
+    string sending;
+    size_t sendOff;
+    bool sendInFlight;
+    bool recvArmed;
+    bool recvCancelling;
+    bool broken;  // close as soon as nothing is in flight, dropping output
+    bool touched; // needs attention after this batch of completions
+
+    UringConnection(uint64_t id, int fd, int timeout) :
+        id(id), fd(fd), conn(timeout), sendOff(0), sendInFlight(false),
+        recvArmed(false), recvCancelling(false), broken(false),
+        touched(false)
+    {};
+};
+
+typedef unordered_map<uint64_t, UringConnection *> UringConnections;
+
+
+// armAccept
+//  - one multishot accept, which completes once for every new client
+
+static void armAccept(RPCUring &ring, int listenfd) {
+    struct io_uring_sqe *sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = _userData(SERVER_ACCEPT, 0);
+}
+
+
+// armRecv
+//  - one multishot receive, which completes every time data arrives, in a
+//    buffer the kernel picks from the provided buffers
+
+static void armRecv(RPCUring &ring, UringConnection *c) {
+    struct io_uring_sqe *sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = SERVER_BUFFER_GROUP;
+    sqe->user_data = _userData(SERVER_RECV, c->id);
+    c->recvArmed = true;
+}
+
+
+// cancelRecv
+//  - ends c's multishot receive; its last completion is -ECANCELED
+
+static void cancelRecv(RPCUring &ring, UringConnection *c) {
+    struct io_uring_sqe *sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = _userData(SERVER_RECV, c->id);
+    sqe->user_data = _userData(SERVER_CANCEL, c->id);
+    c->recvCancelling = true;
+}
+
+
+// armSend
+//  - sends the rest of c's sending buffer
+
+static void armSend(RPCUring &ring, UringConnection *c) {
+    struct io_uring_sqe *sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(c->sending.data() + c->sendOff);
+    sqe->len = c->sending.size() - c->sendOff;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = _userData(SERVER_SEND, c->id);
+    c->sendInFlight = true;
+}
+
+
+// armTimer
+//  - completes after ts, to check frame deadlines
+
+static void armTimer(RPCUring &ring, struct __kernel_timespec *ts) {
+    struct io_uring_sqe *sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)ts;
+    sqe->len = 1;
+    sqe->user_data = _userData(SERVER_TIMER, 0);
+}
+
+
+// settleConnection
+//  - after a batch of completions: closes c if it is done, otherwise starts
+//    sending whatever responses are queued, and re-arms its receive if needed
+//    and there is room for more responses, or cancels it if there is not
+//  - closing shuts the socket down first, which ends its receive; that last
+//    completion arrives for an id that is gone and is ignored
+
+static void settleConnection(RPCUring &ring, UringConnection *c,
+                             UringConnections &conns) {
+    bool drained = c->conn.queued() == 0 && c->sendOff == c->sending.size();
+    if (!c->sendInFlight && (c->broken || (c->conn.closing && drained))) {
+        shutdown(c->fd, SHUT_RDWR);
+        ::close(c->fd);
+        conns.erase(c->id);
+        delete c;
+        return;
+    }
+
+    if (!c->sendInFlight && !c->broken) {
+        if (c->sendOff < c->sending.size()) {
+            armSend(ring, c);
+        } else if (c->conn.queued() > 0) {
+            c->sending.clear();
+            c->sending.swap(c->conn.out);
+            c->conn.outSent = 0;
+            c->sendOff = 0;
+            armSend(ring, c);
+        }
+    }
+
+    size_t queued = c->conn.queued() + (c->sending.size() - c->sendOff);
+    if (queued >= MAX_QUEUED_OUTPUT) {
+        if (c->recvArmed && !c->recvCancelling) cancelRecv(ring, c);
+    } else if (!c->recvArmed && !c->conn.closing && !c->broken) {
+        armRecv(ring, c);
+    }
+}
+
+
+// rpcuringserve
+//  - see rpcuring.h
+
+bool rpcuringserve(RPCListener &listener, int timeout) {
+    RPCUring *ringp;
+    RPCUringBuffers *buffersp;
+    try {
+        ringp = new RPCUring(SERVER_RING_ENTRIES);
+        try {
+            buffersp = new RPCUringBuffers(*ringp, SERVER_BUFFER_GROUP,
+                                           SERVER_BUFFERS, SERVER_BUFFER_SIZE);
+        } catch (RPCException &e) {
+            delete ringp;
+            throw;
+        }
+    } catch (RPCException &e) {
+        c150debug->printf(C150RPCDEBUG, "rpcuringserver: Unavailable, %s",
+                          e.formattedExplanation().c_str());
+        return false;
+    }
+    RPCUring &ring = *ringp;
+    RPCUringBuffers &buffers = *buffersp;
+
+    armAccept(ring, listener.fileno());
+    c150debug->printf(C150RPCDEBUG,
+        "rpcuringserver: Listening on %s", listener.address());
+
+    // deadlines are checked a few times per timeout, as in rpcepollserve
+    struct __kernel_timespec ts;
+    ts.tv_sec = (timeout + 1) / 2 / 1000;
+    ts.tv_nsec = (long long)((timeout + 1) / 2 % 1000) * 1000000;
+    if (timeout != 0) armTimer(ring, &ts);
+
+    UringConnections conns;
+    uint64_t nextId = 1;
+    vector<UringConnection *> touched;
+    while (1) {
+        // everything prepared last round, eg. every connection's responses,
+        // goes in with the wait for the next completion
+        ring.submit(1);
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring.peekCqe()) != NULL) {
+            int op = cqe->user_data >> 56;
+            uint64_t id = cqe->user_data & ID_MASK;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            ring.cqeSeen();
+
+            UringConnection *c = NULL;
+            if (op == SERVER_RECV || op == SERVER_SEND) {
+                UringConnections::iterator it = conns.find(id);
+                if (it != conns.end()) c = it->second;
+            }
+
+            if (op == SERVER_ACCEPT) {
+                if (res >= 0) {
+                    int one = 1;
+                    setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    c = new UringConnection(nextId++, res, timeout);
+                    conns[c->id] = c;
+                    armRecv(ring, c);
+                    c150debug->printf(C150RPCDEBUG,
+                                      "rpcuringserver: Accepted client");
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    armAccept(ring, listener.fileno());
+                }
+            } else if (op == SERVER_RECV) {
+                bool hasBuffer = flags & IORING_CQE_F_BUFFER;
+                unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+                if (c != NULL && res > 0 && hasBuffer) {
+                    c->conn.receive(buffers.buffer(bid), res);
+                }
+                if (hasBuffer) buffers.recycle(bid);
+                if (c == NULL) continue; // already closed
+
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    c->recvArmed = false;
+                    c->recvCancelling = false;
+                }
+                if (res == 0 ||
+                    (res < 0 && res != -ENOBUFS && res != -ECANCELED)) {
+                    c150debug->printf(C150RPCDEBUG,
+                                      "rpcuringserver: EOF signaled on input");
+                    c->conn.closing = true;
+                }
+            } else if (op == SERVER_SEND) {
+                if (c == NULL) continue;
+                c->sendInFlight = false;
+                if (res < 0) {
+                    c150debug->printf(C150RPCDEBUG,
+                        "rpcuringserver: Write failed, closing connection");
+                    c->broken = true;
+                } else {
+                    c->sendOff += res;
+                }
+            } else if (op == SERVER_TIMER) {
+                long long now = rpcNowMs();
+                for (auto &entry : conns) {
+                    UringConnection *e = entry.second;
+                    if (e->conn.expired(now) && !e->broken) {
+                        c150debug->printf(C150RPCDEBUG,
+                            "rpcuringserver: Socket timed out");
+                        e->broken = true;
+                        if (!e->touched) {
+                            e->touched = true;
+                            touched.push_back(e);
+                        }
+                    }
+                }
+                armTimer(ring, &ts);
+            }
+
+            if (c != NULL && !c->touched) {
+                c->touched = true;
+                touched.push_back(c);
+            }
+        }
+
+        for (UringConnection *c : touched) {
+            c->touched = false;
+            settleConnection(ring, c, conns);
+        }
+        touched.clear();
+    }
+}
+
+#else
+
+bool rpcuringserve(RPCListener &listener, int timeout) {
+    return false;
+}
+
+#endif
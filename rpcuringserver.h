@@ -0,0 +1,26 @@
+// rpcuringserver.h
+//
+// Declares the io_uring event loop server
+//
+// by: Justin Jo and Charles Wan
+
+#ifndef _RPCURINGSERVER_H_
+#define _RPCURINGSERVER_H_
+
+#include "rpcuring.h"
+#include "rpcstubhelper.h"
+
+
+// rpcuringserve
+//  - event loop server like rpcepollserve, but on io_uring: one multishot
+//    accept for every client, one multishot receive per connection into
+//    provided buffers, and the responses of every connection that got
+//    requests sent in the same submission as the next wait
+//  - unlike rpcepollserve, a client that sends faster than it reads its
+//    responses is not throttled
+//  - returns false at once if this kernel cannot run it, so the caller can
+//    fall back to rpcepollserve; otherwise serves forever
+
+bool rpcuringserve(RPCListener &listener, int timeout);
+
+#endif
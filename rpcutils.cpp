@@ -7,17 +7,29 @@
 
 #include <string>
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
 #include <inttypes.h>
+#include <time.h>
+#include <mutex>
 #include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "c150grading.h"
 #include "c150debug.h"
-#include "c150streamsocket.h"
 #include "rpcutils.h"
+#include "rpctransport.h"
+#include "rpclog.h"
+#include "rpctrace.h"
 
 using namespace std;
 using namespace C150NETWORK;
 
 
+uint32_t RPCLOGCLASSES = 0;
+
+
 // initDebugLog
 //      - enables logging to either console or file
 //
@@ -25,10 +37,16 @@ using namespace C150NETWORK;
 //      - logname: name of log file; if NULL, defaults to console
 //      - progname: name of program
 //      - classes: for which to log
+//      - async: whether logDebug only queues lines, for a background thread
+//        to write, see rpclog.h; the lines are then stamped by the sink
+//        rather than by the log
+//  - if $RPCTRACE is set, also traces calls to the file it names, see
+//    rpctrace.h
 //
 // returns: n/a
 
-void initDebugLog(const char *logname, const char *progname, uint32_t classes) {
+void initDebugLog(const char *logname, const char *progname, uint32_t classes,
+                  bool async) {
     if (logname != NULL) { // pipe logging to file
         ofstream *outstreamp = new ofstream(logname);
         DebugStream *filestreamp = new DebugStream(outstreamp);
@@ -36,9 +54,17 @@ void initDebugLog(const char *logname, const char *progname, uint32_t classes) {
     }
 
     c150debug->setPrefix(progname);
-    c150debug->enableTimestamp();
+    if (async) {
+        rpcLogStart();
+    } else {
+        c150debug->enableTimestamp();
+    }
 
     c150debug->enableLogging(classes);
+    RPCLOGCLASSES |= classes;
+
+    const char *tracepath = getenv("RPCTRACE");
+    if (tracepath != NULL && *tracepath != '\0') rpcTraceStart(tracepath);
 }
 
 
@@ -46,10 +72,28 @@ void initDebugLog(const char *logname, const char *progname, uint32_t classes) {
 //  - prints the contents of debugStream to the debug log
 //  - if grade is true, debug string is also printed to grading log
 //  - clears the debugStream after printing
+//  - safe to call from several server threads at once; each stream is
+//    written whole
+//  - does nothing if rpcLogging says nothing would be printed, and never
+//    writes the grading log when compiled with -DRPC_NO_GRADING
+//  - with the async sink, only queues the line, see rpclog.h
+
+static mutex logMutex;
 
 void logDebug(stringstream &debugStream, uint32_t debugClasses, bool grade) {
-    c150debug->printf(debugClasses, debugStream.str().c_str());
-    if (grade) *GRADING << debugStream.str() << endl;
+#ifdef RPC_NO_GRADING
+    grade = false;
+#endif
+    grade = grade && GRADING != NULL;
+    if (!rpcLogging(debugClasses, grade)) {
+        // nothing would be printed
+    } else if (RPCLOGASYNC) {
+        rpcLogPost(debugClasses, grade, debugStream.view());
+    } else {
+        lock_guard<mutex> lock(logMutex);
+        c150debug->printf(debugClasses, debugStream.str().c_str());
+        if (grade) *GRADING << debugStream.str() << endl;
+    }
     debugStream.str(""); // clear debug stream so current debug does not leak
                          // into next debug
 }
@@ -77,10 +121,200 @@ void printBytes(const unsigned char *buf, size_t buflen) {
 }
 
 
+// rpcNowMs
+//  - monotonic clock in ms, for message deadlines
+
+long long rpcNowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// rpcNowUs
+//  - monotonic clock in us, for timing calls
+
+long long rpcNowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// rpcNowNs
+//  - monotonic clock in ns, for timing the phases of a call
+
+long long rpcNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// RPCReader
+//  - capacity is the initial buffer size, it grows if a caller needs more
+//    contiguous bytes than that
+
+RPCReader::RPCReader(RPCTransport *transport, size_t capacity) :
+    transport(transport), buf(capacity), start(0), end(0), timeout(0), deadline(0),
+    abandoned(false)
+{}
+
+
+// RPCReader::reset
+//  - drops all buffered bytes and message state
+
+void RPCReader::reset() {
+    start = end = 0;
+    deadline = 0;
+    abandoned = false;
+}
+
+
+// RPCReader::abandon
+//  - for a stream whose frame could not be read whole, eg. one that claimed
+//    more than MAX_FRAME_ARGS bytes: what follows is not a frame header, so
+//    nothing more is read and the connection reads as eof, to be closed
+
+void RPCReader::abandon() {
+    start = end = 0;
+    abandoned = true;
+}
+
+
+// RPCReader::eof, RPCReader::timedout
+//  - eof only once everything buffered has been read as well, or once the
+//    stream was abandoned
+
+bool RPCReader::eof() const {
+    return abandoned || (buffered() == 0 && transport->eof());
+}
+
+bool RPCReader::timedout() const {
+    return transport->timedout();
+}
+
+
+// RPCConnection
+//  - closes and deletes the transport
+
+RPCConnection::~RPCConnection() {
+    transport->close();
+    delete transport;
+}
+
+
+// RPCReader::compact
+//  - moves unread bytes to the front of the buffer to make room at the end
+
+void RPCReader::compact() {
+    if (start == 0) return;
+    memmove(&buf[0], &buf[start], end - start);
+    end -= start;
+    start = 0;
+}
+
+
+// RPCReader::sockRead
+//  - does a single socket read of up to len bytes into dst, and arms the
+//    message deadline when the first bytes of a message arrive
+//
+//  returns:
+//      - success, if any bytes were read
+//      - incomplete_bytes, if nothing could be read, ie. eof
+//      - timed_out, if the socket or the current message timed out
+
+StatusCode RPCReader::sockRead(char *dst, size_t len, ssize_t &readlen) {
+    readlen = transport->read(dst, len);
+    if (readlen > 0 && timeout != 0 && deadline == 0) {
+        deadline = rpcNowMs() + timeout;
+    }
+
+    if (transport->timedout() || (deadline != 0 && rpcNowMs() > deadline)) {
+        c150debug->printf(VARDEBUG, "rpcutils.RPCReader: Socket timed out");
+        return timed_out;
+    }
+    return readlen > 0 ? success : incomplete_bytes;
+}
+
+
+// RPCReader::fill
+//  - does a single socket read into the free space at the end of the buffer
+//  - the socket delivers whatever has arrived, up to the free space, so one
+//    read usually picks up a whole small frame, or several
+//
+//  returns: see sockRead
+
+StatusCode RPCReader::fill() {
+    if (start == end) {
+        start = end = 0; // empty, rewind for free
+    } else if (end == buf.size()) {
+        compact();
+    }
+
+    ssize_t readlen;
+    StatusCode code = sockRead(&buf[end], buf.size() - end, readlen);
+    if (readlen > 0) end += readlen;
+    return code;
+}
+
+
+// RPCReader::ensure
+//  - reads until at least len bytes are buffered, contiguously, starting at
+//    the next unread byte
+//  - if len exceeds the buffer's capacity, the buffer is doubled each time
+//    it fills, up to len, rather than sized for len up front; len comes off
+//    the wire, so a frame only costs memory for the bytes actually sent
+//
+//  returns: see sockRead, success once len bytes are buffered
+
+StatusCode RPCReader::ensure(size_t len) {
+    if (start + len > buf.size()) compact();
+
+    while (buffered() < len) {
+        if (end == buf.size()) buf.resize(min(len, 2 * buf.size()));
+        StatusCode code = fill();
+        if (code != success) return code;
+    }
+    return success;
+}
+
+
+// RPCReader::read
+//  - copies the next len bytes into dst, reading from the socket as needed
+//  - if len is larger than the buffer, the remainder is read straight into dst
+//    instead of growing the buffer
+//
+//  returns: see sockRead, success once len bytes are copied
+
+StatusCode RPCReader::read(char *dst, size_t len) {
+    if (len <= buf.size()) {
+        StatusCode code = ensure(len);
+        if (code != success) return code;
+        memcpy(dst, &buf[start], len);
+        start += len;
+        return success;
+    }
+
+    // too large to buffer, take what is buffered then bypass the buffer
+    size_t copied = buffered();
+    memcpy(dst, &buf[start], copied);
+    start = end = 0;
+
+    while (copied < len) {
+        ssize_t readlen;
+        StatusCode code = sockRead(dst + copied, len - copied, readlen);
+        if (code != success) return code;
+        copied += readlen;
+    }
+    return success;
+}
+
+
 // readAndCheck
-//  - reads lenToRead number of bytes from sock, and returns a status code based
+//  - reads lenToRead number of bytes from in, and returns a status code based
 //    on whether or not the bytes were successfully read
-//  - if lenToRead is 0, nothing is written and success is returned
+//  - if lenToRead is 0, nothing is read and success is returned
 //
 //  returns:
 //      - success, exact bytes receive
@@ -90,44 +324,27 @@ void printBytes(const unsigned char *buf, size_t buflen) {
 //  notes:
 //      - testing found that if a large number of bytes are expected, the socket
 //        will not necessarily deliver all of it at once. it is a stream after
-//        all.
-//          - solution: loop and read until we get all the bytes we want OR
-//            there are no more bytes left, which is a problem
+//        all. RPCReader loops until it has all of them.
 
-StatusCode readAndCheck(C150StreamSocket *sock, char *buf, ssize_t lenToRead) {
+StatusCode readAndCheck(RPCReader &in, char *buf, ssize_t lenToRead) {
     if (lenToRead == 0) return success;
-    ssize_t readlen, totalRead = 0;
-
-    // loop and read until lenToRead bytes filled or no bytes available
-    do {
-        readlen = sock->read(buf + totalRead, lenToRead - totalRead);
-        totalRead += readlen;
-
-        if (sock->timedout()) {
-            c150debug->printf(VARDEBUG, "rpcutils.readAndCheck: Socket timed out");
-            return timed_out;
-        }
-    } while (totalRead < lenToRead && readlen > 0);
 
-    if (totalRead == lenToRead) {
-        return success;
-
-    } else {
+    StatusCode code = in.read(buf, lenToRead);
+    if (code == incomplete_bytes) {
         c150debug->printf(VARDEBUG,
-            "rpcutils.readAndCheck: %d bytes could not be read, got %d "
-            "instead",
-            lenToRead, readlen);
-        return incomplete_bytes;
+            "rpcutils.readAndCheck: %d bytes could not be read",
+            lenToRead);
     }
+    return code;
 }
 
 
 // readAndThrow
-//  - reads lenToRead number of bytes from sock, throws if wrong number of bytes
+//  - reads lenToRead number of bytes from in, throws if wrong number of bytes
 //    received
 
-void readAndThrow(C150StreamSocket *sock, char *buf, ssize_t lenToRead) {
-    if (readAndCheck(sock, buf, lenToRead) != success) {
+void readAndThrow(RPCReader &in, char *buf, ssize_t lenToRead) {
+    if (readAndCheck(in, buf, lenToRead) != success) {
         stringstream ss;
         ss << "rpcutils.readAndCheck: " << lenToRead << " bytes could not be "
            << "read";
@@ -137,28 +354,116 @@ void readAndThrow(C150StreamSocket *sock, char *buf, ssize_t lenToRead) {
 
 
 // writeAndCheck
-//  - writes lenToWrite number of bytes to sock
+//  - writes lenToWrite number of bytes to transport
 //  - if lenToWrite = 0, no write is done to avoid premature EOF
 
-void writeAndCheck(C150StreamSocket *sock, const char *buf, ssize_t lenToWrite) {
+void writeAndCheck(RPCTransport *transport, const char *buf, ssize_t lenToWrite) {
     if (lenToWrite == 0) return;
-    sock->write(buf, lenToWrite);
+    transport->write(buf, lenToWrite);
+}
+
+
+// RPCWriter
+//  - sizeHint is the expected size of the frame, eg. 12 + argsSize for a
+//    request frame; exceeding it is allowed but costs a reallocation
+
+RPCWriter::RPCWriter(RPCTransport *transport, size_t sizeHint) :
+    transport(transport), corked(true)
+{
+    buf.reserve(sizeHint);
+}
+
+
+// RPCWriter::append
+//  - buffers len bytes of data, or writes them straight out if uncorked
+
+void RPCWriter::append(const char *data, size_t len) {
+    buf.append(data, len);
+    if (!corked) flush();
+}
+
+
+// RPCWriter::uncork
+//  - stops buffering; whatever was buffered while corked is flushed now
+
+void RPCWriter::uncork() {
+    corked = false;
+    flush();
+}
+
+
+// RPCWriter::flush
+//  - writes everything buffered in one socket write and empties the buffer
+//  - buffer capacity is kept so the writer can be reused for another frame
+
+void RPCWriter::flush() {
+    writeAndCheck(transport, buf.data(), buf.size());
+    buf.clear();
+}
+
+
+// RPCWriter::moveTo
+//  - appends everything buffered to dst and empties the buffer
+//  - when dst is empty, the buffers are swapped rather than copied
+
+void RPCWriter::moveTo(string &dst) {
+    if (dst.empty()) {
+        dst.swap(buf);
+    } else {
+        dst.append(buf);
+    }
+    buf.clear();
+}
+
+
+// writeStatusFrame
+//  - writes a response frame that carries only a status code, ie. an error or
+//    the success of a void function
+//  - the result size is still written, as 0, so that every response frame has
+//    the same layout
+
+void writeStatusFrame(RPCWriter &out, StatusCode code) {
+    writeInt(out, code);
+    writeInt(out, 0); // no result bytes
+}
+
+
+// readSpan
+//  - makes the next lenToRead bytes of in available in memory and returns a
+//    cursor over them, without copying them out of the read-ahead buffer
+//  - the bytes are consumed from in, but stay valid until the next read from
+//    in, so the cursor must be done with by then
+//  - throws if wrong number of bytes received, or lenToRead is more than
+//    MAX_FRAME_ARGS, before reading any of them
+
+RPCCursor readSpan(RPCReader &in, ssize_t lenToRead) {
+    if (lenToRead < 0 || lenToRead > MAX_FRAME_ARGS ||
+        in.ensure(lenToRead) != success) {
+        stringstream ss;
+        ss << "rpcutils.readSpan: " << lenToRead << " bytes could not be "
+           << "read";
+        throw RPCException(ss.str());
+    }
+
+    RPCCursor span(in.peek(), lenToRead);
+    in.consume(lenToRead);
+    return span;
 }
 
 
 // checkBytes
-//  - to be called after all bytes have been extracted from ss
+//  - to be called after all bytes have been extracted from in
 //  - checks if there were too few or too many bytes to fill args/result
 //
 //  note:
 //  - whether or not val bytes were correctly organized is NOT checked. this can
 //    only be checked during value parsing
 
-StatusCode checkBytes(stringstream &ss) {
-    if (ss.rdbuf()->in_avail() != 0) { // too many bytes even though args filled
-        return too_many_bytes;
-    } else if (ss.eof() && ss.fail()) { // too few bytes, args not fulfilled
+StatusCode checkBytes(RPCCursor &in) {
+    if (in.fail()) { // too few bytes, args not fulfilled
         return too_few_bytes;
+    } else if (in.remaining() != 0) { // too many bytes even though args filled
+        return too_many_bytes;
     } else {
         return good_bytes;
     }
@@ -177,12 +482,24 @@ string debugStatusCode(StatusCode code) {
             return "Received unexpected number of bytes";
         case no_null_term_found:
             return "No null-terminator received after string contents";
+        case timed_out:
+            return "Timed out waiting for bytes";
+        case unreachable:
+            return "Server could not be reached";
+        case not_gathered:
+            return "Call was not waited for";
+        case func_failed:
+            return "Function threw instead of returning";
 
         // function names
         case existing_func:
             return "Function requested exists";
         case nonexistent_func:
             return "Function requested does not exist";
+        case matching_interface:
+            return "Proxy and stub were generated from the same idl";
+        case mismatched_interface:
+            return "Proxy and stub were generated from different idls";
 
         // arguments/results
         case good_bytes:
@@ -203,110 +520,307 @@ string debugStatusCode(StatusCode code) {
 }
 
 
-// _extractNum
-//  - helper for extractInt/Float that reads from ss and switches byte order
+// RPCCursor::take
+//  - returns a pointer to the next len bytes and moves past them
+//  - if fewer than len bytes remain, the cursor fails and NULL is returned
 
-inline union N _extractNum(stringstream &ss) {
-    union N n;
-    ss.read(n.c, 4);
-    n.u = ntohl(n.u);
+const char *RPCCursor::take(size_t len) {
+    if (failed || len > remaining()) {
+        failed = true;
+        return NULL;
+    }
+
+    const char *bytes = pos;
+    pos += len;
+    return bytes;
+}
+
+
+// _extractNum
+//  - helper for extractInt/Float that reads from in and switches byte order
+//  - a failed cursor yields 0
+
+inline union N _extractNum(RPCCursor &in) {
+    union N n = { .u = 0 };
+    const char *bytes = in.take(4);
+    if (bytes != NULL) {
+        memcpy(n.c, bytes, 4);
+        n.u = ntohl(n.u);
+    }
     return n;
 }
 
 
 // extractInt
-//  - extracts and returns an int from a string stream
-//  - assumes that the int was in network byte order in the stream, and converts
-//    it back to host order before returning
+//  - extracts and returns an int from a cursor
+//  - assumes that the int was in network byte order, and converts it back to
+//    host order before returning
 
-int extractInt(stringstream &ss) {
-    return _extractNum(ss).i;
+int extractInt(RPCCursor &in) {
+    return _extractNum(in).i;
 }
 
 
 // extractFloat
-//  - extracts and returns a float from a string stream
-//  - assumes that the float was in network byte order in the stream, and
-//    and it back to host order before returning
+//  - extracts and returns a float from a cursor
+//  - assumes that the float was in network byte order, and converts it back to
+//    host order before returning
 
-float extractFloat(stringstream &ss) {
-    return _extractNum(ss).f;
+float extractFloat(RPCCursor &in) {
+    return _extractNum(in).f;
 }
 
 // extractString
-//  - extracts a string from a stringstream
+//  - extracts a string from a cursor
 //  - the length of the string (incl null-term) precedes the string itself
 //  - if a null terminator is not found as the last byte, exception is thrown
 //
 //  returns:
-//      - s, extracted string from ss, since null term found
+//      - s, extracted string from in, since null term found
+//      - empty string, if in ran out of bytes
 
-string extractString(stringstream &ss) {
-    int len = extractInt(ss);
-    char buf[len];
-    ss.read(buf, len);
+string extractString(RPCCursor &in) {
+    int len = extractInt(in);
+    if (in.fail()) return string();
+    if (len < 1) // not even room for a null term
+        throw RPCException("rpcutils.extractString: Null-term not found");
 
-    if (!ss.fail() && buf[len-1] != '\0')
+    const char *bytes = in.take(len);
+    if (bytes == NULL) return string();
+    if (bytes[len-1] != '\0')
         throw RPCException("rpcutils.extractString: Null-term not found");
 
-    return string(buf, len - 1); // -1 to exclude null term
+    return string(bytes, len - 1); // -1 to exclude null term
+}
+
+
+// extractSpan
+//  - extracts a run of bytes preceded by its length from a cursor, eg. one
+//    call of a batch, as a cursor of its own
+//  - if in runs out of bytes, or the length is negative, both in and the
+//    returned cursor fail
+
+RPCCursor extractSpan(RPCCursor &in) {
+    int len = extractInt(in);
+    const char *bytes = (len < 0) ? NULL : in.take(len);
+    if (bytes == NULL) {
+        in.take(in.remaining() + 1); // fail in, if the length did not
+        RPCCursor failed(NULL, 0);
+        failed.take(1);
+        return failed;
+    }
+
+    return RPCCursor(bytes, len);
+}
+
+
+
+// _swapWordsScalar
+//  - converts count 32 bit words from src between host and network byte order
+//    into dst, one at a time; handles whatever the vector versions leave over
+
+static void _swapWordsScalar(char *dst, const char *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t w;
+        memcpy(&w, src + 4 * i, 4);
+        w = htonl(w);
+        memcpy(dst + 4 * i, &w, 4);
+    }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// _swapWordsAVX2, _swapWordsSSSE3
+//  - same as _swapWordsScalar, 8 or 4 words per shuffle
+//  - compiled for their instruction sets regardless of build flags, and only
+//    called if the cpu has them, see _swapWords
+//
+//  returns: number of words converted, the rest are left for the caller
+
+__attribute__((target("avx2")))
+static size_t _swapWordsAVX2(char *dst, const char *src, size_t count) {
+    const __m256i mask = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i),
+                            _mm256_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t _swapWordsSSSE3(char *dst, const char *src, size_t count) {
+    const __m128i mask = _mm_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), _mm_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+#endif
+
+
+// _swapWords
+//  - converts count 32 bit words from src between host and network byte order
+//    into dst, using the widest vector shuffle the cpu supports
+//  - on big-endian hosts the orders are the same and this is a memcpy
+
+static void _swapWords(char *dst, const char *src, size_t count) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(dst, src, 4 * count);
+#else
+    size_t done = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if (hasAVX2) {
+        done = _swapWordsAVX2(dst, src, count);
+    } else if (hasSSSE3) {
+        done = _swapWordsSSSE3(dst, src, count);
+    }
+#endif
+    _swapWordsScalar(dst + 4 * done, src + 4 * done, count - done);
+#endif
+}
+
+
+// extractInts, extractFloats
+//  - extracts count ints/floats in network byte order from in into vals, eg.
+//    a whole int[100][100] in one go
+//  - if in runs out of bytes, it fails and vals is left untouched
+
+void extractInts(RPCCursor &in, int *vals, size_t count) {
+    const char *bytes = in.take(4 * count);
+    if (bytes != NULL) _swapWords((char *)vals, bytes, count);
 }
 
+void extractFloats(RPCCursor &in, float *vals, size_t count) {
+    const char *bytes = in.take(4 * count);
+    if (bytes != NULL) _swapWords((char *)vals, bytes, count);
+}
 
 
 // _readNum
 //  - helper for readInt/readFloat that performs the read and byte order switch
 
-inline union N _readNum(C150StreamSocket *sock) {
+inline union N _readNum(RPCReader &in) {
     union N n;
-    readAndThrow(sock, n.c, 4);
+    readAndThrow(in, n.c, 4);
     n.u = ntohl(n.u);
     return n;
 }
 
 
 // readInt
-//  - reads an int from sock and returns it in host byte order
+//  - reads an int from in and returns it in host byte order
 
-int readInt(C150StreamSocket *sock) {
-    return _readNum(sock).i;
+int readInt(RPCReader &in) {
+    return _readNum(in).i;
 }
 
 
 // readFloat
-//  - reads an float from sock and returns it in host byte order
+//  - reads an float from in and returns it in host byte order
 
-float readFloat(C150StreamSocket *sock) {
-    return _readNum(sock).f;
+float readFloat(RPCReader &in) {
+    return _readNum(in).f;
 }
 
 
 // writeInt
-//  - writes an int i to sock
+//  - writes an int i to transport
 //  - automatically converts i to network byte order before writing
 
-void writeInt(C150StreamSocket *sock, int i) {
+void writeInt(RPCTransport *transport, int i) {
     union N n = { .i = i };
     n.u = htonl(n.u); // convert to network byte order
-    writeAndCheck(sock, n.c, 4);
+    writeAndCheck(transport, n.c, 4);
 }
 
 
 // writeFloat
-//  - writes an float to sock
+//  - writes an float to transport
 //  - automatically converts f to network byte order before writing
 
-void writeFloat(C150StreamSocket *sock, float f) {
+void writeFloat(RPCTransport *transport, float f) {
     union N n = { .f = f };
     n.u = htonl(n.u); // conver to network byte order
-    writeAndCheck(sock, n.c, 4);
+    writeAndCheck(transport, n.c, 4);
 }
 
 
 // writeString
-//  - writes length of string and string to sock
+//  - writes length of string and string to transport
 //  - lenToWrite can't be 0 for string, must at least have null terminator
-void writeString(C150StreamSocket *sock, const string &s) {
-    writeInt(sock, s.length() + 1); // include null terminator
-    writeAndCheck(sock, s.c_str(), s.length() + 1);
+void writeString(RPCTransport *transport, const string &s) {
+    writeInt(transport, s.length() + 1); // include null terminator
+    writeAndCheck(transport, s.c_str(), s.length() + 1);
+}
+
+
+// writeInt
+//  - appends an int i to out in network byte order
+
+void writeInt(RPCWriter &out, int i) {
+    union N n = { .i = i };
+    n.u = htonl(n.u); // convert to network byte order
+    out.append(n.c, 4);
+}
+
+
+// writeFloat
+//  - appends a float f to out in network byte order
+
+void writeFloat(RPCWriter &out, float f) {
+    union N n = { .f = f };
+    n.u = htonl(n.u); // convert to network byte order
+    out.append(n.c, 4);
+}
+
+
+// writeString
+//  - appends length of string and string to out, incl null terminator
+
+void writeString(RPCWriter &out, const string &s) {
+    writeInt(out, s.length() + 1); // include null terminator
+    out.append(s.c_str(), s.length() + 1);
+}
+
+
+// _writeWords
+//  - appends count 32 bit words from vals to out in network byte order
+//  - converts through a small chunk that stays in cache, so each chunk is
+//    swapped and appended at close to memcpy speed without allocating
+
+static void _writeWords(RPCWriter &out, const char *vals, size_t count) {
+    const size_t CHUNK_WORDS = 1024;
+    char chunk[4 * CHUNK_WORDS];
+
+    for (size_t i = 0; i < count; i += CHUNK_WORDS) {
+        size_t n = (count - i < CHUNK_WORDS) ? count - i : CHUNK_WORDS;
+        _swapWords(chunk, vals + 4 * i, n);
+        out.append(chunk, 4 * n);
+    }
+}
+
+
+// writeInts, writeFloats
+//  - appends count ints/floats from vals to out in network byte order, eg. a
+//    whole int[100][100] in one go
+
+void writeInts(RPCWriter &out, const int *vals, size_t count) {
+    _writeWords(out, (const char *)vals, count);
+}
+
+void writeFloats(RPCWriter &out, const float *vals, size_t count) {
+    _writeWords(out, (const char *)vals, count);
 }
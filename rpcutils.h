@@ -8,13 +8,17 @@
 #define _RPCUTILS_H_
 
 #include <sstream>
+#include <string>
+#include <vector>
 #include <inttypes.h>
-#include "c150streamsocket.h"
 #include "c150exceptions.h"
+#include "c150grading.h"
 
 using namespace std;
 using namespace C150NETWORK;
 
+class RPCTransport; // see rpctransport.h
+
 
 // N
 //  - union to help handle endianness problem by allowing type punning
@@ -62,6 +66,8 @@ public:
 // StatusCode
 //  - used by stub to communicate to proxy whether or not values sent were
 //    accepted or not
+//  - sent as the first field of every response frame, success means that the
+//    result follows
 
 enum StatusCode {
     // 000 range - general
@@ -69,10 +75,15 @@ enum StatusCode {
     incomplete_bytes = 1, // unexpected number of bytes received
     no_null_term_found = 2,
     timed_out = 3,
+    unreachable = 4, // call could not be sent, or its connection broke
+    not_gathered = 5, // <func>_fanout returned before it was answered
+    func_failed = 6, // the function threw instead of returning
 
     // 100 range - function names
     existing_func = 100,
     nonexistent_func = 101,
+    matching_interface = 102, // proxy and stub built from the same idl
+    mismatched_interface = 103,
 
     // 200 range - arguments/results
     good_bytes = 200,
@@ -82,29 +93,185 @@ enum StatusCode {
 };
 
 
+// RPCWriter
+//  - output buffer for one request or response frame
+//  - while corked (the default), writes are only appended to the buffer and
+//    the whole frame goes out in a single socket write on flush
+//  - while uncorked, every write is sent immediately, as before
+//  - reserve the frame size up front so large frames are never reallocated
+//  - with no transport, frames are only collected, and handed off with
+//    moveTo, eg. to a server's per-connection output queue
+
+class RPCWriter {
+private:
+    RPCTransport *transport;
+    string buf;
+    bool corked;
+
+public:
+    RPCWriter(RPCTransport *transport, size_t sizeHint = 0);
+
+    void reserve(size_t len) { buf.reserve(buf.size() + len); }; // len more
+    void append(const char *data, size_t len);
+    void cork() { corked = true; };
+    void uncork(); // flushes anything buffered so far
+    void flush();
+    void moveTo(string &dst); // appends buffered bytes to dst and empties
+    void truncate(size_t len) { buf.resize(len); }; // drops bytes past len
+
+    const char *data() const { return buf.data(); };
+    size_t size() const { return buf.size(); };
+};
+
+
+// RPCReader
+//  - read-ahead buffer attached to a connection
+//  - every socket read pulls in as much as is available, and reads of single
+//    values are served from the buffer, so a small frame costs one read
+//  - unread bytes are kept contiguous (the buffer is compacted when it runs
+//    out of room at the end), and the buffer is reused for every message
+//  - timeouts apply per message: once the first bytes of a message arrive, the
+//    rest of it must arrive within the timeout, however many reads it takes
+
+class RPCReader {
+private:
+    RPCTransport *transport;
+    vector<char> buf;
+    size_t start, end; // unread bytes are buf[start, end)
+    int timeout; // ms per message, 0 for none
+    long long deadline; // ms, 0 until the current message starts arriving
+    bool abandoned; // out of sync with the frames, see abandon
+
+    void compact();
+    StatusCode sockRead(char *dst, size_t len, ssize_t &readlen);
+    StatusCode fill();
+
+public:
+    RPCReader(RPCTransport *transport, size_t capacity = 65536);
+
+    void reset(); // drops anything buffered, eg. for a new connection
+    void abandon(); // drops anything buffered and reads as eof from now on
+    void setTimeout(int ms) { timeout = ms; };
+    void beginMessage() { deadline = 0; };
+
+    StatusCode ensure(size_t len); // at least len contiguous bytes buffered
+                                   // (grows the buffer as they arrive)
+    StatusCode read(char *dst, size_t len);
+
+    // unread bytes, valid until the next ensure/read
+    const char *peek() const { return &buf[start]; };
+    void consume(size_t len) { start += len; };
+
+    size_t buffered() const { return end - start; };
+    bool eof() const;
+    bool timedout() const;
+};
+
+
+// RPCConnection
+//  - everything that belongs to one connection: its transport and the
+//    read-ahead buffer in front of it
+//  - owns the transport, which is deleted along with the connection
+
+struct RPCConnection {
+    RPCTransport *transport;
+    RPCReader reader;
+
+    RPCConnection(RPCTransport *transport) :
+        transport(transport), reader(transport)
+    {};
+    ~RPCConnection();
+};
+
+
+// RPCCursor
+//  - bounds checked cursor over bytes already in memory, eg. a frame still
+//    sitting in an RPCReader's buffer, that values are decoded from in place
+//  - taking more bytes than remain fails the cursor instead of reading past
+//    the end; checkBytes reports it as too_few_bytes
+
+class RPCCursor {
+private:
+    const char *pos;
+    const char *end;
+    bool failed;
+
+public:
+    RPCCursor(const char *data, size_t len) :
+        pos(data), end(data + len), failed(false)
+    {};
+
+    const char *take(size_t len); // NULL if fewer than len bytes remain
+    size_t remaining() const { return end - pos; };
+    bool fail() const { return failed; };
+};
+
+
 // constants
 const uint32_t VARDEBUG = 0x00000001; // debug flag for variables read/written
+const int MAX_FRAME_ARGS = 64 << 20; // most args or result bytes in a frame
+
+
+// RPCLOGCLASSES
+//  - the debug classes initDebugLog enabled, for rpcLogging
+//  - 0, ie. nothing logged, until it is called
+
+extern uint32_t RPCLOGCLASSES;
+
+
+// rpcLogging
+//  - whether logDebug would print anything for debugClasses, or for the
+//    grading log if grade is true; generated code checks it before it
+//    formats a message at all
+//  - compiled with -DRPC_NO_LOGGING it is always false, and with
+//    -DRPC_NO_GRADING grade is ignored, so the compiler can drop the
+//    logging from proxies and stubs entirely
+
+inline bool rpcLogging(uint32_t debugClasses, bool grade) {
+#ifdef RPC_NO_LOGGING
+    return false;
+#else
+#ifdef RPC_NO_GRADING
+    grade = false;
+#endif
+    return (debugClasses & RPCLOGCLASSES) != 0 || (grade && GRADING != NULL);
+#endif
+}
 
 
 // function declarations
-void initDebugLog(const char *logname, const char *progname, uint32_t classes);
+void initDebugLog(const char *logname, const char *progname, uint32_t classes,
+                  bool async = false);
 void logDebug(stringstream &debugStream, uint32_t debugClasses, bool grade);
-void logThrow(stringstream &debugStream, uint32_t debugClasses, bool grade);
+[[noreturn]] void logThrow(stringstream &debugStream, uint32_t debugClasses, bool grade);
 void printBytes(const unsigned char *buf, size_t buflen);
+long long rpcNowMs();
+long long rpcNowUs();
+long long rpcNowNs();
 
-StatusCode readAndCheck(C150StreamSocket *sock, char *buf, ssize_t lenToRead);
-void readAndThrow(C150StreamSocket *sock, char *buf, ssize_t lenToRead);
-void writeAndCheck(C150StreamSocket *sock, const char *buf, ssize_t lenToWrite);
-StatusCode checkBytes(stringstream &ss);
+StatusCode readAndCheck(RPCReader &in, char *buf, ssize_t lenToRead);
+void readAndThrow(RPCReader &in, char *buf, ssize_t lenToRead);
+void writeAndCheck(RPCTransport *transport, const char *buf, ssize_t lenToWrite);
+void writeStatusFrame(RPCWriter &out, StatusCode code);
+RPCCursor readSpan(RPCReader &in, ssize_t lenToRead);
+StatusCode checkBytes(RPCCursor &in);
 string debugStatusCode(StatusCode code);
 
-int extractInt(stringstream &ss);
-float extractFloat(stringstream &ss);
-string extractString(stringstream &ss);
-int readInt(C150StreamSocket *sock);
-float readFloat(C150StreamSocket *sock);
-void writeInt(C150StreamSocket *sock, int i);
-void writeFloat(C150StreamSocket *sock, float f);
-void writeString(C150StreamSocket *sock, const string &s);
+int extractInt(RPCCursor &in);
+float extractFloat(RPCCursor &in);
+string extractString(RPCCursor &in);
+RPCCursor extractSpan(RPCCursor &in);
+void extractInts(RPCCursor &in, int *vals, size_t count);
+void extractFloats(RPCCursor &in, float *vals, size_t count);
+int readInt(RPCReader &in);
+float readFloat(RPCReader &in);
+void writeInt(RPCTransport *transport, int i);
+void writeFloat(RPCTransport *transport, float f);
+void writeString(RPCTransport *transport, const string &s);
+void writeInt(RPCWriter &out, int i);
+void writeFloat(RPCWriter &out, float f);
+void writeString(RPCWriter &out, const string &s);
+void writeInts(RPCWriter &out, const int *vals, size_t count);
+void writeFloats(RPCWriter &out, const float *vals, size_t count);
 
 #endif
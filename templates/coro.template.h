@@ -0,0 +1,31 @@
+// coro.template.h
+//
+// Defines a template for the coroutine handlers header of an idl file, to be
+// filled in by rpcgenerate --coroutines
+//  - leaves Python format strings for where things should be filled out
+//    - e.g. {prefix}
+//
+// by: Justin Jo and Charles Wan
+
+// {prefix}.coro.h
+//
+// Coroutine handlers for {prefix}.idl, generated by rpcgenerate --coroutines
+//  - include this in place of {prefix}.idl, which it includes, where the
+//    server's functions are defined
+//  - the stubs call <func>_co instead of <func>: define each of them as a
+//    coroutine returning RPCTask of the idl result, which can co_await other
+//    servers' <func>_await proxies without holding a thread (see rpccoro.h)
+
+#ifndef {guard}
+#define {guard}
+
+#include <string>
+#include "rpccoro.h"
+
+using namespace std;
+
+#include "{prefix}.idl"
+
+{declarations}
+
+#endif
@@ -1,46 +1,136 @@
 // funcproxy.template.cpp
 //
-// Defines a template for dispatchFunction to be filled in by rpcgenerate
-//  - dispatchFunction is stub exclusive
+// Defines a template for dispatchRequest and dispatchFunction to be filled in
+// by rpcgenerate
+//  - both are stub exclusive
+//  - dispatchRequest answers one request frame that is already in memory, and
+//    is what servers that parse frames themselves call; the response starts
+//    with the request's call id, so the proxy can match it up
+//  - dispatchFunction reads a frame from a connection and dispatches it, or
+//    abandons the connection if no whole frame can be read
+//  - with rpcgenerate --coroutines, the switch is in dispatchCoroutine, which
+//    awaits the coroutine stubs; dispatchRequest runs it on the executor and
+//    waits, and dispatchAsync runs it without waiting. Otherwise dispatchAsync
+//    declines, see rpcstubhelper.h
+//  - the built-in stats call is answered before any idl function, see
+//    rpcstats.h
+//  - a traced call comes wrapped in its trace id, which is taken off before
+//    it is dispatched, and the dispatch is recorded, see rpctrace.h
 //  - leaves Python format strings for where things should be filled out
 //    - e.g. {funcname} 
 //
 // by: Justin Jo and Charles Wan
 
-void dispatchFunction() {{
-stringstream debugStream;
+{dispatchheader} {{
+RPCTraceId traceid = 0;
+if (funcid == RPCTRACEID) {{
+  funcid = rpctraceunwrap(argsIn, traceid);
+}}
+RPCTraceSpan span("dispatch", traceid, 't');
+writeInt(resOut, callid);
+size_t answerStart = resOut.size();
 
-if (!RPCSTUBSOCKET->eof()) {{
 try {{
-// read funcname length then name
-int funcnamelen = readInt(RPCSTUBSOCKET);
-char funcname[funcnamelen];
-readAndThrow(RPCSTUBSOCKET, funcname, funcnamelen);
+if (funcid == RPCSTATSID) {{
+  rpcstatsanswer(argsIn, resOut);
+  {statsreturn}
+}}
 
-if (funcname[funcnamelen - 1] != '\0') {{ // check funcname null termed
-  writeInt(RPCSTUBSOCKET, no_null_term_found);
-  throw RPCException("dispatchFunction: Function name not null terminated");
+// check func id validity, ids come from {prefix}.ids.h
+const char *funcname = rpcFuncName(funcid);
+if (funcname == NULL) {{
+  // nonexisting function requested, counted together
+  static RPCFuncStats *unknown = rpcstatsfunction("(unknown)");
+  stringstream debugStream;
+  debugStream << "Unknown function id " << funcid << " requested";
+  rpcstatsrecord(unknown, nonexistent_func, argsIn.remaining(), 8, 0, 0, 0);
+  writeStatusFrame(resOut, nonexistent_func);
+  logThrow(debugStream, C150APPLICATION, true);
 }}
 
+span.rename(funcname);
+
 // debug for func request
-debugStream << "Received function request for " << funcname << "()";
-logDebug(debugStream, C150APPLICATION, true);
-
-// branch to check funcname validity
-{% begin branches %}{funcBranches} else {% end branches %}{{
-  // nonexisting function requested
-  debugStream << "Unknown function " << funcname << "() requested";
-  writeInt(RPCSTUBSOCKET, nonexistent_func);
-  logThrow(debugStream, C150APPLICATION, true);
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Received function request for " << funcname << "()";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
+
+// jump straight to the func's stub, or rpcstubbatch for a batch of calls
+switch (funcid) {{
+{funcCases}
 }}
 
-debugStream << "Function request for " << funcname << "() complete";
-logDebug(debugStream, C150APPLICATION, true);
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Function request for " << funcname << "() complete";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
 }} catch (RPCException e) {{
   // something went wrong with dispatch, but shouldnt end server
   c150debug->printf(C150APPLICATION,
     "Caught %s",
     e.formattedExplanation().c_str());
+  rpcstubfailed(resOut, answerStart);
+}} catch (...) {{
+  // the function threw something else, which is still answered
+  rpcstubfailed(resOut, answerStart);
+}}{dispatchreturn}
+}}
+{% begin sync %}
+
+bool dispatchAsync(uint32_t funcid, uint32_t callid, string &args,
+                   function<void(RPCWriter &resOut)> done) {{
+return false; // no coroutines, dispatchRequest answers on the caller's thread
 }}
+{% end sync %}{% begin coroutine %}
+
+// runs a request whose args it owns, and hands its response to done
+static RPCTask<void> runAsync(uint32_t funcid, uint32_t callid, string args,
+                              function<void(RPCWriter &resOut)> done) {{
+RPCCursor argsIn(args.data(), args.size());
+RPCWriter resOut(NULL);
+co_await dispatchCoroutine(funcid, callid, argsIn, resOut);
+done(resOut);
+}}
+
+void dispatchRequest(uint32_t funcid, uint32_t callid, RPCCursor &argsIn,
+                     RPCWriter &resOut) {{
+RPCExecutor::wait(dispatchCoroutine(funcid, callid, argsIn, resOut));
+}}
+
+bool dispatchAsync(uint32_t funcid, uint32_t callid, string &args,
+                   function<void(RPCWriter &resOut)> done) {{
+RPCExecutor::spawn(runAsync(funcid, callid, move(args), move(done)));
+return true;
+}}
+
+{% end coroutine %}
+void dispatchFunction(RPCConnection &conn) {{
+if (!conn.reader.eof()) {{
+RPCWriter resOut(conn.transport); // response frame, incl error frames
+try {{
+// read whole request frame: func id, call id, args size, args
+// - served from the read-ahead buffer, usually one socket read per frame
+conn.reader.beginMessage();
+uint32_t funcid = readInt(conn.reader);
+uint32_t callid = readInt(conn.reader);
+
+int argsSize = readInt(conn.reader);
+RPCCursor argsIn = readSpan(conn.reader, argsSize); // no copy of args
+
+dispatchRequest(funcid, callid, argsIn, resOut);
+}} catch (const RPCException &e) {{
+  // frame never arrived whole, eg. eof, timed out or too big; what is left
+  // is not a frame, so the connection reads as eof and is closed
+  c150debug->printf(C150APPLICATION,
+    "Caught %s",
+    e.formattedExplanation().c_str());
+  conn.reader.abandon();
+}}
+
+// send whatever response frame was built in a single write
+resOut.flush();
 }}
 }}
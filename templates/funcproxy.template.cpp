@@ -1,73 +1,310 @@
 // funcproxy.template.cpp
 //
-// Defines a template for an rpc proxy function to be filled in by rpcgenerate
+// Defines a template for the rpc proxy functions of an idl function, to be
+// filled in by rpcgenerate
+//  - {funcname}_send sends a request frame and returns its call id without
+//    waiting, {funcname}_recv waits for the response to a call id,
+//    {funcname}_async sends and returns a future that receives, or abandons
+//    the call if it is dropped unwaited, and the proxy with the idl signature
+//    waits on {funcname}_async
+//  - {funcname}_batch sends many calls' args in one request frame, which the
+//    stub answers with one response frame holding every call's answer
+//  - {funcname}_fanout sends the same call to every server and gathers their
+//    answers, all of them or the first few
+//  - while calls are traced, each is sent wrapped in its trace id, and its
+//    phases are recorded, see rpctrace.h
 //  - leaves Python format strings for where things should be filled out
-//    - e.g. {funcname} 
+//    - e.g. {funcname}
 //
 // by: Justin Jo and Charles Wan
 
-{funcheader} {{
-stringstream debugStream;
+{sendheader} {{
+// request frame: func id, call id, args size, args
+// - frame is buffered and sent with a single write, sized up front
+RPCTraceId traceid = rpcTracing() ? rpctracenewid() : 0;
+long long traceNs = (traceid != 0) ? rpcNowNs() : 0;
+int argsSize = 0;
+{argsSizeAccumulate}
+RPCProxyConnection *conn = rpcproxycheckout(); // this thread's connection
+RPCWriter argsOut(rpcproxytransport(conn),
+                  rpctraceheadersize(traceid) + argsSize);
+RPCCallId callid = rpcproxynextcall(conn, traceid);
+
+try {{ // the call id is given back if the request is never sent
+if (rpcLogging(C150APPLICATION, true)) {{ // log func request
+  stringstream debugStream;
+  debugStream << "Requesting to call {funcname}()";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
+
+rpctraceheader(argsOut, RPCID_{funcname}, callid, argsSize, traceid);
+{% begin args %}
 
-//send funcname length then funcname
-string funcname = "{funcname}";
-int funcnamelen = funcname.length() + 1; // +1 for null terminator
+// buffer args one by one
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Sending arguments for {funcname}()";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
 
-debugStream << "Requesting to call {funcname}()"; // log func request
-logDebug(debugStream, C150APPLICATION, true);
+{sendArgs}{% end args %}
+}} catch (...) {{
+  rpcproxyunsent(conn, callid);
+  throw;
+}}
+if (traceid != 0) {{
+  rpctracebegin("{funcname}", traceid, traceNs);
+  rpctracespan("encode", traceNs, rpcNowNs(), traceid);
+}}
+rpcproxysend(conn, argsOut, traceid); // whole, even with other threads sending
+return callid;
+}}
 
-writeInt(RPCPROXYSOCKET, funcnamelen);
-writeAndCheck(RPCPROXYSOCKET, funcname.c_str(), funcnamelen);
+{recvheader} {{
+// response frame: call id, status code, result size, result bytes
+// - responses to other calls that arrive first are held until asked for
+RPCProxyResponse response;
+rpcproxyawait(callid, response);
+RPCCursor &resIn = response.resIn; // no copy of result, if it came in turn
+long long traceNs = (response.traceid != 0) ? rpcNowNs() : 0;
 
-// read funcname status code - does server know about this func?
-StatusCode funcnameCode = (StatusCode)readInt(RPCPROXYSOCKET);;
-if (funcnameCode != existing_func) {{
-  debugStream << "proxy.{funcname}: " << debugStatusCode(funcnameCode);
+if (response.code != success) {{
+  stringstream debugStream;
+  debugStream << "proxy.{funcname}: " << debugStatusCode(response.code);
   logThrow(debugStream, C150APPLICATION, true);
 }}
-{% begin args %}
+{% begin result %}
 
-// send total size of all args
-int argsSize = 0;
-{argsSizeAccumulate}
-writeInt(RPCPROXYSOCKET, argsSize);
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Receiving result for {funcname}()";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
 
-// send args one by one
-debugStream << "Sending arguments for {funcname}()";
-logDebug(debugStream, C150APPLICATION, true);
+// deconstruct result bytes into result for return
+{declareResult} // result must be named res
 
-{sendArgs}
-// read args status code - does server like args?
-StatusCode argsCode = (StatusCode)readInt(RPCPROXYSOCKET);
-if (argsCode != good_bytes) {{
-  debugStream << "proxy.{funcname}: " <<  debugStatusCode(argsCode) << ", for arguments";
+{readResult}{% end result %}
+StatusCode bytesCode = checkBytes(resIn); // void funcs expect no bytes
+if (bytesCode != good_bytes) {{
+  stringstream debugStream;
+  debugStream << "proxy.{funcname}: " <<  debugStatusCode(bytesCode) << ", for result";
   logThrow(debugStream, C150APPLICATION, true);
 }}
-{% end args %}
-{% begin result %}
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Call to {funcname}() complete";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
+if (response.traceid != 0) {{
+  long long doneNs = rpcNowNs();
+  rpctracespan("decode", traceNs, doneNs, response.traceid);
+  rpctraceend("{funcname}", response.traceid, doneNs);
+}}
+{returnResult}
+}}
+
+{asyncheader} {{
+// the request goes out now, the response is received by the future's get;
+// a future dropped without get abandons the call, see RPCPendingCall
+RPCCallId callid = {sendcall};
+return async(launch::deferred, [](RPCPendingCall call) {{
+  return {funcname}_recv(call.take());
+}}, RPCPendingCall(callid));
+}}
 
-debugStream << "Receiving result for {funcname}()";
-logDebug(debugStream, C150APPLICATION, true);
+{funcheader} {{
+RPCAwaitNow awaitNow; // the request may go out with the wait, see rpcproxysend
+{returnKeyword}{asynccall}.get();
+}}
 
-// read result size and result bytes
-int resSize = readInt(RPCPROXYSOCKET);
-char resBytes[resSize];
-readAndThrow(RPCPROXYSOCKET, resBytes, resSize);
+{batchheader} {{
+// request frame: batch id, call id, args size, then the number of calls and
+// each call's args, preceded by their size
+// - the whole batch is sized up front and sent with a single write
+RPCTraceId traceid = rpcTracing() ? rpctracenewid() : 0;
+long long traceNs = (traceid != 0) ? rpcNowNs() : 0;
+vector<int> callSizes(calls.size());
+int argsSize = 4;
+for (size_t c = 0; c < calls.size(); c++) {{
+int callSize = 0;
+{batchSizeAccumulate}
+callSizes[c] = callSize;
+argsSize += 4 + callSize;
+}}
+RPCAwaitNow awaitNow; // the request may go out with the wait, see rpcproxysend
+RPCProxyConnection *conn = rpcproxycheckout();
+RPCWriter argsOut(rpcproxytransport(conn),
+                  rpctraceheadersize(traceid) + argsSize);
+RPCCallId callid = rpcproxynextcall(conn, traceid);
 
-// use string stream to deconstruct result bytes into result for return
-stringstream ss;
-ss << string(resBytes, resSize);
-{declareResult} // result must be named res
+try {{ // the call id is given back if the request is never sent
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Requesting a batch of " << calls.size() << " calls to {funcname}()";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
 
-{readResult}
-StatusCode resCode = checkBytes(ss);
-if (resCode != good_bytes) {{
-  debugStream << "proxy.{funcname}: " <<  debugStatusCode(resCode) << ", for result";
+rpctraceheader(argsOut, RPCBATCHID_{funcname}, callid, argsSize, traceid);
+writeInt(argsOut, calls.size());
+for (size_t c = 0; c < calls.size(); c++) {{
+writeInt(argsOut, callSizes[c]);
+{batchSendArgs}
+}}
+}} catch (...) {{
+  rpcproxyunsent(conn, callid);
+  throw;
+}}
+if (traceid != 0) {{
+  rpctracebegin("{funcname}_batch", traceid, traceNs);
+  rpctracespan("encode", traceNs, rpcNowNs(), traceid);
+}}
+rpcproxysend(conn, argsOut, traceid);
+
+// response frame: call id, status, result size, then the number of answers
+// and each call's status, result size and result, as it would be on its own
+RPCProxyResponse response;
+rpcproxyawait(callid, response);
+RPCCursor &resIn = response.resIn;
+traceNs = (traceid != 0) ? rpcNowNs() : 0;
+
+if (response.code != success) {{
+  stringstream debugStream;
+  debugStream << "proxy.{funcname}_batch: " << debugStatusCode(response.code);
+  logThrow(debugStream, C150APPLICATION, true);
+}}
+
+vector<RPCBatchResult<{returntype}>> results(calls.size());
+StatusCode bytesCode = ((size_t)extractInt(resIn) == results.size()) ?
+  good_bytes : scrambled_bytes;
+for (size_t c = 0; c < results.size() && bytesCode == good_bytes; c++) {{
+results[c].code = (StatusCode)extractInt(resIn);
+RPCCursor callIn = extractSpan(resIn);
+{% begin batchresult %}
+if (results[c].code == success) {{
+{declareResult}
+{batchReadResult}
+results[c].res = res;
+}}
+{% end batchresult %}
+bytesCode = checkBytes(callIn);
+}}
+if (bytesCode == good_bytes) {{
+  bytesCode = checkBytes(resIn);
+}}
+if (bytesCode != good_bytes) {{
+  stringstream debugStream;
+  debugStream << "proxy.{funcname}_batch: " <<  debugStatusCode(bytesCode) << ", for results";
   logThrow(debugStream, C150APPLICATION, true);
 }}
-debugStream << "Call to {funcname}() complete";
-logDebug(debugStream, C150APPLICATION, true);
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Batch of calls to {funcname}() complete";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
+if (traceid != 0) {{
+  long long doneNs = rpcNowNs();
+  rpctracespan("decode", traceNs, doneNs, traceid);
+  rpctraceend("{funcname}_batch", traceid, doneNs);
+}}
+return results;
+}}
 
-return res;
-{% end result %}
+{fanoutheader} {{
+// args are encoded once, and sent to every server behind a request header
+// of its own, since each connection has its own call ids; each is traced as
+// a call of its own, from its header to its answer being decoded
+long long traceNs = rpcTracing() ? rpcNowNs() : 0;
+int argsSize = 0;
+{argsSizeAccumulate}
+RPCWriter argsOut(NULL, argsSize);
+{sendArgs}
+if (traceNs != 0) {{
+  rpctracespan("encode", traceNs, rpcNowNs()); // shared by every call
+}}
+
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Requesting {funcname}() of " << rpcproxyendpoints() << " servers";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
+
+vector<RPCBatchResult<{returntype}>> results(rpcproxyendpoints());
+vector<RPCCallId> callids(results.size(), 0); // 0 if never sent
+vector<RPCTraceId> traceids(results.size(), 0); // 0 if not begun
+for (size_t t = 0; t < results.size(); t++) {{
+results[t].code = not_gathered;
+try {{
+  RPCTraceId traceid = rpcTracing() ? rpctracenewid() : 0;
+  traceNs = (traceid != 0) ? rpcNowNs() : 0;
+  RPCProxyConnection *conn = rpcproxycheckout(t);
+  RPCWriter frameOut(rpcproxytransport(conn),
+                     rpctraceheadersize(traceid) + argsSize);
+  RPCCallId callid = rpcproxynextcall(conn, traceid);
+  try {{ // the call id is given back if the request is never sent
+    rpctraceheader(frameOut, RPCID_{funcname}, callid, argsSize, traceid);
+    frameOut.append(argsOut.data(), argsOut.size());
+  }} catch (...) {{
+    rpcproxyunsent(conn, callid);
+    throw;
+  }}
+  if (traceid != 0) {{
+    rpctracebegin("{funcname}_fanout", traceid, traceNs);
+    rpctracespan("encode", traceNs, rpcNowNs(), traceid);
+    traceids[t] = traceid;
+  }}
+  rpcproxysend(conn, frameOut, traceid);
+  callids[t] = callid;
+}} catch (C150Exception &e) {{
+  results[t].code = unreachable;
+  if (traceids[t] != 0) {{
+    rpctraceend("{funcname}_fanout", traceids[t], rpcNowNs());
+  }}
+}}
+}}
+
+// every server works on the call at once; the slowest one gathered decides
+// how long this takes
+for (int t : rpcproxygather(callids, first)) {{
+RPCProxyResponse response;
+try {{
+  rpcproxyawait(callids[t], response);
+}} catch (C150Exception &e) {{
+  results[t].code = unreachable;
+  if (traceids[t] != 0) {{
+    rpctraceend("{funcname}_fanout", traceids[t], rpcNowNs());
+  }}
+  continue;
+}}
+RPCCursor &resIn = response.resIn;
+results[t].code = response.code;
+traceNs = (traceids[t] != 0) ? rpcNowNs() : 0;
+{% begin fanoutresult %}
+if (results[t].code == success) {{
+{declareResult}
+{readResult}
+results[t].res = res;
+}}
+{% end fanoutresult %}
+StatusCode bytesCode = checkBytes(resIn);
+if (results[t].code == success && bytesCode != good_bytes) {{
+  results[t].code = bytesCode; // this server's answer only
+}}
+if (traceids[t] != 0) {{
+  long long doneNs = rpcNowNs();
+  rpctracespan("decode", traceNs, doneNs, traceids[t]);
+  rpctraceend("{funcname}_fanout", traceids[t], doneNs);
+}}
+}}
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Call to {funcname}() of every server complete";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
+for (size_t t = 0; t < results.size(); t++) {{
+if (results[t].code == not_gathered && traceids[t] != 0) {{
+  rpctraceend("{funcname}_fanout", traceids[t], rpcNowNs()); // left behind
+}}
+}}
+return results;
 }}
@@ -3,56 +3,85 @@
 // Defines a template for an rpc stub function to be filled in by rpcgenerate
 //  - leaves Python format strings for where things should be filled out
 //    - e.g. {funcname} 
+//  - args bytes have already been read off the socket by dispatchFunction, and
+//    are decoded in place through argsIn
+//  - the response frame is buffered in resOut after the call id that
+//    dispatchRequest wrote, and dispatchFunction flushes it
+//  - with rpcgenerate --coroutines, the stub is itself a coroutine that
+//    awaits the handler {funcname}_co instead of calling {funcname}
+//  - every call is timed and counted in the function's stats, see rpcstats.h,
+//    and while calls are traced, its phases are recorded, see rpctrace.h
 //
 // by: Justin Jo and Charles Wan
 
-void _{funcname}() {{
-stringstream debugStream;
+{stubtype} _{funcname}(RPCCursor &argsIn, RPCWriter &resOut) {{
+static RPCFuncStats *stats = rpcstatsfunction("{funcname}");
+long long startNs = rpcstatsclock();
+size_t bytesIn = argsIn.remaining(), resStart = resOut.size();
+StatusCode argsCode = good_bytes; // assume that args are good for now
 {% begin args %}
 
-// reag args size then all args bytes
-debugStream << "Receiving arguments for {funcname}()";
-logDebug(debugStream, C150APPLICATION, true);
-
-int argsSize = readInt(RPCSTUBSOCKET);
-char argsBytes[argsSize];
-readAndThrow(RPCSTUBSOCKET, argsBytes, argsSize);
-
-// use string stream to deconstruct args bytes into args
-stringstream ss;
-ss << string(argsBytes, argsSize);
-StatusCode argsCode = good_bytes; // assume that args are good for now
+// deconstruct args bytes into args
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Receiving arguments for {funcname}()";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
 
 {declareArgs}
+{% end args %}
 
+// funcs without args still check that no stray bytes were sent
 try {{
 {readArgs}
-argsCode = checkBytes(ss);
+argsCode = checkBytes(argsIn);
 }} catch (RPCException e) {{ // should only be from extractString
   argsCode = scrambled_bytes;
 }}
 
-// send args code
-writeInt(RPCSTUBSOCKET, argsCode);
+// bad args are answered with a status only response frame
 if (argsCode != good_bytes) {{
-  debugStream << "proxy.{funcname}: " <<  debugStatusCode(argsCode) << ", for arguments";
+  writeStatusFrame(resOut, argsCode);
+  rpcstatsrecord(stats, argsCode, bytesIn, resOut.size() - resStart,
+                 rpcstatsclock() - startNs, 0, 0);
+  stringstream debugStream;
+  debugStream << "stub.{funcname}: " <<  debugStatusCode(argsCode) << ", for arguments";
   logThrow(debugStream, C150APPLICATION, true);
 }}
 
-{% end args %}
 // call real func with args
-debugStream << "Calling {funcname}()";
-logDebug(debugStream, C150APPLICATION, true);
+long long decodedNs = rpcstatsclock();
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Calling {funcname}()";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
 {callFunction} // must declare a result variable res, if return value exists
+long long executedNs = rpcstatsclock();
 {% begin result %}
 
-// send result size back then result
-debugStream << "Sending result of call to {funcname}()";
-logDebug(debugStream, C150APPLICATION, true);
+// send rest of response frame: status, result size then result
+if (rpcLogging(C150APPLICATION, true)) {{
+  stringstream debugStream;
+  debugStream << "Sending result of call to {funcname}()";
+  logDebug(debugStream, C150APPLICATION, true);
+}}
 
 int resSize = 0;
 {resSizeAccumulate}
-writeInt(RPCSTUBSOCKET, resSize);
+resOut.reserve(8 + resSize);
+writeInt(resOut, success);
+writeInt(resOut, resSize);
 
 {sendRes}{% end result %}
+
+long long encodedNs = rpcstatsclock();
+rpcstatsrecord(stats, success, bytesIn, resOut.size() - resStart,
+               decodedNs - startNs, executedNs - decodedNs,
+               encodedNs - executedNs);
+if (rpcTracing()) {{
+  rpctracespan("decode", startNs, decodedNs);
+  rpctracespan("execute", decodedNs, executedNs);
+  rpctracespan("encode", executedNs, encodedNs);
+}}
 }}
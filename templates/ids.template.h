@@ -0,0 +1,40 @@
+// ids.template.h
+//
+// Defines a template for the function ids header of an idl file, to be filled
+// in by rpcgenerate
+//  - leaves Python format strings for where things should be filled out
+//    - e.g. {prefix}
+//
+// by: Justin Jo and Charles Wan
+
+// {prefix}.ids.h
+//
+// Function ids for {prefix}.idl, generated by rpcgenerate
+//  - included by both {prefix}.proxy.cpp and {prefix}.stub.cpp
+//  - proxies send a function's id in place of its name, and its RPCBATCHID
+//    for a <func>_batch request
+//  - a proxy sends RPCINTERFACEID when it connects, and the stub refuses the
+//    connection if its own differs, ie. they were built from different idls
+
+#ifndef {guard}
+#define {guard}
+
+#include <cstddef>
+#include <inttypes.h>
+
+const uint32_t RPCINTERFACEID = {interfaceid};
+
+{funcIds}
+
+// rpcFuncName
+//  - returns the name of the function with id funcid, NULL if there is none
+
+inline const char *rpcFuncName(uint32_t funcid) {{
+switch (funcid) {{
+{nameCases}
+default:
+  return NULL;
+}}
+}}
+
+#endif
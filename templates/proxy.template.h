@@ -0,0 +1,62 @@
+// proxy.template.h
+//
+// Defines a template for the proxy header of an idl file, to be filled in by
+// rpcgenerate
+//  - leaves Python format strings for where things should be filled out
+//    - e.g. {prefix}
+//
+// by: Justin Jo and Charles Wan
+
+// {prefix}.proxy.h
+//
+// Pipelined proxies for {prefix}.idl, generated by rpcgenerate
+//  - include this in place of {prefix}.idl, which it includes
+//  - <func>_send sends a call without waiting for it and returns its call id;
+//    <func>_recv waits for the result of that call. Many calls can be sent
+//    before any is received, so they share round trips instead of paying one
+//    each
+//  - calls can be received in any order, and the server may answer them in
+//    any order too; responses that arrive before they are asked for are held.
+//    Every call sent must be received exactly once
+//  - proxies may be called from any number of threads at once; each thread's
+//    calls go out on the connection it checked out of the pool, see
+//    rpcproxyinitialize
+//  - <func>_async sends a call the same way and returns a future of its
+//    result; get on the future receives it, as <func>_recv would, so the
+//    caller can do local work, or make other calls, while it is in flight.
+//    A future destroyed without get abandons its call: the response is
+//    dropped when it arrives, see rpcproxyabandon
+//  - <func> itself is <func>_async(...).get()
+//  - <func>_batch makes many calls to <func> in one round trip: it takes the
+//    args of each call as a <func>_args, and returns each call's status and
+//    result in the same order. A call that fails does not fail the others
+//  - <func>_fanout makes the same call on every server given to
+//    rpcproxyinitialize at once, and returns each one's status and result in
+//    the order they were given; with first set, it returns once that many
+//    have answered, and the rest are not_gathered. A server that cannot be
+//    reached is unreachable
+//  - compiled as c++20, <func>_await sends a call too and returns an
+//    RPCCall, for a coroutine to co_await without holding a thread; see
+//    rpccoro.h
+
+#ifndef {guard}
+#define {guard}
+
+#include <string>
+#include <future>
+#include <vector>
+#include "rpcproxyhelper.h"
+
+using namespace std;
+
+#include "{prefix}.idl"
+
+{declarations}
+
+#ifdef __cpp_impl_coroutine
+#include "rpccoro.h"
+
+{awaitproxies}
+#endif
+
+#endif